@@ -0,0 +1,22 @@
+#ifndef __BURST_H
+#define __BURST_H
+
+#include "stm32l0xx_hal.h"
+#include "sine_cs.h"
+
+// burst counter: TIM21 trigger output pulses at channel 1 compare match, TIM22 counts the pulses (ITR0 is TIM21 TRGO).
+// Compare flags are set only when TIM21 counts down in table mode, so a pulse is channel 1 switch off, once per period.
+// Edge-aligned phase accumulator mode pulses at switch on too, twice per period. Counter end interrupt stops TIM2,
+// so DAC, DMA and commutator are frozen in the dead-time after channel 1 switch off and continue from there
+#define BURST_COUNTER_TOP 		0xFFFF 		// TIM22 ARR, counter is preset so that overflow is the last pulse
+#define BURST_COMM_GPIO_PORT 	GPIOA
+#define BURST_COMM_CH1_PIN 		GPIO_PIN_2 	// TIM21_CH1
+
+void burst_Init(void);
+void burst_Sync(void);
+void burst_Start(uint16_t pulses);
+void burst_Release(void);
+uint8_t burst_IsGated(void);
+void burst_IrqHandler(void);
+
+#endif
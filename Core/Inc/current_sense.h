@@ -0,0 +1,54 @@
+#ifndef __CURRENT_SENSE_H
+#define __CURRENT_SENSE_H
+
+#include "stm32l0xx_hal.h"
+#include "sine_cs.h"
+
+// shunt amplifier output is sampled by ADC at each TIM2 update, together with DAC sample update.
+// Shunt amplifier output is assumed on PA0 (ADC_IN0), board wiring is changed here. The pin is not in the CubeMX
+// project, it is configured analog by currentSense_Init()
+#define CURRENT_SENSE_ADC_CHANNEL 		ADC_CHSELR_CHSEL0
+#define CURRENT_SENSE_GPIO_PORT 		GPIOA
+#define CURRENT_SENSE_GPIO_PIN_POS 		0
+#define CURRENT_SENSE_BLOCK_SAMPLES 	(SINE_CAPTURE_SAMPLES/2) 	// DMA half transfer, samples are accumulated once per block
+// 1 - the assumed channel is checked on the board. Until then RMS is measured and captured, but the closed loop is
+// not enabled: a floating input would drive the loop gain to its limit. The simulator models the shunt on ADC_IN0
+#ifndef CURRENT_SENSE_CHANNEL_CONFIRMED
+#define CURRENT_SENSE_CHANNEL_CONFIRMED 	0
+#endif
+
+// capture: DAC output register and commutator pins are read by DMA at TIM2 compare, after ADC sample is stored and
+// before the next DAC update. DMA1 channel 3 is TIM2_CH2 request, channel 4 is TIM2_CH4 request (request 8)
+#define CURRENT_SENSE_CAPTURE_CC 		10 		// TIM2 counter, us after DAC and ADC trigger
+#define CURRENT_SENSE_SLOT_START 		12 		// TIM2 counter window, in which no capture DMA transfer happens
+#define CURRENT_SENSE_SLOT_END 			17
+#define CURRENT_SENSE_COMM_CH1_PIN 		GPIO_PIN_2 	// TIM21_CH1, GPIOA
+#define CURRENT_SENSE_COMM_CH2_PIN 		GPIO_PIN_3 	// TIM21_CH2, GPIOA
+
+typedef enum
+{
+	CAPTURE_IDLE = 0,
+	CAPTURE_ARMED, 		// ring is recorded, trigger is searched each block
+	CAPTURE_DONE, 		// ring is frozen, current sense is paused
+}captureState;
+
+// sums over a window of whole sine periods
+typedef struct
+{
+	uint64_t sumSq; 	// sum of squared samples
+	uint32_t sum; 		// sum of samples
+	uint32_t samples; 	// window length
+}currentSenseWindow;
+
+void currentSense_Init(void);
+void currentSense_SetWindow(uint32_t samples);
+uint8_t currentSense_GetWindow(currentSenseWindow* window);
+void currentSense_Discard(void);
+void currentSense_DmaHandler(void);
+void currentSense_Resync(void);
+void currentSense_CaptureCtrl(uint8_t trigger);
+captureState currentSense_GetCaptureState(void);
+uint16_t currentSense_GetCaptureTrigger(void);
+uint16_t currentSense_ReadCapture(uint32_t* record, uint16_t first, uint16_t num);
+
+#endif
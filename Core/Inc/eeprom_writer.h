@@ -0,0 +1,21 @@
+#ifndef __EEPROM_WRITER_H
+#define __EEPROM_WRITER_H
+
+#include "stm32l0xx_hal.h"
+
+#define EEPROM_WRITER_MAX_WORDS 32 // the longest record written at once
+
+typedef enum
+{
+	EEPROM_WRITER_IDLE = 0,
+	EEPROM_WRITER_BUSY, 	// words are being written
+	EEPROM_WRITER_DONE, 	// the last job is written and verified
+	EEPROM_WRITER_ERROR, 	// the last job failed, data EEPROM is locked
+}eepromWriterState;
+
+uint8_t eepromWriter_Start(uint32_t address, const uint32_t* data, uint8_t words);
+eepromWriterState eepromWriter_Process(uint8_t is_write_allowed);
+eepromWriterState eepromWriter_GetState(void);
+uint32_t eepromWriter_GetWrites(void);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef __JOURNAL_H
+#define __JOURNAL_H
+
+#include "stm32l0xx_hal.h"
+#include "eeprom_writer.h"
+
+// append-only journal over the whole data EEPROM. Each record takes the next slot, so saves are spread over
+// all slots; the record with the highest sequence number and valid CRC is the actual one
+#define JOURNAL_ADDR 			0x08080000
+#define JOURNAL_SIZE 			2048
+#define JOURNAL_SLOT_WORDS 		EEPROM_WRITER_MAX_WORDS
+#define JOURNAL_SLOTS 			(JOURNAL_SIZE/(4*JOURNAL_SLOT_WORDS))
+#define JOURNAL_MAX_PAYLOAD 	(JOURNAL_SLOT_WORDS - 3) // words, header, sequence number and CRC are excluded
+
+// record header: magic, record type, record version, payload length in words
+#define JOURNAL_MAGIC 			0xA5
+#define JOURNAL_HEADER(type, version, words) 	(((uint32_t)JOURNAL_MAGIC << 24) | ((uint32_t)(type) << 16) | \
+												((uint32_t)(version) << 8) | (words))
+
+uint8_t journal_Init(void);
+uint8_t journal_Load(uint8_t type, void* payload, uint8_t max_words, uint8_t* version);
+uint8_t journal_Append(uint8_t type, uint8_t version, const void* payload, uint8_t words);
+uint32_t journal_GetSequence(void);
+uint32_t journal_CalcCrc(const uint32_t* data, uint16_t words);
+
+#endif
@@ -2,9 +2,328 @@
 #define __SINE_CS_H
 
 #include "stm32l0xx_hal.h"
+#include "sine_kernel.h"
 
-#define SINE_SAMPLES_NUM 500
-#define EEPROM_CAL_DATA_ADDR 0x08080000
+#define SINE_FW_VERSION 0x0200 		// major.minor
+
+// interrupt priorities, Cortex-M0+ has 4 levels, 0 is the highest. Commutator edges preempt everything, DAC buffer
+// refill and swap preempt USB, so long USB requests delay neither. SysTick has the lowest level (TICK_INT_PRIORITY)
+#define SINE_IRQ_PRIO_COMMUTATOR 	0
+#define SINE_IRQ_PRIO_DAC_DMA 		1
+#define SINE_IRQ_PRIO_USB 			2
+#define SINE_IRQ_PRIO_CURRENT_SENSE 2 		// ADC block accumulation and capture trigger, 1,28 ms period
+
+#define SAMPLE_TIMER_TICK_US 	1 	// TIM2 counter tick, TIM2 counter is sub-sample time stamp
+
+// build options
+#ifndef SINE_LEAN_ISR
+#define SINE_LEAN_ISR 1 			// DAC DMA and TIM21 interrupts are decoded at register level, not by HAL handlers
+#endif
+#ifndef SINE_ISR_STATS
+#define SINE_ISR_STATS 1 			// measure DAC DMA and TIM21 interrupts duration by SysTick
+#endif
+#define EEPROM_CAL_DATA_ADDR 0x08080000 // calibration block of previous firmware versions, read if journal is empty
+// data EEPROM word programming stalls CPU up to 3.2 ms. Writes start only during the first samples after DMA
+// buffer boundary; in phase accumulator mode commutator interrupts come each half period, so above this frequency
+// writes wait until output is switched off
+#define EEPROM_WRITE_SLOT_SAMPLES 50
+#define EEPROM_WRITE_FREQ_MAX 120000 // mHz
+
+#define SINE_FREQ_TABLE 50000 		// mHz, SINE_SAMPLES_NUM samples per half period, table mode is used
+#define SINE_FREQ_MIN 500 			// mHz, half period in samples must fit into TIM21 16-bit counter
+#define SINE_FREQ_MAX 400000 		// mHz
+// commutator dead-time in TIM21 ticks (DAC samples, 20 us)
+#define SINE_DEAD_TIME_MIN 		1
+#define SINE_DEAD_TIME_MAX 		25
+#define SINE_DEAD_TIME_DEFAULT 	1
+#define SINE_DEAD_TIME_SWEEP_HALF_PERIODS 50 // calibration sweep step duration
+
+// table mode commutator: TIM21 counts up and down once per sine period in center-aligned mode,
+// channel 1 (PWM2) is active around counter top, channel 2 (PWM1) around counter bottom.
+// Dead-time is the pulses difference, split around the commutation point
+#define COMM_TABLE_PERIOD 			SINE_SAMPLES_NUM 			// TIM21 ARR
+#define COMM_TABLE_START_CNT 		(SINE_SAMPLES_NUM/2 - 1) 	// TIM21 counter at the first DAC sample
+#define COMM_TABLE_CH1_PULSE(dt) 	(SINE_SAMPLES_NUM/2 + ((dt) + 1)/2)
+#define COMM_TABLE_CH2_PULSE(dt) 	(SINE_SAMPLES_NUM/2 - (dt)/2)
+// amplitude calibration: DAC amplitude at 1, 2 ... SINE_CAL_POINTS A, piecewise linear between points
+#define SINE_CAL_POINTS 		7
+#define SINE_CAL_AMPL_1A 		124 					// DAC amplitude at 1A until calibration is loaded
+#define SINE_AMPL_MAX 			(SINE_CAL_POINTS*10) 	// 0,1 A
+#define SINE_RAW_AMPL_MIN 		50
+// output stage current limit: full scale calibration point plus 10% for calibration spread and loop correction.
+// Raw amplitudes and the corrected envelope are clamped to it, so no command or loop gain drives the stage above 7,7 A
+#define SINE_RAW_AMPL_MAX 		(SINE_CAL_AMPL_1A*SINE_CAL_POINTS*11/10)
+
+// full period mode: DMA replays both DAC buffers as one full period, the first half is played with channel 1 (positive)
+// switched on, the second one with channel 2 (negative). Negative half amplitude is scaled by gain in 1/4096 units
+#define SINE_FULL_PERIOD_SAMPLES 	(2*SINE_SAMPLES_NUM)
+#define SINE_POLARITY_GAIN_ONE 		4096
+#define SINE_POLARITY_GAIN_MIN 		2048
+#define SINE_POLARITY_GAIN_MAX 		6144
+
+// closed loop: shunt RMS is measured over windows of whole periods, at least SINE_RMS_WINDOW_MIN samples long.
+// PI regulator corrects envelope by gain in 1/65536 units, each settled window. Gains are per unit relative error
+#define SINE_RMS_WINDOW_MIN 		(2*SINE_SAMPLES_NUM)
+#define SINE_LOOP_GAIN_ONE 			65536
+#define SINE_LOOP_GAIN_MIN 			(SINE_LOOP_GAIN_ONE*3/4)
+#define SINE_LOOP_GAIN_MAX 			(SINE_LOOP_GAIN_ONE*5/4)
+#define SINE_LOOP_KP 				13107 	// 0,2
+#define SINE_LOOP_KI 				6554 	// 0,1
+#define SINE_LOOP_SETTLE_WINDOWS 	2 		// windows skipped after amplitude change, the first one holds old samples
+
+// capture: shunt ADC sample, DAC output code and commutator outputs of the same DAC sample period are recorded into
+// a ring, which is frozen after trigger. Record is read over capture bulk endpoint, SINE_CAPTURE_x words per sample
+// Record is 2,56 ms, shorter than a half period: a 50 Hz period is 1000 samples of 5 bytes, more than the RAM left
+// by DAC buffers (2000 bytes), waveform slot (1000 bytes), USB, stack and heap. Commutator triggers place the switch on
+// with dead-time and up to 1,28 ms after it into the record
+#define SINE_CAPTURE_SAMPLES 		128 	// must be power of 2
+#define SINE_CAPTURE_STOP 			0 		// capture is released, current sense continues
+#define SINE_CAPTURE_NOW 			1 		// trigger at once, when pre-trigger samples are recorded
+#define SINE_CAPTURE_POSITIVE 		2 		// trigger at channel 1 (positive half) switch on
+#define SINE_CAPTURE_NEGATIVE 		3 		// trigger at channel 2 (negative half) switch on
+// capture sample word
+#define SINE_CAPTURE_ADC_MASK 		0x00000FFFUL
+#define SINE_CAPTURE_DAC_POS 		12
+#define SINE_CAPTURE_DAC_MASK 		0x00FFF000UL
+#define SINE_CAPTURE_CH1 			0x01000000UL
+#define SINE_CAPTURE_CH2 			0x02000000UL
+#define SINE_CAPTURE_TRIGGER 		0x80000000UL 	// trigger sample
+
+// uploaded waveform: one RAM slot of SINE_SAMPLES_NUM half period samples, 0...SINE_WAVE_MAX for amplitude. Slot is
+// written while it is not active and is activated after CRC check of the whole slot as little-endian 32-bit words.
+// CRC unit defaults: CRC-32/MPEG-2 - polynomial 0x04C11DB7, init 0xFFFFFFFF, no input/output reflection, no final
+// XOR. It is not zlib/Ethernet CRC-32 (reflected, final XOR), host must calculate the same MPEG-2 variant
+// Active waveform replaces sine in table and full period modes, phase accumulator keeps sine
+#define SINE_WAVE_WORDS 			(SINE_SAMPLES_NUM/2)
+// harmonic command value: amplitude 0...SINE_WAVE_MAX, odd order, phase 0...SINE_HARMONIC_PHASES-1
+#define SINE_HARMONIC_VALUE(order, ampl, phase) 	((ampl) | ((uint32_t)(order) << 12) | ((uint32_t)(phase) << 16))
+
+// sequencer: segments are timed by half periods counter. Amplitude of the next segment is staged one half period
+// ahead and takes effect at segment boundary, frequency change restarts generator at the boundary
+#define SINE_SEQUENCE_SEGMENTS 		16
+#define SINE_SEQUENCE_IDLE 			0xFF 	// status sequence segment, when sequencer is not running
+
+// burst: generator is gated by TIM22 counter of commutator periods (see burst.h) and holds both channels off between
+// bursts, with power stage on. The first burst waits until the burst amplitude is played out of DAC buffers, next
+// ones start each interval from the main loop. Envelope is not ramped in burst mode
+#define SINE_BURST_CYCLES_MAX 		32767 	// burst counter is 16-bit, two pulses per period in phase accumulator mode
+#define SINE_BURST_SETTLE_MS 		11 		// DAC buffer play time, after new amplitude is taken
+// status burst state
+#define SINE_BURST_OFF 				0
+#define SINE_BURST_ARMING 			1 		// waiting for burst amplitude in DAC buffers, power stage is off
+#define SINE_BURST_SYNC 			2 		// waiting for the first gate
+#define SINE_BURST_WAITING 			3 		// generator is gated until the next burst
+#define SINE_BURST_RUNNING 			4
+
+#define RAMP_STEPS_PER_SECOND (DAC_SAMPLE_RATE/SINE_SAMPLES_NUM) // envelope is stepped at each DAC buffer period
+
+// deferred driver commands, executed from main loop
+#define SINE_CS_CMD_POWER_CTRL			0x01
+#define SINE_CS_CMD_CALIB_MODE_CTRL		0x02
+#define SINE_CS_CMD_SAVE_CALIB_DATA		0x03
+#define SINE_CS_CMD_SET_RAW_OFFSET		0x04
+#define SINE_CS_CMD_SET_RAW_AMPL		0x05
+#define SINE_CS_CMD_SET_AMPL			0x06
+#define SINE_CS_CMD_SET_FREQ			0x07
+#define SINE_CS_CMD_SET_RAMP_RATE		0x08
+#define SINE_CS_CMD_SET_DEAD_TIME		0x09
+#define SINE_CS_CMD_DEAD_TIME_SWEEP		0x0A
+#define SINE_CS_CMD_SAVE_SETTINGS		0x0B
+#define SINE_CS_CMD_SET_CAL_POINT		0x0C
+#define SINE_CS_CMD_FULL_PERIOD_CTRL	0x0D
+#define SINE_CS_CMD_CALIB_POLARITY		0x0E
+#define SINE_CS_CMD_LINEARIZATION_CTRL	0x0F
+#define SINE_CS_CMD_SET_LINEARIZATION	0x10 	// uploaded curve is applied, value is not used
+#define SINE_CS_CMD_LOOP_CTRL			0x11
+#define SINE_CS_CMD_CAPTURE_CTRL		0x12
+#define SINE_CS_CMD_WAVE_ACTIVATE		0x13 	// value - slot CRC-32/MPEG-2
+#define SINE_CS_CMD_WAVE_CTRL			0x14 	// 0 - sine, 1 - the verified slot
+#define SINE_CS_CMD_SET_HARMONIC		0x15 	// SINE_HARMONIC_VALUE, zero amplitude removes harmonic
+#define SINE_CS_CMD_HARMONICS_CTRL		0x16 	// 1 - synthesize into waveform slot and activate, 0 - clear list
+#define SINE_CS_CMD_SEQUENCE_CTRL		0x17 	// segments number | loops << 16, loops 0 - endless, 0 - stop
+#define SINE_CS_CMD_BURST_CTRL			0x18 	// periods | interval ms << 16, interval 0 - single burst, 0 - stop
+
+typedef enum
+{
+	SINE_MODE_TABLE = 0, 	// 50 Hz, precalculated half period buffer is replayed by DMA
+	SINE_MODE_DDS, 			// arbitrary frequency, buffer is streamed from phase accumulator
+	SINE_MODE_FULL_PERIOD, 	// 50 Hz, full period buffer with separate polarity corrections is replayed by DMA
+}sineMode;
+
+#define SINE_STATUS_VERSION 8
+
+// status block flags
+#define SINE_STATUS_OUTPUT_ENABLED 		0x01 	// output is commanded on
+#define SINE_STATUS_POWER_ON 			0x02 	// DC_EN is set, output stays on until soft stop is finished
+#define SINE_STATUS_CALIB_MODE 			0x04
+#define SINE_STATUS_RAMP_ACTIVE 		0x08
+#define SINE_STATUS_DEAD_TIME_SWEEP 	0x10
+#define SINE_STATUS_EEPROM_BUSY 		0x20 	// calibration data is being saved
+#define SINE_STATUS_EEPROM_ERROR 		0x40 	// the last save failed
+#define SINE_STATUS_FULL_PERIOD 		0x80 	// full period mode is enabled, used at 50 Hz
+// status block extended flags
+#define SINE_STATUS_EXT_LINEARIZATION 	0x01 	// DAC codes are corrected by linearization curve
+#define SINE_STATUS_EXT_LOOP 			0x02 	// closed loop RMS regulation is enabled
+#define SINE_STATUS_EXT_LOOP_LIMIT 		0x04 	// loop correction is at its limit
+#define SINE_STATUS_EXT_RMS_VALID 		0x08 	// shunt RMS is measured with power on
+#define SINE_STATUS_EXT_CAPTURE_ARMED 	0x10 	// capture waits for trigger
+#define SINE_STATUS_EXT_CAPTURE_DONE 	0x20 	// capture record is frozen and can be read
+#define SINE_STATUS_EXT_WAVE_VERIFIED 	0x40 	// waveform slot passed CRC check and is not written since
+#define SINE_STATUS_EXT_WAVE_ACTIVE 	0x80 	// uploaded waveform replaces sine
+
+typedef struct __PACKED
+{
+	uint8_t version; 			// SINE_STATUS_VERSION, block layout is only extended
+	uint8_t flags; 				// SINE_STATUS_x flags
+	uint16_t fwVersion; 		// SINE_FW_VERSION
+	uint8_t mode; 				// sineMode
+	uint8_t burst; 				// SINE_BURST_x state, reserved before version 8
+	uint16_t amplitude; 		// applied (ramped) amplitude, DAC discretes
+	uint16_t targetAmplitude; 	// commanded amplitude after limiting, DAC discretes
+	uint16_t offset; 			// DAC discretes
+	uint16_t amplitude1A; 		// 1A calibration value, DAC discretes
+	uint16_t rampRate; 			// 0,1 A/s
+	uint32_t frequency; 		// mHz
+	uint32_t halfPeriods; 		// half periods generated since reset
+	uint32_t commands; 			// commands executed since reset
+	// version 2
+	uint16_t deadTime; 			// commutator dead-time, DAC samples
+	// version 3
+	uint16_t calibPoints[SINE_CAL_POINTS]; 	// DAC amplitude at 1...SINE_CAL_POINTS A
+	// version 4
+	uint16_t negativeGain; 		// negative half amplitude gain, 1/4096
+	uint16_t negativeOffset; 	// negative half offset, DAC discretes
+	uint8_t calibPolarity; 		// 0 - raw values are set for positive half, 1 - for negative one
+	// version 5
+	uint8_t flagsExt; 			// SINE_STATUS_EXT_x flags
+	// version 6
+	uint16_t rms; 				// measured shunt RMS, ADC discretes, zero offset is subtracted
+	uint16_t rmsTarget; 		// commanded shunt RMS, ADC discretes
+	uint16_t rms1A; 			// shunt RMS at 1A amplitude calibration, ADC discretes
+	uint16_t adcZero; 			// shunt zero with power off, ADC discretes
+	uint32_t loopGain; 			// envelope correction, 1/65536
+	// version 7
+	uint8_t sequenceSegment; 	// running segment, SINE_SEQUENCE_IDLE - sequencer is stopped
+	uint8_t sequenceLoops; 		// finished sequence loops, saturated at 255
+}sineCS_status;
+
+// sequence segment
+typedef struct __PACKED
+{
+	uint8_t amplitude; 			// 0,1 A, 0 - no output current
+	uint8_t reserved;
+	uint16_t rampRate; 			// 0,1 A/s, 0 - amplitude is changed at segment boundary
+	uint32_t frequency; 		// mHz, 0 - frequency is kept
+	uint32_t periods; 			// segment duration, sine periods
+}sineCS_segment;
+
+#define SINE_SETTINGS_RECORD 	0x01 	// journal record type
+#define SINE_SETTINGS_VERSION 	5
+
+// settings snapshot saved to journal, layout is only extended between versions
+typedef struct
+{
+	uint16_t amplitude1A; 		// DAC discretes
+	uint16_t offset; 			// DAC discretes
+	uint8_t deadTime; 			// DAC samples
+	uint8_t isOutputEnabled; 	// output state at save, output is never switched on at power up
+	uint16_t rampRate; 			// 0,1 A/s
+	uint16_t amplitude; 		// commanded amplitude, DAC discretes
+	uint16_t reserved;
+	uint32_t frequency; 		// mHz
+	uint32_t halfPeriods; 		// half periods generated over lifetime
+	uint32_t powerOns; 			// output switch on count over lifetime
+	// version 2
+	uint16_t calibPoints[SINE_CAL_POINTS]; 	// DAC amplitude at 1...SINE_CAL_POINTS A, first one equals amplitude1A
+	uint16_t reserved2;
+	// version 3
+	uint16_t negativeGain; 		// negative half amplitude gain, 1/4096
+	uint16_t negativeOffset; 	// DAC discretes
+	uint8_t isFullPeriodEnabled;
+	uint8_t reserved3;
+	uint16_t reserved4;
+	// version 4
+	int8_t linearization[SINE_LIN_KNOTS]; 	// DAC discretes
+	uint8_t isLinearizationEnabled;
+	uint16_t reserved5;
+	// version 5
+	uint16_t rms1A; 			// ADC discretes
+	uint8_t isLoopEnabled;
+	uint8_t reserved6;
+}sineCS_settings;
+
+#define SINE_EVENTS_NUM 16 // must be power of 2
+
+// asynchronous event types
+#define SINE_EVENT_RAMP_COMPLETE 		0x01 	// param - reached amplitude, DAC discretes
+#define SINE_EVENT_SEQUENCE_FINISHED 	0x02 	// param - executed segments number
+#define SINE_EVENT_FAULT 				0x03 	// param - SINE_FAULT_x code
+#define SINE_EVENT_SETTINGS_SAVED 		0x04 	// param - journal sequence number, low word
+#define SINE_EVENT_BUFFER_UNDERRUN 		0x05 	// param - sineMode, buffer was not ready at DMA boundary
+#define SINE_EVENT_DEAD_TIME 			0x06 	// param - dead-time, sent at each sweep step and at sweep end
+#define SINE_EVENT_CAPTURE_DONE 		0x07 	// param - trigger sample index in capture record
+#define SINE_EVENT_BURST_FINISHED 		0x08 	// param - bursts number, output is switched off
+
+#define SINE_FAULT_EEPROM 				0x01
+#define SINE_FAULT_WAVE 				0x02 	// waveform slot CRC mismatch or sample out of range
+
+// interrupts with duration statistics
+#define SINE_ISR_DAC_DMA 	0
+#define SINE_ISR_COMMUTATOR 1
+#define SINE_ISR_NUM 		2
+
+#define SINE_PERF_VERSION 	4
+
+typedef struct __PACKED
+{
+	uint32_t count; 		// interrupts handled
+	uint32_t cycles; 		// total duration, CPU cycles
+	uint16_t maxCycles;
+	uint16_t lastCycles;
+}sineCS_isrStats;
+
+typedef struct __PACKED
+{
+	uint16_t maxUs;
+	uint16_t lastUs;
+}sineCS_latency;
+
+typedef struct __PACKED
+{
+	uint8_t version; 		// SINE_PERF_VERSION
+	uint8_t leanIsr; 		// SINE_LEAN_ISR build option
+	uint16_t reserved;
+	sineCS_isrStats isr[SINE_ISR_NUM];
+	// version 2
+	sineCS_latency commutator; 		// TIM21 compare match to callback entry
+	sineCS_latency bufferReady; 	// DMA half/full transfer to refilled or switched buffer
+	// version 3
+	sineCS_isrStats recompute; 		// waveform buffer build in main loop, interrupts included
+	sineCS_isrStats linearization; 	// linearization part of buffer build in main loop, interrupts included
+	// version 4
+	sineCS_isrStats harmonics; 		// harmonic synthesis in main loop, interrupts included
+	uint8_t harmonicsUsed; 			// harmonics in the last synthesis, build time per harmonic is its duration share
+	uint8_t reserved2;
+	uint16_t clippedSamples; 		// samples clipped in the last synthesis
+}sineCS_perf;
+
+#if SINE_ISR_STATS
+// handler duration from its first to its last statement. SysTick counts CPU cycles down from LOAD,
+// exception entry and exit (about 15 cycles each on Cortex-M0+) are not included
+#define SINE_ISR_STATS_ENTER() 		uint32_t isr_stats_entry = SysTick->VAL
+#define SINE_ISR_STATS_EXIT(isr) 	sineCS_IsrStatsUpdate((isr), isr_stats_entry, SysTick->VAL)
+#else
+#define SINE_ISR_STATS_ENTER()
+#define SINE_ISR_STATS_EXIT(isr)
+#endif
+
+typedef struct __PACKED
+{
+	uint8_t type; 			// SINE_EVENT_x
+	uint8_t reserved;
+	uint16_t param;
+	uint32_t timestamp; 	// half periods counter
+}sineCS_event;
 
 typedef struct
 {
@@ -15,8 +334,31 @@ typedef struct
 	void (*SetRawOffset)(uint16_t dac_offset);
 	void (*CalibrationModeCtrl)(uint8_t is_enabled);
 	void (*SaveCalibrationData)(void);
+	void (*SaveSettings)(void);
+	void (*SetCalibrationPoint)(uint8_t point);
+	void (*CalibrationPolarityCtrl)(uint8_t is_negative);
+	void (*FullPeriodCtrl)(uint8_t is_enabled);
+	void (*LinearizationCtrl)(uint8_t is_enabled);
+	void (*LoadLinearization)(const int8_t* knots);
+	void (*GetLinearization)(int8_t* knots);
+	void (*LoopCtrl)(uint8_t is_enabled);
+	void (*CaptureCtrl)(uint8_t trigger);
+	uint16_t (*ReadCapture)(uint32_t* samples, uint16_t first, uint16_t num);
+	uint16_t* (*GetWaveSlot)(uint16_t first, uint16_t num);
+	void (*LoadSegment)(uint8_t index, const sineCS_segment* segment);
+	void (*SetFrequency)(uint32_t freq);
+	void (*SetRampRate)(uint16_t rate);
+	void (*SetDeadTime)(uint8_t dead_time);
+	void (*DeadTimeSweepCtrl)(uint8_t is_enabled);
+	uint8_t (*PostCommand)(uint8_t cmd, uint32_t value);
+	void (*Process)(void);
+	void (*GetStatus)(sineCS_status* status);
+	uint8_t (*GetEvent)(sineCS_event* event);
+	void (*GetPerf)(sineCS_perf* perf, uint8_t is_reset);
 }sineCS_driver;
 
 extern sineCS_driver* sineCS_drv;
 
+void sineCS_IsrStatsUpdate(uint8_t isr, uint32_t entry, uint32_t exit);
+
 #endif
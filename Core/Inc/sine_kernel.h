@@ -0,0 +1,53 @@
+#ifndef __SINE_KERNEL_H
+#define __SINE_KERNEL_H
+
+// waveform engine: plain integer code without HAL and register access, can be built for any target
+#include <stdint.h>
+
+#define SINE_SAMPLES_NUM 500
+#define DAC_SAMPLE_RATE 50000 		// TIM2 update frequency, Hz
+#define SINE_WAVE_MAX 4095 			// uploaded half period sample for amplitude, equals sine table peak
+
+// DAC and output stage linearization curve: correction in DAC discretes at each 1 << SINE_LIN_STEP_SHIFT code,
+// linearly interpolated between knots. The last knot is for code 4096
+#define SINE_LIN_STEP_SHIFT 	7
+#define SINE_LIN_KNOTS 			((4096 >> SINE_LIN_STEP_SHIFT) + 1)
+
+// harmonic synthesis: odd harmonics keep half-wave symmetry, so half period is played with both polarities.
+// Phase is in 1/(2*SINE_SAMPLES_NUM) of harmonic period
+#define SINE_HARMONICS_MAX 		8 		// orders 1, 3 ... 2*SINE_HARMONICS_MAX-1
+#define SINE_HARMONIC_PHASES 	(2*SINE_SAMPLES_NUM)
+
+typedef struct
+{
+	uint8_t order; 			// odd order, 1 is fundamental
+	uint16_t amplitude; 	// 0...SINE_WAVE_MAX, 0 - harmonic is off
+	uint16_t phase; 		// 0...SINE_HARMONIC_PHASES-1
+}sineHarmonic;
+
+typedef struct
+{
+	uint16_t tick; 	// integer part of crossing position in samples, wraps as TIM21 counter
+	uint32_t frac; 	// fractional part in 1/tuningWord units
+}sineCrossing;
+
+// phase accumulator synthesis state, 2^32 is one half period
+typedef struct
+{
+	uint32_t phase;
+	uint32_t tuningWord;
+	uint16_t halfPeriodInt; 	// 2^32 / tuningWord
+	uint32_t halfPeriodFrac; 	// 2^32 % tuningWord
+	uint32_t activeParams; 		// amplitude | offset << 16 of current half period
+	sineCrossing crossing[2]; 	// next zero crossing for each commutator channel
+}sineDds;
+
+void sineKernel_CalcHalfPeriod(uint16_t* buf, uint16_t amplitude, uint16_t offset);
+void sineKernel_CalcHalfPeriodWave(uint16_t* buf, const uint16_t* wave, uint16_t amplitude, uint16_t offset);
+uint16_t sineKernel_CalcHarmonics(uint16_t* wave, const sineHarmonic* harmonics, uint8_t num);
+void sineKernel_DdsStart(sineDds* dds, uint32_t freq, uint32_t params);
+uint16_t sineKernel_DdsFill(sineDds* dds, uint16_t* buf, uint16_t len, volatile const uint32_t* params);
+uint16_t sineKernel_NextCrossing(sineDds* dds, uint8_t channel);
+void sineKernel_Linearize(uint16_t* buf, uint16_t len, const int8_t* knots);
+
+#endif
@@ -56,7 +56,8 @@ void DMA1_Channel2_3_IRQHandler(void);
 void TIM21_IRQHandler(void);
 void USB_IRQHandler(void);
 /* USER CODE BEGIN EFP */
-
+void DMA1_Channel1_IRQHandler(void);
+void TIM22_IRQHandler(void);
 /* USER CODE END EFP */
 
 #ifdef __cplusplus
@@ -0,0 +1,17 @@
+#ifndef __WORK_QUEUE_H
+#define __WORK_QUEUE_H
+
+#include "stm32l0xx_hal.h"
+
+#define WORK_QUEUE_SIZE 32 // must be power of 2, holds at least one full bulk command packet
+
+typedef struct
+{
+	uint8_t cmd;
+	uint32_t value;
+}workItem;
+
+uint8_t workQueue_Post(uint8_t cmd, uint32_t value);
+uint8_t workQueue_Get(workItem* item);
+
+#endif
@@ -0,0 +1,108 @@
+#include "burst.h"
+
+static volatile uint8_t isGated = 0; 	// TIM2 is stopped by counter end interrupt
+
+/**
+  * @brief  Configure burst counter. TIM21 trigger output is switched to compare pulse, counter waits stopped.
+  * Must be called after TIM21 initialization
+  * @param  None
+  * @retval None
+  */
+void burst_Init(void)
+{
+	__HAL_RCC_TIM22_CLK_ENABLE();
+
+	// TIM21 TRGO: compare pulse, channel 1 compare match
+	TIM21->CR2 = (TIM21->CR2 & ~TIM_CR2_MMS) | TIM_CR2_MMS_1 | TIM_CR2_MMS_0;
+
+	// external clock mode 1 from ITR0, one pulse mode, only overflow sets update flag
+	TIM22->CR1 = TIM_CR1_OPM | TIM_CR1_URS;
+	TIM22->SMCR = TIM_SMCR_SMS_2 | TIM_SMCR_SMS_1 | TIM_SMCR_SMS_0;
+	TIM22->PSC = 0;
+	TIM22->ARR = BURST_COUNTER_TOP;
+	TIM22->EGR = TIM_EGR_UG;
+	TIM22->SR = 0;
+	TIM22->DIER = TIM_DIER_UIE;
+
+	// gate must land in the same DAC sample as the switch off
+	HAL_NVIC_SetPriority(TIM22_IRQn, SINE_IRQ_PRIO_COMMUTATOR, 0);
+	HAL_NVIC_EnableIRQ(TIM22_IRQn);
+}
+
+/**
+  * @brief  Gate running generator at the next channel 1 switch off. Called from main loop
+  * @param  None
+  * @retval None
+  */
+void burst_Sync(void)
+{
+	burst_Start(1);
+}
+
+/**
+  * @brief  Count pulses and start TIM2, generator is gated again after the last pulse. Called from main loop
+  * @param  pulses: 1...BURST_COUNTER_TOP - TIM21 compare pulses to be counted
+  * @retval None
+  */
+void burst_Start(uint16_t pulses)
+{
+	uint32_t primask = __get_PRIMASK();
+
+	__disable_irq();
+	TIM22->CR1 &= ~TIM_CR1_CEN;
+	TIM22->SR = 0;
+	NVIC_ClearPendingIRQ(TIM22_IRQn);
+	TIM22->CNT = (uint16_t)(BURST_COUNTER_TOP + 1UL - pulses);
+	TIM22->CR1 |= TIM_CR1_CEN;
+	isGated = 0;
+	TIM2->CR1 |= TIM_CR1_CEN;
+	__set_PRIMASK(primask);
+}
+
+/**
+  * @brief  Stop counting and let generator run. Called from main loop
+  * @param  None
+  * @retval None
+  */
+void burst_Release(void)
+{
+	uint32_t primask = __get_PRIMASK();
+
+	__disable_irq();
+	TIM22->CR1 &= ~TIM_CR1_CEN;
+	TIM22->SR = 0;
+	NVIC_ClearPendingIRQ(TIM22_IRQn);
+	isGated = 0;
+	TIM2->CR1 |= TIM_CR1_CEN;
+	__set_PRIMASK(primask);
+}
+
+/**
+  * @brief  Check if generator is gated
+  * @param  None
+  * @retval 1 - TIM2 is stopped after the counted pulses, 0 - generator runs
+  */
+uint8_t burst_IsGated(void)
+{
+	return isGated;
+}
+
+/**
+  * @brief  Counter end interrupt: stop TIM2 unless the last pulse was channel 1 switch on, then one more pulse is
+  * counted. TIM2 counts microseconds since DAC sample, it is stopped before the next sample
+  * @param  None
+  * @retval None
+  */
+void burst_IrqHandler(void)
+{
+	TIM22->SR = ~(uint32_t)TIM_SR_UIF;
+
+	if(BURST_COMM_GPIO_PORT->IDR & BURST_COMM_CH1_PIN)
+	{
+		TIM22->CNT = BURST_COUNTER_TOP;
+		TIM22->CR1 |= TIM_CR1_CEN;
+		return;
+	}
+	TIM2->CR1 &= ~TIM_CR1_CEN;
+	isGated = 1;
+}
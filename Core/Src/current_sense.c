@@ -0,0 +1,386 @@
+#include "current_sense.h"
+
+static void accumulate(const uint16_t* block);
+static void scanTrigger(uint16_t first);
+static uint32_t enterSampleSlot(void);
+static void restartRing(captureState state);
+
+// ADC samples, DMA is circular over two blocks. The same ring is capture record
+static uint16_t samples[SINE_CAPTURE_SAMPLES];
+// DAC output codes and GPIOA input low byte, recorded in step with ADC samples
+static uint16_t dacCodes[SINE_CAPTURE_SAMPLES];
+static uint8_t commPins[SINE_CAPTURE_SAMPLES];
+
+// capture state, changed from main loop in sample slot and from DMA interrupt
+static volatile captureState capture = CAPTURE_IDLE;
+static uint8_t captureTrigger = SINE_CAPTURE_STOP;
+static uint16_t captureFilled = 0; 		// pre-trigger samples recorded since arming
+static uint8_t prevCommPins = 0;
+static uint16_t triggerIndex = 0; 		// ring index of trigger sample
+static uint16_t endIndex = 0; 			// ring index of the oldest sample in frozen ring
+static uint8_t captureLag = 0; 			// DAC and pins ring is ahead of ADC one, when TIM2 was started before compare
+
+// window being accumulated, DMA interrupt context
+static uint64_t windowSumSq = 0;
+static uint32_t windowSum = 0;
+static uint32_t windowCount = 0;
+static uint32_t windowSamples = 2*SINE_SAMPLES_NUM;
+
+// the last complete window, read from main loop
+static currentSenseWindow readyWindow;
+static volatile uint32_t readyCount = 0;
+static uint32_t readCount = 0;
+
+/**
+  * @brief  Configure ADC and capture DMA channels. Conversions start at the first TIM2 update, so TIM2 must be started
+  * after this function. ADC is clocked by PCLK/2, 16 MHz, conversion takes 3,3 us of 20 us sample period
+  * @param  None
+  * @retval None
+  */
+void currentSense_Init(void)
+{
+	__HAL_RCC_ADC1_CLK_ENABLE();
+	__HAL_RCC_GPIOA_CLK_ENABLE();
+
+	// analog mode
+	CURRENT_SENSE_GPIO_PORT->MODER |= (3UL << (2*CURRENT_SENSE_GPIO_PIN_POS));
+
+	ADC1->CFGR2 = ADC_CFGR2_CKMODE_0;
+	ADC1->CR = ADC_CR_ADVREGEN;
+	HAL_Delay(1); // regulator start-up
+	ADC1->CR |= ADC_CR_ADCAL;
+	while(ADC1->CR & ADC_CR_ADCAL);
+
+	// 12 bits, right alignment, conversion at TIM2 TRGO rising edge, circular DMA
+	ADC1->CFGR1 = ADC_CFGR1_EXTEN_0 | ADC_CFGR1_EXTSEL_1 | ADC_CFGR1_DMACFG | ADC_CFGR1_DMAEN;
+	ADC1->SMPR = ADC_SMPR_SMP_2 | ADC_SMPR_SMP_0; // 39,5 cycles
+	ADC1->CHSELR = CURRENT_SENSE_ADC_CHANNEL;
+
+	// DMA1 channel 1 request 0 is ADC
+	DMA1_CSELR->CSELR &= ~DMA_CSELR_C1S;
+	DMA1_Channel1->CPAR = (uint32_t)&ADC1->DR;
+	DMA1_Channel1->CMAR = (uint32_t)samples;
+	DMA1_Channel1->CNDTR = SINE_CAPTURE_SAMPLES;
+	DMA1_Channel1->CCR = DMA_CCR_PL_1 | DMA_CCR_MSIZE_0 | DMA_CCR_PSIZE_0 | DMA_CCR_MINC | DMA_CCR_CIRC |
+			DMA_CCR_HTIE | DMA_CCR_TCIE;
+	// DMA1 channels 3 and 4 request 8 are TIM2_CH2 and TIM2_CH4, no interrupts. Channel 4 reads 16-bit IDR
+	// into byte, the low byte is kept
+	DMA1_CSELR->CSELR = (DMA1_CSELR->CSELR & ~(DMA_CSELR_C3S | DMA_CSELR_C4S)) |
+			(8UL << DMA_CSELR_C3S_Pos) | (8UL << DMA_CSELR_C4S_Pos);
+	DMA1_Channel3->CPAR = (uint32_t)&DAC->DOR1;
+	DMA1_Channel3->CMAR = (uint32_t)dacCodes;
+	DMA1_Channel3->CNDTR = SINE_CAPTURE_SAMPLES;
+	DMA1_Channel3->CCR = DMA_CCR_MSIZE_0 | DMA_CCR_PSIZE_0 | DMA_CCR_MINC | DMA_CCR_CIRC;
+	DMA1_Channel4->CPAR = (uint32_t)&GPIOA->IDR;
+	DMA1_Channel4->CMAR = (uint32_t)commPins;
+	DMA1_Channel4->CNDTR = SINE_CAPTURE_SAMPLES;
+	DMA1_Channel4->CCR = DMA_CCR_PSIZE_0 | DMA_CCR_MINC | DMA_CCR_CIRC;
+
+	// frozen compare channels only make DMA requests
+	TIM2->CCR2 = CURRENT_SENSE_CAPTURE_CC;
+	TIM2->CCR4 = CURRENT_SENSE_CAPTURE_CC;
+
+	HAL_NVIC_SetPriority(DMA1_Channel1_IRQn, SINE_IRQ_PRIO_CURRENT_SENSE, 0);
+	HAL_NVIC_EnableIRQ(DMA1_Channel1_IRQn);
+
+	ADC1->ISR = ADC_ISR_ADRDY;
+	ADC1->CR |= ADC_CR_ADEN;
+	while(!(ADC1->ISR & ADC_ISR_ADRDY));
+	// wait for triggers
+	ADC1->CR |= ADC_CR_ADSTART;
+	restartRing(CAPTURE_IDLE);
+}
+
+/**
+  * @brief  Set accumulation window length and restart accumulation. Window must be whole number of sine periods
+  * @param  samples: window length in samples
+  * @retval None
+  */
+void currentSense_SetWindow(uint32_t samples)
+{
+	uint32_t primask = __get_PRIMASK();
+
+	__disable_irq();
+	windowSamples = samples;
+	windowSumSq = 0;
+	windowSum = 0;
+	windowCount = 0;
+	__set_PRIMASK(primask);
+}
+
+/**
+  * @brief  Drop the window being accumulated and the complete one, which is not taken yet. Used after CPU stall
+  * longer than the ring, when late block interrupts have accumulated samples overwritten by DMA. Called from main loop
+  * @param  None
+  * @retval None
+  */
+void currentSense_Discard(void)
+{
+	uint32_t primask = __get_PRIMASK();
+
+	__disable_irq();
+	windowSumSq = 0;
+	windowSum = 0;
+	windowCount = 0;
+	readCount = readyCount;
+	__set_PRIMASK(primask);
+}
+
+/**
+  * @brief  Get the last complete window. Called from main loop
+  * @param  window: window storage
+  * @retval 1 - new window is taken, 0 - no window since the previous call
+  */
+uint8_t currentSense_GetWindow(currentSenseWindow* window)
+{
+	uint32_t primask = __get_PRIMASK();
+
+	if(readyCount == readCount) return 0;
+
+	__disable_irq();
+	*window = readyWindow;
+	readCount = readyCount;
+	__set_PRIMASK(primask);
+
+	return 1;
+}
+
+/**
+  * @brief  Accumulate the block, which DMA has just written, and search it for capture trigger. Called from DMA1
+  * channel 1 interrupt
+  * @param  None
+  * @retval None
+  */
+void currentSense_DmaHandler(void)
+{
+	uint32_t flags = DMA1->ISR & (DMA_ISR_GIF1 | DMA_ISR_HTIF1 | DMA_ISR_TCIF1 | DMA_ISR_TEIF1);
+
+	// all taken flags are cleared, a late handler finds both blocks pending and the first one may freeze the ring
+	DMA1->IFCR = flags;
+	if(flags & DMA_ISR_HTIF1)
+	{
+		accumulate(&samples[0]);
+		scanTrigger(0);
+	}
+	if((flags & DMA_ISR_TCIF1) && (capture != CAPTURE_DONE))
+	{
+		accumulate(&samples[CURRENT_SENSE_BLOCK_SAMPLES]);
+		scanTrigger(CURRENT_SENSE_BLOCK_SAMPLES);
+	}
+}
+
+/**
+  * @brief  Add block samples to the window, window is closed exactly at its last sample. Block sum of squares fits
+  * 32 bits, it is added to 64-bit window sum once per block and at window end
+  * @param  block: CURRENT_SENSE_BLOCK_SAMPLES samples
+  * @retval None
+  */
+static void accumulate(const uint16_t* block)
+{
+	uint32_t sum_sq = 0;
+	uint32_t sum = 0;
+	uint32_t sample = 0;
+
+	for(uint16_t i = 0; i < CURRENT_SENSE_BLOCK_SAMPLES; i++)
+	{
+		sample = block[i];
+		sum += sample;
+		sum_sq += sample*sample;
+		if(++windowCount >= windowSamples)
+		{
+			readyWindow.sumSq = windowSumSq + sum_sq;
+			readyWindow.sum = windowSum + sum;
+			readyWindow.samples = windowCount;
+			readyCount++;
+			windowSumSq = 0;
+			windowSum = 0;
+			windowCount = 0;
+			sum_sq = 0;
+			sum = 0;
+		}
+	}
+	windowSumSq += sum_sq;
+	windowSum += sum;
+}
+
+/**
+  * @brief  Restart the ring after TIM2 is stopped: stop may fall between ADC sample and capture transfers of the same
+  * sample period. Frozen record is kept. Called from main loop with TIM2 stopped
+  * @param  None
+  * @retval None
+  */
+void currentSense_Resync(void)
+{
+	uint32_t primask = __get_PRIMASK();
+
+	__disable_irq();
+	if(capture != CAPTURE_DONE) restartRing(capture);
+	__set_PRIMASK(primask);
+}
+
+/**
+  * @brief  Capture control. Arming restarts the ring, so the record never holds samples of previous capture.
+  * Called from main loop
+  * @param  trigger: SINE_CAPTURE_x trigger, SINE_CAPTURE_STOP releases frozen ring
+  * @retval None
+  */
+void currentSense_CaptureCtrl(uint8_t trigger)
+{
+	if(trigger > SINE_CAPTURE_NEGATIVE) return;
+
+	captureTrigger = trigger;
+	restartRing((trigger == SINE_CAPTURE_STOP) ? CAPTURE_IDLE : CAPTURE_ARMED);
+}
+
+/**
+  * @brief  Get capture state
+  * @param  None
+  * @retval captureState
+  */
+captureState currentSense_GetCaptureState(void)
+{
+	return capture;
+}
+
+/**
+  * @brief  Get trigger sample index in capture record
+  * @param  None
+  * @retval index, valid when capture is done
+  */
+uint16_t currentSense_GetCaptureTrigger(void)
+{
+	return (uint16_t)((triggerIndex - endIndex) & (SINE_CAPTURE_SAMPLES - 1));
+}
+
+/**
+  * @brief  Pack frozen record samples in time order. Called from USB interrupt
+  * @param  record: SINE_CAPTURE_x sample words storage
+  * @param  first: index of the first sample in record
+  * @param  num: samples number
+  * @retval samples packed, 0 - capture is not done or record end is reached
+  */
+uint16_t currentSense_ReadCapture(uint32_t* record, uint16_t first, uint16_t num)
+{
+	uint16_t index = 0;
+	uint16_t comm = 0;
+	uint16_t i = 0;
+
+	if(capture != CAPTURE_DONE) return 0;
+
+	for(i = 0; (i < num) && ((first + i) < SINE_CAPTURE_SAMPLES); i++)
+	{
+		index = (endIndex + first + i) & (SINE_CAPTURE_SAMPLES - 1);
+		comm = (index + captureLag) & (SINE_CAPTURE_SAMPLES - 1);
+		record[i] = (samples[index] & SINE_CAPTURE_ADC_MASK) |
+				(((uint32_t)dacCodes[comm] << SINE_CAPTURE_DAC_POS) & SINE_CAPTURE_DAC_MASK);
+		if(commPins[comm] & CURRENT_SENSE_COMM_CH1_PIN) record[i] |= SINE_CAPTURE_CH1;
+		if(commPins[comm] & CURRENT_SENSE_COMM_CH2_PIN) record[i] |= SINE_CAPTURE_CH2;
+		if(index == triggerIndex) record[i] |= SINE_CAPTURE_TRIGGER;
+	}
+
+	return i;
+}
+
+/**
+  * @brief  Search the block for trigger, the first block after arming is pre-trigger record. Ring is frozen at trigger
+  * block end, so trigger sample is in the second half of record
+  * @param  first: ring index of the block
+  * @retval None
+  */
+static void scanTrigger(uint16_t first)
+{
+	uint32_t primask = 0;
+	uint8_t comm = 0;
+	uint8_t pins = 0;
+
+	if(capture != CAPTURE_ARMED) return;
+
+	if(captureFilled < CURRENT_SENSE_BLOCK_SAMPLES)
+	{
+		captureFilled += CURRENT_SENSE_BLOCK_SAMPLES;
+		prevCommPins = commPins[(first + CURRENT_SENSE_BLOCK_SAMPLES - 1 + captureLag) & (SINE_CAPTURE_SAMPLES - 1)];
+		return;
+	}
+
+	for(uint16_t i = first; i < (first + CURRENT_SENSE_BLOCK_SAMPLES); i++)
+	{
+		// pins switched on at this sample. With lag the last pins sample is stored 6 us after ADC one, long before
+		// the block is accumulated
+		comm = commPins[(i + captureLag) & (SINE_CAPTURE_SAMPLES - 1)];
+		pins = comm & ~prevCommPins;
+		prevCommPins = comm;
+		if((captureTrigger == SINE_CAPTURE_NOW) ||
+				((captureTrigger == SINE_CAPTURE_POSITIVE) && (pins & CURRENT_SENSE_COMM_CH1_PIN)) ||
+				((captureTrigger == SINE_CAPTURE_NEGATIVE) && (pins & CURRENT_SENSE_COMM_CH2_PIN)))
+		{
+			primask = enterSampleSlot();
+			DMA1_Channel1->CCR &= ~(DMA_CCR_EN | DMA_CCR_HTIE | DMA_CCR_TCIE);
+			DMA1_Channel3->CCR &= ~DMA_CCR_EN;
+			DMA1_Channel4->CCR &= ~DMA_CCR_EN;
+			// block completed meanwhile is a part of the frozen record, its flag must not re-enter the handler
+			DMA1->IFCR = DMA_IFCR_CGIF1;
+			// pending compare requests would be served at once after re-enabling
+			TIM2->DIER &= ~(TIM_DIER_CC2DE | TIM_DIER_CC4DE);
+			endIndex = (SINE_CAPTURE_SAMPLES - DMA1_Channel1->CNDTR) & (SINE_CAPTURE_SAMPLES - 1);
+			triggerIndex = i;
+			capture = CAPTURE_DONE;
+			__set_PRIMASK(primask);
+			return;
+		}
+	}
+}
+
+/**
+  * @brief  Wait for TIM2 counter window, in which ADC sample and capture DMA transfers of current sample period are
+  * done and the next ones are not started. Returns with interrupts disabled
+  * @param  None
+  * @retval PRIMASK to be restored
+  */
+static uint32_t enterSampleSlot(void)
+{
+	uint32_t primask = __get_PRIMASK();
+	uint32_t cnt = 0;
+
+	do
+	{
+		__set_PRIMASK(primask);
+		__disable_irq();
+		cnt = TIM2->CNT;
+	}while((TIM2->CR1 & TIM_CR1_CEN) && ((cnt < CURRENT_SENSE_SLOT_START) || (cnt > CURRENT_SENSE_SLOT_END)));
+
+	return primask;
+}
+
+/**
+  * @brief  Restart ADC and capture DMA from ring start at the same sample, window accumulation is restarted
+  * @param  state: new capture state
+  * @retval None
+  */
+static void restartRing(captureState state)
+{
+	uint32_t primask = enterSampleSlot();
+
+	DMA1_Channel1->CCR &= ~DMA_CCR_EN;
+	DMA1_Channel3->CCR &= ~DMA_CCR_EN;
+	DMA1_Channel4->CCR &= ~DMA_CCR_EN;
+	DMA1->IFCR = DMA_IFCR_CGIF1;
+	DMA1_Channel1->CNDTR = SINE_CAPTURE_SAMPLES;
+	DMA1_Channel3->CNDTR = SINE_CAPTURE_SAMPLES;
+	DMA1_Channel4->CNDTR = SINE_CAPTURE_SAMPLES;
+	// conversions made while ring was frozen set overrun, which blocks ADC DMA requests
+	(void)ADC1->DR;
+	ADC1->ISR = ADC_ISR_OVR;
+	// stopped TIM2 makes compare before the first update after start
+	captureLag = (!(TIM2->CR1 & TIM_CR1_CEN) && (TIM2->CNT < CURRENT_SENSE_CAPTURE_CC)) ? 1 : 0;
+	DMA1_Channel1->CCR |= DMA_CCR_EN | DMA_CCR_HTIE | DMA_CCR_TCIE;
+	DMA1_Channel3->CCR |= DMA_CCR_EN;
+	DMA1_Channel4->CCR |= DMA_CCR_EN;
+	TIM2->DIER |= TIM_DIER_CC2DE | TIM_DIER_CC4DE;
+
+	windowSumSq = 0;
+	windowSum = 0;
+	windowCount = 0;
+	captureFilled = 0;
+	capture = state;
+	__set_PRIMASK(primask);
+}
@@ -0,0 +1,107 @@
+#include "eeprom_writer.h"
+
+#define EEPROM_WRITER_ERRORS (FLASH_SR_WRPERR | FLASH_SR_PGAERR | FLASH_SR_SIZERR | FLASH_SR_NOTZEROERR | FLASH_SR_FWWERR)
+
+static uint32_t jobData[EEPROM_WRITER_MAX_WORDS];
+static uint32_t jobAddress = 0;
+static uint8_t jobWords = 0;
+static uint8_t jobIndex = 0; 	// the next word to write
+static eepromWriterState state = EEPROM_WRITER_IDLE;
+static uint32_t wordsWritten = 0; 	// programmed words counter, each one is a CPU stall
+
+/**
+  * @brief  Start data EEPROM write job. Data is copied, words are written by eepromWriter_Process() calls
+  * @param  address: word aligned data EEPROM address
+  * @param  data: words to write
+  * @param  words: 1...EEPROM_WRITER_MAX_WORDS - words number
+  * @retval 1 - job is started, 0 - previous job is not finished or wrong length
+  */
+uint8_t eepromWriter_Start(uint32_t address, const uint32_t* data, uint8_t words)
+{
+	if((state == EEPROM_WRITER_BUSY) || (words == 0) || (words > EEPROM_WRITER_MAX_WORDS)) return 0;
+
+	for(uint8_t i = 0; i < words; i++)
+	{
+		jobData[i] = data[i];
+	}
+	jobAddress = address;
+	jobWords = words;
+	jobIndex = 0;
+	state = EEPROM_WRITER_BUSY;
+
+	return 1;
+}
+
+/**
+  * @brief  Make one step of write job: check the previous word, then start the next one. Never waits for NVM,
+  * called from main loop
+  * @param  is_write_allowed: 1 - the next word can be started now. CPU stalls on flash access while word is
+  * programmed, so caller allows writes only when nothing time critical is expected during programming
+  * @retval writer state
+  */
+eepromWriterState eepromWriter_Process(uint8_t is_write_allowed)
+{
+	__IO uint32_t* word;
+
+	if(state != EEPROM_WRITER_BUSY) return state;
+	if(FLASH->SR & FLASH_SR_BSY) return state;
+
+	if(jobIndex != 0)
+	{
+		// verify the previous word
+		word = (__IO uint32_t*)(jobAddress + 4*(jobIndex - 1));
+		if((FLASH->SR & EEPROM_WRITER_ERRORS) || (*word != jobData[jobIndex - 1]))
+		{
+			FLASH->SR = EEPROM_WRITER_ERRORS;
+			HAL_FLASHEx_DATAEEPROM_Lock();
+			state = EEPROM_WRITER_ERROR;
+			return state;
+		}
+	}
+	// unchanged words are skipped, they cost neither time nor wear
+	while((jobIndex < jobWords) && (*(__IO uint32_t*)(jobAddress + 4*jobIndex) == jobData[jobIndex]))
+	{
+		jobIndex++;
+	}
+	if(jobIndex == jobWords)
+	{
+		HAL_FLASHEx_DATAEEPROM_Lock();
+		state = EEPROM_WRITER_DONE;
+		return state;
+	}
+
+	if(is_write_allowed)
+	{
+		if(HAL_FLASHEx_DATAEEPROM_Unlock() != HAL_OK)
+		{
+			state = EEPROM_WRITER_ERROR;
+			return state;
+		}
+		// erase is made by hardware if the word is not zero
+		FLASH->SR = EEPROM_WRITER_ERRORS | FLASH_SR_EOP;
+		*(__IO uint32_t*)(jobAddress + 4*jobIndex) = jobData[jobIndex];
+		jobIndex++;
+		wordsWritten++;
+	}
+	return state;
+}
+
+/**
+  * @brief  Get write job state
+  * @param  None
+  * @retval writer state
+  */
+eepromWriterState eepromWriter_GetState(void)
+{
+	return state;
+}
+
+/**
+  * @brief  Get programmed words counter, it is changed by each eepromWriter_Process() call, which stalled CPU
+  * @param  None
+  * @retval words programmed since reset
+  */
+uint32_t eepromWriter_GetWrites(void)
+{
+	return wordsWritten;
+}
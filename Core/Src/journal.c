@@ -0,0 +1,146 @@
+#include "journal.h"
+
+static uint32_t record[JOURNAL_SLOT_WORDS];
+static uint8_t latestSlot = JOURNAL_SLOTS - 1; 	// the first record is written to slot 0
+static uint32_t latestSequence = 0;
+static uint8_t isRecordFound = 0;
+
+static const uint32_t* getSlot(uint8_t slot);
+static uint8_t isRecordValid(const uint32_t* rec);
+
+/**
+  * @brief  Scan all slots and find the actual record. Torn or never written slots fail CRC check and are skipped
+  * @param  None
+  * @retval 1 - valid record is found, 0 - journal is empty
+  */
+uint8_t journal_Init(void)
+{
+	const uint32_t* rec;
+
+	__HAL_RCC_CRC_CLK_ENABLE();
+
+	for(uint8_t i = 0; i < JOURNAL_SLOTS; i++)
+	{
+		rec = getSlot(i);
+		if(isRecordValid(rec) && (!isRecordFound || (rec[1] > latestSequence)))
+		{
+			latestSlot = i;
+			latestSequence = rec[1];
+			isRecordFound = 1;
+		}
+	}
+	return isRecordFound;
+}
+
+/**
+  * @brief  Copy payload of the actual record. Payload is only extended between versions, so shorter payload of older
+  * record leaves the rest of caller structure untouched
+  * @param  type: expected record type
+  * @param  payload: payload storage
+  * @param  max_words: payload storage size in words
+  * @param  version: record version storage
+  * @retval payload words copied, 0 - no record of given type
+  */
+uint8_t journal_Load(uint8_t type, void* payload, uint8_t max_words, uint8_t* version)
+{
+	const uint32_t* rec = getSlot(latestSlot);
+	uint32_t* dst = (uint32_t*)payload;
+	uint8_t words = 0;
+
+	if(!isRecordFound || (((rec[0] >> 16) & 0xFF) != type)) return 0;
+
+	words = rec[0] & 0xFF;
+	if(words > max_words) words = max_words;
+	for(uint8_t i = 0; i < words; i++)
+	{
+		dst[i] = rec[2 + i];
+	}
+	*version = (rec[0] >> 8) & 0xFF;
+
+	return words;
+}
+
+/**
+  * @brief  Start writing new record into the slot after the actual one. The actual record is never overwritten,
+  * so a torn write leaves the previous record in force
+  * @param  type: record type
+  * @param  version: record version
+  * @param  payload: record payload
+  * @param  words: 1...JOURNAL_MAX_PAYLOAD - payload length in words
+  * @retval 1 - write is started, 0 - EEPROM writer is busy
+  */
+uint8_t journal_Append(uint8_t type, uint8_t version, const void* payload, uint8_t words)
+{
+	const uint32_t* src = (const uint32_t*)payload;
+	uint8_t slot = (latestSlot + 1) % JOURNAL_SLOTS;
+
+	if((words == 0) || (words > JOURNAL_MAX_PAYLOAD) || (eepromWriter_GetState() == EEPROM_WRITER_BUSY)) return 0;
+
+	record[0] = JOURNAL_HEADER(type, version, words);
+	record[1] = latestSequence + 1;
+	for(uint8_t i = 0; i < words; i++)
+	{
+		record[2 + i] = src[i];
+	}
+	// CRC is the last written word
+	record[2 + words] = journal_CalcCrc(record, 2 + words);
+
+	if(!eepromWriter_Start((uint32_t)getSlot(slot), record, 3 + words)) return 0;
+
+	// failed write leaves invalid slot, the next record goes to the next slot anyway
+	latestSlot = slot;
+	latestSequence++;
+	isRecordFound = 1;
+
+	return 1;
+}
+
+/**
+  * @brief  Get sequence number of the last written record, it is the number of saves as well
+  * @param  None
+  * @retval sequence number
+  */
+uint32_t journal_GetSequence(void)
+{
+	return latestSequence;
+}
+
+/**
+  * @brief  Calculate CRC-32/MPEG-2 (polynomial 0x04C11DB7, init 0xFFFFFFFF, no reflection, no final XOR) with CRC unit, which is enabled by journal_Init(). Main loop only
+  * @param  data: words to check
+  * @param  words: words number
+  * @retval CRC value
+  */
+uint32_t journal_CalcCrc(const uint32_t* data, uint16_t words)
+{
+	CRC->CR = CRC_CR_RESET;
+	for(uint16_t i = 0; i < words; i++)
+	{
+		CRC->DR = data[i];
+	}
+	return CRC->DR;
+}
+
+/**
+  * @brief  Get slot address
+  * @param  slot: 0...JOURNAL_SLOTS-1 - slot index
+  * @retval pointer to slot in data EEPROM
+  */
+static const uint32_t* getSlot(uint8_t slot)
+{
+	return (const uint32_t*)(JOURNAL_ADDR + 4*JOURNAL_SLOT_WORDS*slot);
+}
+
+/**
+  * @brief  Check record header and CRC
+  * @param  rec: pointer to record
+  * @retval 1 - record is valid, 0 - slot is empty or damaged
+  */
+static uint8_t isRecordValid(const uint32_t* rec)
+{
+	uint8_t words = rec[0] & 0xFF;
+
+	if(((rec[0] >> 24) != JOURNAL_MAGIC) || (words == 0) || (words > JOURNAL_MAX_PAYLOAD)) return 0;
+
+	return (journal_CalcCrc(rec, 2 + words) == rec[2 + words]);
+}
@@ -48,7 +48,7 @@ TIM_HandleTypeDef htim2;
 TIM_HandleTypeDef htim21;
 
 /* USER CODE BEGIN PV */
-extern uint16_t sineHalfPeriod[SINE_SAMPLES_NUM];
+extern uint16_t sineHalfPeriod[2][SINE_SAMPLES_NUM];
 
 /* USER CODE END PV */
 
@@ -105,17 +105,21 @@ int main(void)
   // init sine CS driver
   sineCS_drv->Init();
   // init DAC DMA
-  HAL_DAC_Start_DMA(&hdac, DAC_CHANNEL_1, (uint32_t*)sineHalfPeriod, SINE_SAMPLES_NUM, DAC_ALIGN_12B_R);
-  // start timers
+  HAL_DAC_Start_DMA(&hdac, DAC_CHANNEL_1, (uint32_t*)sineHalfPeriod[0], SINE_SAMPLES_NUM, DAC_ALIGN_12B_R);
+  __HAL_DMA_DISABLE_IT(&hdma_dac_ch1, DMA_IT_HT); // buffers are switched only at transfer complete
+  // start timers: commutator is aligned to the first DAC sample and switches without interrupts in table mode
+  __HAL_TIM_SET_COUNTER(&htim21, COMM_TABLE_START_CNT);
+  HAL_TIM_PWM_Start(&htim21, TIM_CHANNEL_1);
+  HAL_TIM_PWM_Start(&htim21, TIM_CHANNEL_2);
   HAL_TIM_Base_Start(&htim2); // DAC conversion timer, master
-  HAL_TIM_OC_Start_IT(&htim21, TIM_CHANNEL_1);
-  HAL_TIM_OC_Start_IT(&htim21, TIM_CHANNEL_2);
   /* USER CODE END 2 */
 
   /* Infinite loop */
   /* USER CODE BEGIN WHILE */
   while (1)
   {
+	// execute commands received by USB
+	sineCS_drv->Process();
     /* USER CODE END WHILE */
 
     /* USER CODE BEGIN 3 */
@@ -275,15 +279,15 @@ static void MX_TIM21_Init(void)
   /* USER CODE END TIM21_Init 1 */
   htim21.Instance = TIM21;
   htim21.Init.Prescaler = 0;
-  htim21.Init.CounterMode = TIM_COUNTERMODE_UP;
-  htim21.Init.Period = 999;
+  htim21.Init.CounterMode = TIM_COUNTERMODE_CENTERALIGNED1;
+  htim21.Init.Period = 500;
   htim21.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
   htim21.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_ENABLE;
   if (HAL_TIM_Base_Init(&htim21) != HAL_OK)
   {
     Error_Handler();
   }
-  if (HAL_TIM_OC_Init(&htim21) != HAL_OK)
+  if (HAL_TIM_PWM_Init(&htim21) != HAL_OK)
   {
     Error_Handler();
   }
@@ -299,16 +303,17 @@ static void MX_TIM21_Init(void)
   {
     Error_Handler();
   }
-  sConfigOC.OCMode = TIM_OCMODE_ACTIVE;
-  sConfigOC.Pulse = 2;
+  sConfigOC.OCMode = TIM_OCMODE_PWM2;
+  sConfigOC.Pulse = 251;
   sConfigOC.OCPolarity = TIM_OCPOLARITY_HIGH;
   sConfigOC.OCFastMode = TIM_OCFAST_DISABLE;
-  if (HAL_TIM_OC_ConfigChannel(&htim21, &sConfigOC, TIM_CHANNEL_1) != HAL_OK)
+  if (HAL_TIM_PWM_ConfigChannel(&htim21, &sConfigOC, TIM_CHANNEL_1) != HAL_OK)
   {
     Error_Handler();
   }
-  sConfigOC.Pulse = 502;
-  if (HAL_TIM_OC_ConfigChannel(&htim21, &sConfigOC, TIM_CHANNEL_2) != HAL_OK)
+  sConfigOC.OCMode = TIM_OCMODE_PWM1;
+  sConfigOC.Pulse = 250;
+  if (HAL_TIM_PWM_ConfigChannel(&htim21, &sConfigOC, TIM_CHANNEL_2) != HAL_OK)
   {
     Error_Handler();
   }
@@ -330,7 +335,7 @@ static void MX_DMA_Init(void)
 
   /* DMA interrupt init */
   /* DMA1_Channel2_3_IRQn interrupt configuration */
-  HAL_NVIC_SetPriority(DMA1_Channel2_3_IRQn, 0, 0);
+  HAL_NVIC_SetPriority(DMA1_Channel2_3_IRQn, SINE_IRQ_PRIO_DAC_DMA, 0);
   HAL_NVIC_EnableIRQ(DMA1_Channel2_3_IRQn);
 
 }
@@ -372,38 +377,7 @@ static void MX_GPIO_Init(void)
 }
 
 /* USER CODE BEGIN 4 */
-/**
-  * @brief  Realize dead-time function with general-purpose timer
-  * @param  htim: active timer handle
-  * @retval None
-  */
-void HAL_TIM_OC_DelayElapsedCallback(TIM_HandleTypeDef *htim)
-{
-	if(htim->Channel == HAL_TIM_ACTIVE_CHANNEL_1)
-	{
-		if(htim->Instance->CCR1 == 501)
-		{
-			htim->Instance->CCR1 = 2;
-		}
-		else if(htim->Instance->CCR1 == 2)
-		{
-			htim->Instance->CCR1 = 501;
-		}
-		htim->Instance->CCMR1 ^= (TIM_CCMR1_OC1M_1 | TIM_CCMR1_OC1M_0);
-	}
-	if(htim->Channel == HAL_TIM_ACTIVE_CHANNEL_2)
-	{
-		if(htim->Instance->CCR2 == 502)
-		{
-			htim->Instance->CCR2 = 1;
-		}
-		else if(htim->Instance->CCR2 == 1)
-		{
-			htim->Instance->CCR2 = 502;
-		}
-		htim->Instance->CCMR1 ^= (TIM_CCMR1_OC2M_1 | TIM_CCMR1_OC2M_0);
-	}
-}
+
 /* USER CODE END 4 */
 
 /**
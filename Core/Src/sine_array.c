@@ -0,0 +1,62 @@
+#include "sine_array.h"
+
+#if (SINE_SAMPLES_NUM % 2) || (SINE_QUARTER_SAMPLES + 1 > 1023)
+#error "SINE_SAMPLES_NUM must be even and not greater than 2044"
+#endif
+
+// sin(x) Taylor series up to x^21 in Horner form, exact in double precision for 0 <= x <= pi/2
+#define SINE_X2(x) 		((x)*(x))
+#define SINE_POLY(x) 	((x)*(1.0 - SINE_X2(x)/6.0*(1.0 - SINE_X2(x)/20.0*(1.0 - SINE_X2(x)/42.0*(1.0 - SINE_X2(x)/72.0*\
+						(1.0 - SINE_X2(x)/110.0*(1.0 - SINE_X2(x)/156.0*(1.0 - SINE_X2(x)/210.0*(1.0 - SINE_X2(x)/272.0*\
+						(1.0 - SINE_X2(x)/342.0*(1.0 - SINE_X2(x)/420.0)))))))))))
+#define SINE_STEP 		(3.14159265358979323846/(2.0*SINE_QUARTER_SAMPLES))
+// truncated as in the original hand-typed table, small bias keeps exact integers (peak value) from rounding down
+#define SINE_VALUE(i) 	(uint16_t)(SINE_ARRAY_AMPLITUDE*SINE_POLY((i)*SINE_STEP) + 1e-9)
+
+// repeat SINE_VALUE for 2^n consecutive indexes starting from i
+#define SINE_REP1(i) 	SINE_VALUE(i),
+#define SINE_REP2(i) 	SINE_REP1(i) SINE_REP1((i)+1)
+#define SINE_REP4(i) 	SINE_REP2(i) SINE_REP2((i)+2)
+#define SINE_REP8(i) 	SINE_REP4(i) SINE_REP4((i)+4)
+#define SINE_REP16(i) 	SINE_REP8(i) SINE_REP8((i)+8)
+#define SINE_REP32(i) 	SINE_REP16(i) SINE_REP16((i)+16)
+#define SINE_REP64(i) 	SINE_REP32(i) SINE_REP32((i)+32)
+#define SINE_REP128(i) 	SINE_REP64(i) SINE_REP64((i)+64)
+#define SINE_REP256(i) 	SINE_REP128(i) SINE_REP128((i)+128)
+#define SINE_REP512(i) 	SINE_REP256(i) SINE_REP256((i)+256)
+
+#define SINE_QUARTER_LEN (SINE_QUARTER_SAMPLES + 1)
+
+// table is generated by compiler for any SINE_SAMPLES_NUM: one block per set bit of the table length
+const uint16_t sineQuarter[SINE_QUARTER_LEN] = {
+#if (SINE_QUARTER_LEN & 512)
+		SINE_REP512(0)
+#endif
+#if (SINE_QUARTER_LEN & 256)
+		SINE_REP256(SINE_QUARTER_LEN & 512)
+#endif
+#if (SINE_QUARTER_LEN & 128)
+		SINE_REP128(SINE_QUARTER_LEN & 768)
+#endif
+#if (SINE_QUARTER_LEN & 64)
+		SINE_REP64(SINE_QUARTER_LEN & 896)
+#endif
+#if (SINE_QUARTER_LEN & 32)
+		SINE_REP32(SINE_QUARTER_LEN & 960)
+#endif
+#if (SINE_QUARTER_LEN & 16)
+		SINE_REP16(SINE_QUARTER_LEN & 992)
+#endif
+#if (SINE_QUARTER_LEN & 8)
+		SINE_REP8(SINE_QUARTER_LEN & 1008)
+#endif
+#if (SINE_QUARTER_LEN & 4)
+		SINE_REP4(SINE_QUARTER_LEN & 1016)
+#endif
+#if (SINE_QUARTER_LEN & 2)
+		SINE_REP2(SINE_QUARTER_LEN & 1020)
+#endif
+#if (SINE_QUARTER_LEN & 1)
+		SINE_REP1(SINE_QUARTER_LEN & 1022)
+#endif
+};
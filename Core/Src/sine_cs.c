@@ -1,8 +1,11 @@
 #include "sine_cs.h"
-#include "sine_array.h"
 #include "main.h"
+#include "work_queue.h"
+#include "eeprom_writer.h"
+#include "journal.h"
+#include "current_sense.h"
+#include "burst.h"
 #include <math.h>
-#include <string.h>
 
 // driver functions
 static void init(void);
@@ -12,20 +15,189 @@ static void setSineAmplitude(uint8_t ampl);
 static void setSineOffset(uint16_t dac_offset);
 static void calibrationModeControl(uint8_t is_enabled);
 static void saveCalibrationData(void);
+static void saveSettings(void);
+static void setCalibrationPoint(uint8_t point);
+static void calibrationPolarityControl(uint8_t is_negative);
+static void fullPeriodControl(uint8_t is_enabled);
+static void linearizationControl(uint8_t is_enabled);
+static void loadLinearization(const int8_t* knots);
+static void getLinearization(int8_t* knots);
+static void loopControl(uint8_t is_enabled);
+static void captureControl(uint8_t trigger);
+static uint16_t readCapture(uint32_t* samples, uint16_t first, uint16_t num);
+static uint16_t* getWaveSlot(uint16_t first, uint16_t num);
+static void loadSegment(uint8_t index, const sineCS_segment* segment);
+static void setFrequency(uint32_t freq);
+static void setRampRate(uint16_t rate);
+static void setDeadTime(uint8_t dead_time);
+static void deadTimeSweepControl(uint8_t is_enabled);
+static uint8_t postCommand(uint8_t cmd, uint32_t value);
+static void process(void);
+static void getStatus(sineCS_status* status);
+static uint8_t getEvent(sineCS_event* event);
+static void getPerf(sineCS_perf* perf, uint8_t is_reset);
 
 // inner functions
 static void calcHalfSineWave(uint16_t amplitude, uint16_t offset);
+static void processFullPeriod(void);
+static void buildHalfPeriod(uint16_t* buf, uint16_t amplitude, uint16_t offset);
+static void setLinearization(void);
+static void activateWave(uint32_t crc, uint32_t writes);
+static void waveControl(uint8_t is_enabled);
+static void setHarmonic(uint32_t value);
+static void harmonicsControl(uint8_t is_enabled);
+static void sequenceControl(uint32_t value);
+static void processSequencer(void);
+static void startSegment(const sineCS_segment* segment, uint8_t is_staged);
+static void stopSequencer(void);
+static void burstControl(uint32_t value);
+static void processBurst(void);
+static void stopBurst(void);
+static uint32_t getCycles(void);
+static void accountCycles(sineCS_isrStats* stats, uint32_t cycles);
+static void processFeedback(void);
+static void regulate(uint16_t rms);
+static uint32_t calcRmsWindow(void);
+static uint16_t sqrtInt(uint32_t value);
+static void executeCommand(workItem* item);
+static void restartGenerator(void);
+static void applyEnvelope(void);
+static void powerStageOff(void);
+static void stepEnvelope(void);
+static void postEvent(uint8_t type, uint16_t param);
+static void processEepromWriter(void);
+static void loadSettings(void);
+static void setLinearCalibration(uint16_t ampl_1a);
+static uint8_t isEepromWriteAllowed(void);
+static void updateLatency(sineCS_latency* latency, uint32_t samples, uint32_t us);
+static void measureBufferReadyLatency(DMA_Channel_TypeDef* dma_ch, uint16_t boundary);
 
-uint16_t sineHalfPeriod[SINE_SAMPLES_NUM] = {0};
-uint16_t tempBuf[SINE_SAMPLES_NUM] = {0};
+extern DAC_HandleTypeDef hdac;
+extern TIM_HandleTypeDef htim2;
+extern TIM_HandleTypeDef htim21;
 
-volatile uint8_t isFullSineParamsChanged = 0;
-volatile uint8_t isHalfSineParamsChanged = 0;
+// ping-pong DAC buffers: DMA reads the active one, new waveform is calculated into the other. In full period mode
+// both buffers are one circular DMA transfer, the first one is positive half period, the second one is negative
+uint16_t sineHalfPeriod[2][SINE_SAMPLES_NUM] = {0};
+
+volatile uint8_t activeBuffer = 0;
+// buffer sequence counter: odd while inactive buffer is being written, even when it is consistent
+volatile uint32_t bufferVersion = 0;
+volatile uint32_t appliedVersion = 0;
 volatile uint8_t isCalibrationModeEnabled = 0;
+volatile uint8_t isOutputEnabled = 0;
+uint8_t isWaveUpdateRequired = 0;
+
+volatile sineMode generatorMode = SINE_MODE_TABLE;
+volatile uint32_t sineFrequency = SINE_FREQ_TABLE;
+
+// phase accumulator synthesis
+static sineDds dds;
+// amplitude | offset << 16: written by main loop, latched by DMA callbacks at half period boundary
+volatile uint32_t ddsParams = 0;
+
+// full period mode: the half period, which DMA does not read, is rewritten from main loop
+volatile uint8_t isFullPeriodEnabled = 0;
+static uint32_t halfParams[2]; 				// amplitude | offset << 16 of positive and negative half
+static volatile uint8_t pendingHalves = 0; 	// halves to be rewritten with halfParams, bit per half
+static volatile uint8_t idleHalf = 0; 			// half, which is not read by DMA now
+static volatile uint32_t halfSwitches = 0; 	// DMA half period boundaries counter
+static volatile uint8_t writingHalf = 0; 		// half being written plus one, 0 - none
 
-volatile uint16_t sineAmplitude = 124;
-volatile uint16_t sineAmplitude_1A = 124;
+volatile uint16_t sineAmplitude = SINE_CAL_AMPL_1A;
+volatile uint16_t sineAmplitude_1A = SINE_CAL_AMPL_1A;
 volatile uint16_t sineOffset = 372;
+// DAC amplitude at 1...SINE_CAL_POINTS A
+uint16_t calibPoints[SINE_CAL_POINTS] = {SINE_CAL_AMPL_1A, 2*SINE_CAL_AMPL_1A, 3*SINE_CAL_AMPL_1A, 4*SINE_CAL_AMPL_1A,
+		5*SINE_CAL_AMPL_1A, 6*SINE_CAL_AMPL_1A, 7*SINE_CAL_AMPL_1A};
+static uint8_t isCalibrationPointSet = 0; 	// multi-point calibration is made since calibration mode is entered
+// negative half corrections, full period mode
+volatile uint16_t negativeGain = SINE_POLARITY_GAIN_ONE; 	// 1/4096
+volatile uint16_t sineOffsetNegative = 372;
+static uint8_t calibPolarity = 0; 			// 1 - raw amplitude and offset commands calibrate negative half
+// DAC and output stage linearization curve, applied when waveform buffer is built
+int8_t linearization[SINE_LIN_KNOTS] = {0};
+volatile uint8_t isLinearizationEnabled = 0;
+static int8_t linearizationUpload[SINE_LIN_KNOTS]; 	// written from USB interrupt, applied from main loop
+static volatile uint8_t isLinearizationUploaded = 0;
+// uploaded waveform slot, written by USB control transfers while it is not active
+static uint16_t waveSlot[SINE_SAMPLES_NUM] __ALIGNED(4);
+static volatile uint8_t isWaveVerified = 0;
+volatile uint8_t isWaveActive = 0;
+static volatile uint32_t waveWrites = 0; 	// slot writes counter, checked by activation
+// harmonics list, entry index is (order - 1)/2
+static sineHarmonic harmonics[SINE_HARMONICS_MAX];
+static uint8_t harmonicsUsed = 0;
+static uint16_t clippedSamples = 0;
+
+// sequencer: segment boundaries are counted in half periods from the sequence start, so main loop latency does not
+// accumulate. The table is written from USB interrupt only while sequencer is stopped
+static sineCS_segment sequence[SINE_SEQUENCE_SEGMENTS];
+static volatile uint8_t sequenceLength = 0; 	// segments in running sequence, 0 - sequencer is stopped
+static uint8_t sequenceIndex = 0;
+static uint16_t sequenceLoops = 0; 			// loops to run, 0 - endless
+static uint16_t loopsDone = 0;
+static uint16_t segmentsDone = 0;
+static uint32_t segmentStart = 0; 				// half periods counter at segment start
+static uint8_t isSegmentStaged = 0; 			// next segment amplitude is already applied
+static uint16_t sequenceRampRate = 0; 			// ramp rate before sequence start, restored at the end
+
+// burst mode
+static uint8_t burstState = SINE_BURST_OFF;
+static uint16_t burstCycles = 0; 				// periods in burst
+static uint16_t burstInterval = 0; 			// ms between burst starts, 0 - single burst
+static uint16_t burstsDone = 0;
+static uint32_t burstMark = 0; 				// half periods counter at arming
+static uint32_t burstTick = 0; 				// SysTick at settle start or at the last burst start
+
+// closed loop RMS regulation by shunt feedback
+volatile uint8_t isLoopEnabled = 0;
+volatile uint32_t loopGain = SINE_LOOP_GAIN_ONE; 	// envelope correction, 1/65536
+static int32_t loopIntegral = 0; 					// integral part of correction, 1/65536
+static uint8_t loopSettleWindows = 0;
+static uint8_t commandedCurrent = 0; 				// 0,1 A
+uint16_t rms1A = 0; 								// shunt RMS at 1A, ADC discretes, 0 - not calibrated
+static uint16_t rmsMeasured = 0;
+static uint16_t rmsTarget = 0;
+static uint16_t adcZero = 0;
+static uint8_t isRmsValid = 0;
+static uint8_t isCaptureReported = 0; 			// capture done event is posted
+
+// amplitude envelope in 16.16 DAC discretes: stepped towards target once per DAC buffer period
+volatile uint32_t envelope = 0;
+volatile uint32_t envelopeTarget = 0;
+volatile uint16_t rampRate = 0; 			// 0,1 A/s, 0 - amplitude is changed immediately
+static uint32_t rampStep = 0; 				// envelope step, 16.16 DAC discretes
+volatile uint8_t isEnvelopeStepped = 0;
+volatile uint8_t isWaveApplyRequired = 0;
+
+// commutator dead-time, TIM21 ticks
+volatile uint8_t deadTime = SINE_DEAD_TIME_DEFAULT;
+static uint8_t isDeadTimeSweepActive = 0;
+static uint32_t deadTimeSweepStart = 0; 	// half periods counter at current sweep step
+
+// settings snapshot is written to EEPROM journal from main loop
+static uint8_t isSettingsSaveRequired = 0;
+static eepromWriterState eepromState = EEPROM_WRITER_IDLE;
+static uint32_t lifetimeHalfPeriods = 0; 	// half periods generated before this power up
+static uint32_t powerOnsCounter = 0;
+
+// statistics
+volatile uint32_t halfPeriodsCounter = 0;
+volatile uint32_t commandsCounter = 0;
+
+// events for interrupt endpoint: posted from any context, read from USB interrupt
+static sineCS_event events[SINE_EVENTS_NUM];
+static volatile uint8_t eventsHead = 0;
+static volatile uint8_t eventsTail = 0;
+
+// interrupts duration statistics
+static sineCS_isrStats isrStats[SINE_ISR_NUM];
+static sineCS_latency commutatorLatency;
+static sineCS_latency bufferReadyLatency;
+static sineCS_isrStats recomputeStats;
+static sineCS_isrStats linearizationStats;
+static sineCS_isrStats harmonicsStats;
 
 sineCS_driver sineCS = {
 		init,
@@ -35,6 +207,27 @@ sineCS_driver sineCS = {
 		setSineOffset,
 		calibrationModeControl,
 		saveCalibrationData,
+		saveSettings,
+		setCalibrationPoint,
+		calibrationPolarityControl,
+		fullPeriodControl,
+		linearizationControl,
+		loadLinearization,
+		getLinearization,
+		loopControl,
+		captureControl,
+		readCapture,
+		getWaveSlot,
+		loadSegment,
+		setFrequency,
+		setRampRate,
+		setDeadTime,
+		deadTimeSweepControl,
+		postCommand,
+		process,
+		getStatus,
+		getEvent,
+		getPerf,
 };
 
 sineCS_driver* sineCS_drv = &sineCS;
@@ -46,14 +239,16 @@ sineCS_driver* sineCS_drv = &sineCS;
   */
 static void init(void)
 {
-	// read calibration data, if it was saved
-	if((*(__IO uint32_t *)EEPROM_CAL_DATA_ADDR) != 0)
-	{
-		sineAmplitude_1A = (*(__IO uint16_t *)EEPROM_CAL_DATA_ADDR);
-		sineAmplitude = sineAmplitude_1A;
+	loadSettings();
+	setRampRate(rampRate);
+	currentSense_SetWindow(calcRmsWindow());
+	currentSense_Init();
+	burst_Init();
 
-		sineOffset = (*(__IO uint16_t *)(EEPROM_CAL_DATA_ADDR+2));
-	}
+	// commutator is not started yet, load compare values immediately
+	htim21.Instance->CCR1 = COMM_TABLE_CH1_PULSE(deadTime);
+	htim21.Instance->CCR2 = COMM_TABLE_CH2_PULSE(deadTime);
+	htim21.Instance->EGR = TIM_EGR_UG;
 }
 
 /**
@@ -63,56 +258,85 @@ static void init(void)
   */
 static void powerControl(uint8_t is_enabled)
 {
+	if(burstState != SINE_BURST_OFF)
+	{
+		// output is switched by burst mode, switch off ends it
+		if(!is_enabled) stopBurst();
+		return;
+	}
 	if(is_enabled)
 	{
+		if(!isOutputEnabled) powerOnsCounter++;
 		DC_EN_GPIO_Port->ODR |= DC_EN_Pin;
 		// LED indication
 		LED_GPIO_Port->ODR |= LED_Pin;
-		// calc sine wave for DAC
-		calcHalfSineWave(sineAmplitude, sineOffset);
 	}
-	else
+	else if(sequenceLength)
 	{
-		DC_EN_GPIO_Port->ODR &= ~DC_EN_Pin;
-		// LED indication
-		LED_GPIO_Port->ODR &= ~LED_Pin;
-		// set DAC output to zero
-		calcHalfSineWave(0, 0);
+		// switch off aborts sequence
+		stopSequencer();
 	}
+	isOutputEnabled = is_enabled;
+	// ramp envelope up or down, power is switched off when envelope reaches zero
+	isWaveUpdateRequired = 1;
 }
 
 /**
-  * @brief  Set sine amplitude in DAC discretes. Used for 1A amplitude calibration
+  * @brief  Set sine amplitude in DAC discretes. Used for 1A amplitude calibration. When negative half is calibrated,
+  * negative half gain is set so, that its amplitude is the given value
   * @param  dac_ampl: 0...4095 - DAC value
   * @retval None
   */
 static void setSineRawAmplitude(uint16_t dac_ampl)
 {
+	uint32_t gain = 0;
+
 	if(isCalibrationModeEnabled)
 	{
 		// limit amplitude value
-		if(dac_ampl < 50) dac_ampl = 50;
-		if(dac_ampl > 250) dac_ampl = 250;
+		if(dac_ampl < SINE_RAW_AMPL_MIN) dac_ampl = SINE_RAW_AMPL_MIN;
+		if(dac_ampl > SINE_RAW_AMPL_MAX) dac_ampl = SINE_RAW_AMPL_MAX;
 
-		sineAmplitude = dac_ampl;
-		calcHalfSineWave(sineAmplitude, sineOffset);
+		if(calibPolarity)
+		{
+			if(sineAmplitude == 0) return;
+			gain = ((uint32_t)dac_ampl*SINE_POLARITY_GAIN_ONE + sineAmplitude/2)/sineAmplitude;
+			if(gain < SINE_POLARITY_GAIN_MIN) gain = SINE_POLARITY_GAIN_MIN;
+			if(gain > SINE_POLARITY_GAIN_MAX) gain = SINE_POLARITY_GAIN_MAX;
+			negativeGain = (uint16_t)gain;
+		}
+		else
+		{
+			sineAmplitude = dac_ampl;
+		}
+		isWaveUpdateRequired = 1;
 	}
 }
 
 /**
-  * @brief  Set sine amplitude in 0,1 A discretes. Used for setting current amplitude
+  * @brief  Set sine amplitude in 0,1 A discretes. Used for setting current amplitude. DAC amplitude is interpolated
+  * between calibration points once here, waveform calculation is not changed
   * @param  ampl: 0...70 - current amplitude from 0 to 7,0 A with 0,1 A step
   * @retval None
   */
 static void setSineAmplitude(uint8_t ampl)
 {
-	uint32_t temp = 0;
+	uint8_t point = 0;
+	uint8_t frac = 0;
+	int32_t lower = 0;
+	int32_t upper = 0;
+
 	if(!isCalibrationModeEnabled)
 	{
-		if(ampl > 70) ampl = 70; // limit value by 7A
-		temp = (uint32_t)(ampl*sineAmplitude_1A);
-		sineAmplitude = temp/10;
-		calcHalfSineWave(sineAmplitude, sineOffset);
+		if(ampl > SINE_AMPL_MAX) ampl = SINE_AMPL_MAX; // limit value by 7A
+		commandedCurrent = ampl;
+		point = ampl/10;
+		frac = ampl%10;
+		// 0 A is zero DAC amplitude
+		lower = (point == 0) ? 0 : calibPoints[point - 1];
+		upper = (point == SINE_CAL_POINTS) ? lower : calibPoints[point];
+		sineAmplitude = (uint16_t)(lower + ((upper - lower)*frac)/10);
+		isWaveUpdateRequired = 1;
 	}
 }
 
@@ -129,8 +353,15 @@ static void setSineOffset(uint16_t offset)
 		if(offset < 250) offset = 250;
 		if(offset > 500) offset = 500;
 
-		sineOffset = offset;
-		calcHalfSineWave(sineAmplitude, sineOffset);
+		if(calibPolarity)
+		{
+			sineOffsetNegative = offset;
+		}
+		else
+		{
+			sineOffset = offset;
+		}
+		isWaveUpdateRequired = 1;
 	}
 }
 
@@ -141,75 +372,1765 @@ static void setSineOffset(uint16_t offset)
   */
 static void calibrationModeControl(uint8_t is_enabled)
 {
+	if(is_enabled && !isCalibrationModeEnabled) isCalibrationPointSet = 0;
 	isCalibrationModeEnabled = is_enabled;
+	if(!is_enabled)
+	{
+		isDeadTimeSweepActive = 0;
+		calibPolarity = 0;
+	}
 }
 
 /**
-  * @brief  Save calibration values in EEPROM
+  * @brief  Save calibration values in EEPROM. Data is written from main loop without blocking, the result is reported
+  * by status flags and events
   * @param  None
   * @retval None
   */
 static void saveCalibrationData(void)
 {
-	HAL_StatusTypeDef flash_ok = HAL_ERROR;
+	if(isCalibrationModeEnabled)
+	{
+		// single point calibration: current raw amplitude is 1A value, the other points are scaled from it
+		if(!isCalibrationPointSet)
+		{
+			setLinearCalibration(sineAmplitude);
+			if(isRmsValid) rms1A = rmsMeasured;
+		}
+		sineAmplitude_1A = calibPoints[0];
+		setRampRate(rampRate);
+		isSettingsSaveRequired = 1;
+	}
+}
+
+/**
+  * @brief  Store current raw amplitude as calibration point. Used in calibration mode, points are saved
+  * by saveCalibrationData()
+  * @param  point: 1...SINE_CAL_POINTS - output current in A, which is measured with current raw amplitude
+  * @retval None
+  */
+static void setCalibrationPoint(uint8_t point)
+{
+	if(isCalibrationModeEnabled && (point >= 1) && (point <= SINE_CAL_POINTS))
+	{
+		calibPoints[point - 1] = sineAmplitude;
+		isCalibrationPointSet = 1;
+		// shunt is linear, any point gives 1A reference
+		if(isRmsValid) rms1A = rmsMeasured/point;
+	}
+}
+
+/**
+  * @brief  Select half period, which is calibrated by raw amplitude and offset commands. Used in calibration mode
+  * with full period mode enabled: positive half is calibrated as before, then negative half amplitude and offset
+  * are matched to it
+  * @param  is_negative: 0 - positive half, 1 - negative half
+  * @retval None
+  */
+static void calibrationPolarityControl(uint8_t is_negative)
+{
+	if(isCalibrationModeEnabled)
+	{
+		calibPolarity = is_negative;
+	}
+}
+
+/**
+  * @brief  Full period mode control. Used at 50 Hz, generator restarts from zero crossing
+  * @param  is_enabled: 0 - half period is replayed for both polarities, 1 - full period with polarity corrections
+  * @retval None
+  */
+static void fullPeriodControl(uint8_t is_enabled)
+{
+	if(is_enabled != isFullPeriodEnabled)
+	{
+		isFullPeriodEnabled = is_enabled;
+		if(sineFrequency == SINE_FREQ_TABLE) restartGenerator();
+	}
+}
 
+/**
+  * @brief  Linearization curve control. Used in calibration mode, the state is saved with calibration data
+  * @param  is_enabled: 0 - DAC codes are not corrected, 1 - DAC codes are corrected by linearization curve
+  * @retval None
+  */
+static void linearizationControl(uint8_t is_enabled)
+{
 	if(isCalibrationModeEnabled)
 	{
-		// update 1A DAC value
-		sineAmplitude_1A = sineAmplitude;
+		isLinearizationEnabled = is_enabled;
+		isWaveUpdateRequired = 1;
+	}
+}
+
+/**
+  * @brief  Take uploaded linearization curve. Called from USB interrupt, the curve is applied from main loop in
+  * calibration mode. Upload is dropped while the previous one is not applied, host checks the result by reading
+  * the curve back
+  * @param  knots: SINE_LIN_KNOTS corrections in DAC discretes
+  * @retval None
+  */
+static void loadLinearization(const int8_t* knots)
+{
+	if(isLinearizationUploaded) return;
+
+	for(uint8_t i = 0; i < SINE_LIN_KNOTS; i++)
+	{
+		linearizationUpload[i] = knots[i];
+	}
+	isLinearizationUploaded = 1;
+	if(!workQueue_Post(SINE_CS_CMD_SET_LINEARIZATION, 0)) isLinearizationUploaded = 0;
+}
+
+/**
+  * @brief  Copy actual linearization curve. Called from USB interrupt
+  * @param  knots: SINE_LIN_KNOTS corrections storage
+  * @retval None
+  */
+static void getLinearization(int8_t* knots)
+{
+	for(uint8_t i = 0; i < SINE_LIN_KNOTS; i++)
+	{
+		knots[i] = linearization[i];
+	}
+}
+
+/**
+  * @brief  Closed loop RMS regulation control. Loop needs shunt 1A reference, which is measured at calibration, and
+  * confirmed shunt ADC channel
+  * @param  is_enabled: 0 - open loop, 1 - envelope is corrected to hold commanded RMS current
+  * @retval None
+  */
+static void loopControl(uint8_t is_enabled)
+{
+	isLoopEnabled = is_enabled && CURRENT_SENSE_CHANNEL_CONFIRMED;
+	loopIntegral = 0;
+	loopGain = SINE_LOOP_GAIN_ONE;
+	loopSettleWindows = SINE_LOOP_SETTLE_WINDOWS;
+	isWaveUpdateRequired = 1;
+}
+
+/**
+  * @brief  Save settings snapshot: calibration, output state and counters. Written to EEPROM journal from main loop
+  * @param  None
+  * @retval None
+  */
+static void saveSettings(void)
+{
+	isSettingsSaveRequired = 1;
+}
+
+/**
+  * @brief  Capture control. Frozen record pauses RMS measurement, so loop correction is held until capture is released
+  * @param  trigger: SINE_CAPTURE_x, SINE_CAPTURE_STOP releases frozen record
+  * @retval None
+  */
+static void captureControl(uint8_t trigger)
+{
+	isCaptureReported = 0;
+	currentSense_CaptureCtrl(trigger);
+}
+
+/**
+  * @brief  Read frozen capture record. Called from USB interrupt
+  * @param  samples: SINE_CAPTURE_x sample words storage
+  * @param  first: index of the first sample in record
+  * @param  num: samples number
+  * @retval samples read, 0 - capture is not done or record end is reached
+  */
+static uint16_t readCapture(uint32_t* samples, uint16_t first, uint16_t num)
+{
+	return currentSense_ReadCapture(samples, first, num);
+}
+
+/**
+  * @brief  Get waveform slot part for control transfer data stage. The slot loses verification. Called from USB
+  * interrupt
+  * @param  first: index of the first sample
+  * @param  num: samples number
+  * @retval pointer to slot samples, NULL - slot is active or range exceeds slot
+  */
+static uint16_t* getWaveSlot(uint16_t first, uint16_t num)
+{
+	if(isWaveActive || (num == 0) || (first >= SINE_SAMPLES_NUM) || (num > (SINE_SAMPLES_NUM - first))) return NULL;
+
+	isWaveVerified = 0;
+	waveWrites++;
+
+	return &waveSlot[first];
+}
+
+/**
+  * @brief  Check waveform slot and activate it. Buffers are rebuilt from the slot and switched by DMA at half period
+  * boundary as at amplitude change. Loop correction is held, RMS target is known for sine only
+  * @param  crc: CRC-32 of the slot
+  * @param  writes: slot writes counter taken before the slot content was completed
+  * @retval None
+  */
+static void activateWave(uint32_t crc, uint32_t writes)
+{
+	uint32_t primask = __get_PRIMASK();
+	uint8_t is_valid = (journal_CalcCrc((const uint32_t*)waveSlot, SINE_WAVE_WORDS) == crc);
+
+	for(uint16_t i = 0; i < SINE_SAMPLES_NUM; i++)
+	{
+		if(waveSlot[i] > SINE_WAVE_MAX) is_valid = 0;
+	}
+
+	__disable_irq();
+	// slot written while it was built or checked is not activated
+	if(is_valid && (writes == waveWrites))
+	{
+		isWaveVerified = 1;
+	}
+	__set_PRIMASK(primask);
+
+	if(!isWaveVerified)
+	{
+		postEvent(SINE_EVENT_FAULT, SINE_FAULT_WAVE);
+		return;
+	}
+	waveControl(1);
+}
+
+/**
+  * @brief  Select output waveform
+  * @param  is_enabled: 0 - sine, 1 - verified waveform slot
+  * @retval None
+  */
+static void waveControl(uint8_t is_enabled)
+{
+	uint32_t primask = __get_PRIMASK();
+
+	__disable_irq();
+	isWaveActive = is_enabled && isWaveVerified;
+	__set_PRIMASK(primask);
+
+	loopIntegral = 0;
+	loopGain = SINE_LOOP_GAIN_ONE;
+	isWaveUpdateRequired = 1;
+}
+
+/**
+  * @brief  Set harmonic of synthesis list, the waveform is not rebuilt
+  * @param  value: SINE_HARMONIC_VALUE, even or out of range order is ignored
+  * @retval None
+  */
+static void setHarmonic(uint32_t value)
+{
+	uint8_t order = (uint8_t)((value >> 12) & 0x0F);
+	uint16_t amplitude = (uint16_t)(value & 0x0FFF);
+	uint16_t phase = (uint16_t)(value >> 16);
+	sineHarmonic* harmonic = NULL;
 
-		HAL_FLASHEx_DATAEEPROM_Unlock();
+	if(((order & 0x01) == 0) || (order > (2*SINE_HARMONICS_MAX - 1)) || (phase >= SINE_HARMONIC_PHASES)) return;
+
+	harmonic = &harmonics[(order - 1)/2];
+	harmonic->order = order;
+	harmonic->amplitude = (amplitude > SINE_WAVE_MAX) ? SINE_WAVE_MAX : amplitude;
+	harmonic->phase = phase;
+}
+
+/**
+  * @brief  Synthesize harmonics list into waveform slot and activate it, or clear the list. Synthesis duration is
+  * accounted in performance statistics
+  * @param  is_enabled: 1 - synthesize and activate, 0 - clear list, the active waveform is kept
+  * @retval None
+  */
+static void harmonicsControl(uint8_t is_enabled)
+{
+	uint32_t start = 0;
+	uint32_t writes = 0;
 
-		flash_ok = HAL_FLASHEx_DATAEEPROM_Erase(EEPROM_CAL_DATA_ADDR);
-		if(flash_ok == HAL_OK)
+	if(!is_enabled)
+	{
+		for(uint8_t i = 0; i < SINE_HARMONICS_MAX; i++)
 		{
-			flash_ok = HAL_FLASHEx_DATAEEPROM_Program(FLASH_TYPEPROGRAMDATA_HALFWORD, EEPROM_CAL_DATA_ADDR, sineAmplitude_1A);
-			flash_ok = HAL_FLASHEx_DATAEEPROM_Program(FLASH_TYPEPROGRAMDATA_HALFWORD, EEPROM_CAL_DATA_ADDR+2, sineOffset);
-			if(flash_ok != HAL_OK)
-			{
-				Error_Handler();
-			}
+			harmonics[i].amplitude = 0;
 		}
+		return;
+	}
 
-		HAL_FLASHEx_DATAEEPROM_Lock();
+	harmonicsUsed = 0;
+	for(uint8_t i = 0; i < SINE_HARMONICS_MAX; i++)
+	{
+		if(harmonics[i].amplitude) harmonicsUsed++;
 	}
+
+	// slot is rebuilt in main loop, where buffers are built from it, so it may be active. Inactive slot may be written
+	// by host meanwhile, such a mix is rejected by activation
+	writes = waveWrites;
+	start = getCycles();
+	clippedSamples = sineKernel_CalcHarmonics(waveSlot, harmonics, SINE_HARMONICS_MAX);
+	accountCycles(&harmonicsStats, getCycles() - start);
+
+	activateWave(journal_CalcCrc((const uint32_t*)waveSlot, SINE_WAVE_WORDS), writes);
 }
 
 /**
-  * @brief  Calculate half sine wave period with given amplitude and offset in DAC discretes
-  * @param  amplitude: 0...4095 - sine wave amplitude in DAC discretes
-  * @param  offset: 0...4095 - sine wave offset in DAC discretes
+  * @brief  Write sequence segment. Called from USB interrupt
+  * @param  index: 0...SINE_SEQUENCE_SEGMENTS-1 - segment index
+  * @param  segment: segment, it is ignored while sequencer is running
   * @retval None
   */
-static void calcHalfSineWave(uint16_t amplitude, uint16_t offset)
+static void loadSegment(uint8_t index, const sineCS_segment* segment)
 {
-  uint32_t temp = 0;
-  for(uint16_t i = 0; i < SINE_SAMPLES_NUM; i++)
-  {
-	  temp = (uint32_t)(amplitude*sineArray[i]);
-	  tempBuf[i] = (uint16_t)(temp>>12) + offset;
-  }
-  isHalfSineParamsChanged = 1;
-  isFullSineParamsChanged = 1;
+	if(sequenceLength || (index >= SINE_SEQUENCE_SEGMENTS)) return;
+
+	sequence[index] = *segment;
 }
 
-// update DAC data buffer after changing sine wave parameters
-void HAL_DAC_ConvHalfCpltCallbackCh1(DAC_HandleTypeDef* hdac)
+/**
+  * @brief  Start or stop sequencer. The first segment starts at once and switches output on, stopped sequencer keeps
+  * output as it is. Not used in calibration mode
+  * @param  value: segments number | loops << 16, loops 0 - endless, segments number 0 - stop
+  * @retval None
+  */
+static void sequenceControl(uint32_t value)
+{
+	uint8_t length = (uint8_t)(value & 0xFF);
+
+	if(sequenceLength) stopSequencer();
+	if((length == 0) || isCalibrationModeEnabled) return;
+	if(burstState != SINE_BURST_OFF) stopBurst();
+
+	if(length > SINE_SEQUENCE_SEGMENTS) length = SINE_SEQUENCE_SEGMENTS;
+	sequenceLoops = (uint16_t)(value >> 16);
+	loopsDone = 0;
+	segmentsDone = 0;
+	sequenceIndex = 0;
+	sequenceRampRate = rampRate;
+	startSegment(&sequence[0], 0);
+	if(!isOutputEnabled) powerControl(1);
+	sequenceLength = length;
+}
+
+/**
+  * @brief  Step sequencer by half periods counter. In the last half period of a segment the next amplitude is
+  * applied, so its buffer is built before the boundary and DMA switches to it exactly at the boundary. Called from
+  * main loop.
+  * Phase accumulator mode counts half periods when a buffer half is filled, several per fill at high frequency, and
+  * the counter runs ahead of DAC output by up to one fill (SINE_SAMPLES_NUM/2 samples). The last half period can be
+  * stepped over, then the next amplitude is picked up at the first zero crossing of the next fill, up to one fill
+  * late. Frequency change restarts generator when the counter reaches the boundary, so the samples already filled
+  * after it are not played and the segment can end in the middle of a half period
+  * @param  None
+  * @retval None
+  */
+static void processSequencer(void)
 {
-	uint16_t bufferSize = sizeof(sineHalfPeriod)/2;
-	if(isHalfSineParamsChanged)
+	uint32_t elapsed = 0;
+	uint32_t duration = 0;
+	uint8_t next = 0;
+
+	if(sequenceLength == 0) return;
+
+	elapsed = halfPeriodsCounter - segmentStart;
+	duration = 2*sequence[sequenceIndex].periods;
+	next = sequenceIndex + 1;
+	if(next >= sequenceLength)
+	{
+		// the last loop ends with the last segment
+		next = (sequenceLoops && ((loopsDone + 1) >= sequenceLoops)) ? SINE_SEQUENCE_IDLE : 0;
+	}
+
+	// the last half period can be stepped over in phase accumulator mode, then segment is staged and started at once.
+	// Frequency change restarts generator, it is not staged
+	if(!isSegmentStaged && ((elapsed + 1) >= duration) && (next != SINE_SEQUENCE_IDLE) &&
+			((sequence[next].frequency == 0) || (sequence[next].frequency == sineFrequency)))
 	{
-		isHalfSineParamsChanged = 0;
-		memcpy(sineHalfPeriod, tempBuf, bufferSize);
+		isSegmentStaged = 1;
+		startSegment(&sequence[next], 0);
 	}
+	if(elapsed < duration) return;
+
+	segmentsDone++;
+	if(next == SINE_SEQUENCE_IDLE)
+	{
+		loopsDone++;
+		stopSequencer();
+		powerControl(0);
+		postEvent(SINE_EVENT_SEQUENCE_FINISHED, segmentsDone);
+		return;
+	}
+	if(next == 0) loopsDone++;
+
+	sequenceIndex = next;
+	segmentStart += duration;
+	startSegment(&sequence[next], isSegmentStaged);
+	isSegmentStaged = 0;
 }
 
-void HAL_DAC_ConvCpltCallbackCh1(DAC_HandleTypeDef* hdac)
+/**
+  * @brief  Apply segment amplitude, ramp rate and frequency
+  * @param  segment: segment to apply
+  * @param  is_staged: 1 - amplitude is already applied
+  * @retval None
+  */
+static void startSegment(const sineCS_segment* segment, uint8_t is_staged)
 {
-	uint16_t bufferSize = sizeof(sineHalfPeriod)/2;
-	if(isFullSineParamsChanged)
+	if(!is_staged)
 	{
-		isFullSineParamsChanged = 0;
-		memcpy(sineHalfPeriod+SINE_SAMPLES_NUM/2, tempBuf+SINE_SAMPLES_NUM/2, bufferSize);
+		setRampRate(segment->rampRate);
+		setSineAmplitude(segment->amplitude);
+	}
+	if(segment->frequency && (segment->frequency != sineFrequency))
+	{
+		setFrequency(segment->frequency);
+		// waveform restarts from zero crossing, segment is counted from the restart
+		segmentStart = halfPeriodsCounter;
+	}
+	else if(sequenceLength == 0)
+	{
+		// the first segment
+		segmentStart = halfPeriodsCounter;
+	}
+}
+
+/**
+  * @brief  Stop sequencer, ramp rate set before sequence start is restored
+  * @param  None
+  * @retval None
+  */
+static void stopSequencer(void)
+{
+	sequenceLength = 0;
+	isSegmentStaged = 0;
+	setRampRate(sequenceRampRate);
+}
+
+/**
+  * @brief  Start or stop burst mode. Generator is gated at the next channel 1 switch off after burst amplitude is in
+  * DAC buffers, then each burst runs whole periods from that point to the same point. Power stage is switched on at
+  * the first gate, if it is off. Running burst mode is restarted. Not used in calibration mode
+  * @param  value: periods | interval << 16, periods 0 - stop and switch output off, interval 0...65535 ms between
+  * burst starts, 0 - single burst, then output is switched off
+  * @retval None
+  */
+static void burstControl(uint32_t value)
+{
+	uint16_t cycles = (uint16_t)(value & 0xFFFF);
+
+	if(burstState != SINE_BURST_OFF) stopBurst();
+	if((cycles == 0) || isCalibrationModeEnabled) return;
+
+	if(sequenceLength) stopSequencer();
+	if(cycles > SINE_BURST_CYCLES_MAX) cycles = SINE_BURST_CYCLES_MAX;
+	burstCycles = cycles;
+	burstInterval = (uint16_t)(value >> 16);
+	burstsDone = 0;
+	if(!isOutputEnabled) powerOnsCounter++;
+	isOutputEnabled = 1;
+	isWaveUpdateRequired = 1;
+	burstMark = halfPeriodsCounter;
+	burstTick = HAL_GetTick();
+	burstState = SINE_BURST_ARMING;
+}
+
+/**
+  * @brief  Step burst mode: gate generator, start bursts by interval and count them. Counting and gating are done by
+  * burst counter hardware. Called from main loop
+  * @param  None
+  * @retval None
+  */
+static void processBurst(void)
+{
+	switch(burstState)
+	{
+		case SINE_BURST_ARMING:
+			// new amplitude is taken at half period boundary, then DAC buffers are played out
+			if(isWaveUpdateRequired || isWaveApplyRequired || pendingHalves || (bufferVersion != appliedVersion) ||
+					((halfPeriodsCounter - burstMark) < 2))
+			{
+				burstTick = HAL_GetTick();
+				return;
+			}
+			if((HAL_GetTick() - burstTick) < SINE_BURST_SETTLE_MS) return;
+			burst_Sync();
+			burstState = SINE_BURST_SYNC;
+			break;
+
+		case SINE_BURST_SYNC:
+			if(!burst_IsGated()) return;
+			// both commutator channels are off
+			DC_EN_GPIO_Port->ODR |= DC_EN_Pin;
+			// LED indication
+			LED_GPIO_Port->ODR |= LED_Pin;
+			burstState = SINE_BURST_WAITING;
+			break;
+
+		case SINE_BURST_WAITING:
+			// the first burst starts at once
+			if(burstsDone && ((HAL_GetTick() - burstTick) < burstInterval)) return;
+			burstTick = HAL_GetTick();
+			burst_Start((generatorMode == SINE_MODE_DDS) ? (2*burstCycles) : burstCycles);
+			burstState = SINE_BURST_RUNNING;
+			break;
+
+		case SINE_BURST_RUNNING:
+			if(!burst_IsGated()) return;
+			burstsDone++;
+			if(burstInterval == 0)
+			{
+				stopBurst();
+				postEvent(SINE_EVENT_BURST_FINISHED, burstsDone);
+				return;
+			}
+			burstState = SINE_BURST_WAITING;
+			break;
+
+		default:
+			break;
+	}
+}
+
+/**
+  * @brief  Stop burst mode and switch output off without soft stop. Power stage is switched off before generator is
+  * released, so the rest of gated waveform is not output
+  * @param  None
+  * @retval None
+  */
+static void stopBurst(void)
+{
+	burstState = SINE_BURST_OFF;
+	isOutputEnabled = 0;
+	envelope = 0;
+	envelopeTarget = 0;
+	isWaveUpdateRequired = 1;
+	powerStageOff();
+	burst_Release();
+}
+
+/**
+  * @brief  Set sine frequency. 50 Hz is generated from precalculated table, other frequencies by phase accumulator.
+  * Waveform restarts from zero crossing
+  * @param  freq: SINE_FREQ_MIN...SINE_FREQ_MAX - frequency in mHz
+  * @retval None
+  */
+static void setFrequency(uint32_t freq)
+{
+	if(freq < SINE_FREQ_MIN) freq = SINE_FREQ_MIN;
+	if(freq > SINE_FREQ_MAX) freq = SINE_FREQ_MAX;
+
+	if(freq != sineFrequency)
+	{
+		sineFrequency = freq;
+		restartGenerator();
+	}
+}
+
+/**
+  * @brief  Set amplitude ramp rate. Used for soft start and soft stop too
+  * @param  rate: 0...65535 - ramp rate in 0,1 A/s discretes, 0 - amplitude is changed immediately
+  * @retval None
+  */
+static void setRampRate(uint16_t rate)
+{
+	rampRate = rate;
+	rampStep = (uint32_t)((((uint64_t)rate*sineAmplitude_1A) << 16)/(10*RAMP_STEPS_PER_SECOND));
+	if((rate != 0) && (rampStep == 0)) rampStep = 1;
+}
+
+/**
+  * @brief  Set commutator dead-time. Used in calibration mode. In table mode compare values are preloaded and
+  * switched by timer at the next update event, in the middle of a channel pulse; any mix of old and new values
+  * keeps channel 2 pulse inside channel 1 pause. In phase accumulator mode the next switch on edge uses new value
+  * @param  dead_time: SINE_DEAD_TIME_MIN...SINE_DEAD_TIME_MAX - dead-time in DAC samples
+  * @retval None
+  */
+static void setDeadTime(uint8_t dead_time)
+{
+	if(isCalibrationModeEnabled)
+	{
+		if(dead_time < SINE_DEAD_TIME_MIN) dead_time = SINE_DEAD_TIME_MIN;
+		if(dead_time > SINE_DEAD_TIME_MAX) dead_time = SINE_DEAD_TIME_MAX;
+
+		deadTime = dead_time;
+		if(generatorMode != SINE_MODE_DDS)
+		{
+			htim21.Instance->CCR1 = COMM_TABLE_CH1_PULSE(dead_time);
+			htim21.Instance->CCR2 = COMM_TABLE_CH2_PULSE(dead_time);
+		}
+	}
+}
+
+/**
+  * @brief  Dead-time calibration sweep control. Dead-time is decreased from maximum by one sample every
+  * SINE_DEAD_TIME_SWEEP_HALF_PERIODS half periods. The host watches the output and stops the sweep as soon as
+  * shoot-through step appears, then the previous (the shortest good) dead-time is restored
+  * @param  is_enabled: 1 - start sweep, 0 - stop sweep
+  * @retval None
+  */
+static void deadTimeSweepControl(uint8_t is_enabled)
+{
+	if(!isCalibrationModeEnabled) return;
+
+	if(is_enabled)
+	{
+		setDeadTime(SINE_DEAD_TIME_MAX);
+		isDeadTimeSweepActive = 1;
+		deadTimeSweepStart = halfPeriodsCounter;
+		postEvent(SINE_EVENT_DEAD_TIME, deadTime);
+	}
+	else if(isDeadTimeSweepActive)
+	{
+		isDeadTimeSweepActive = 0;
+		setDeadTime(deadTime + 1);
+		postEvent(SINE_EVENT_DEAD_TIME, deadTime);
+	}
+}
+
+/**
+  * @brief  Post driver command for deferred execution in main loop. Called from USB interrupt
+  * @param  cmd: SINE_CS_CMD_x command code
+  * @param  value: command argument
+  * @retval 1 - command accepted, 0 - command queue is full
+  */
+static uint8_t postCommand(uint8_t cmd, uint32_t value)
+{
+	return workQueue_Post(cmd, value);
+}
+
+/**
+  * @brief  Execute posted commands and recalculate waveform once for all of them. Called from main loop
+  * @param  None
+  * @retval None
+  */
+static void process(void)
+{
+	workItem item;
+
+	while(workQueue_Get(&item))
+	{
+		executeCommand(&item);
+		commandsCounter++;
+	}
+	processSequencer();
+	processBurst();
+
+	if(isWaveUpdateRequired)
+	{
+		isWaveUpdateRequired = 0;
+		// envelope keeps loop correction, calibration values are not corrected
+		if(isCalibrationModeEnabled) loopGain = SINE_LOOP_GAIN_ONE;
+		envelopeTarget = isOutputEnabled ? ((uint32_t)sineAmplitude*loopGain) : 0;
+		if(envelopeTarget > ((uint32_t)SINE_RAW_AMPL_MAX << 16)) envelopeTarget = (uint32_t)SINE_RAW_AMPL_MAX << 16;
+		loopSettleWindows = SINE_LOOP_SETTLE_WINDOWS;
+		// calibration and burst values are applied immediately
+		if((rampStep == 0) || isCalibrationModeEnabled || (burstState != SINE_BURST_OFF))
+		{
+			envelope = envelopeTarget;
+		}
+		isWaveApplyRequired = 1;
+	}
+	if(isEnvelopeStepped)
+	{
+		isEnvelopeStepped = 0;
+		isWaveApplyRequired = 1;
+	}
+
+	if(isDeadTimeSweepActive && ((halfPeriodsCounter - deadTimeSweepStart) >= SINE_DEAD_TIME_SWEEP_HALF_PERIODS))
+	{
+		// sweep ends at minimal dead-time if host does not stop it
+		deadTimeSweepStart = halfPeriodsCounter;
+		if(deadTime > SINE_DEAD_TIME_MIN)
+		{
+			setDeadTime(deadTime - 1);
+		}
+		else
+		{
+			isDeadTimeSweepActive = 0;
+		}
+		postEvent(SINE_EVENT_DEAD_TIME, deadTime);
+	}
+
+	processEepromWriter();
+	processFeedback();
+	if(!isCaptureReported && (currentSense_GetCaptureState() == CAPTURE_DONE))
+	{
+		isCaptureReported = 1;
+		postEvent(SINE_EVENT_CAPTURE_DONE, currentSense_GetCaptureTrigger());
+	}
+
+	// commands, received before previous buffer was switched by DMA, are coalesced into a single recalculation
+	// full period: the next pair of halves waits for the previous one, both halves of a period have the same parameters
+	if(isWaveApplyRequired && (((generatorMode == SINE_MODE_TABLE) && (bufferVersion == appliedVersion)) ||
+			((generatorMode == SINE_MODE_FULL_PERIOD) && !pendingHalves) || (generatorMode == SINE_MODE_DDS)))
+	{
+		isWaveApplyRequired = 0;
+		applyEnvelope();
+	}
+	processFullPeriod();
+}
+
+/**
+  * @brief  Fill status block with applied values, output state and counters. Called from USB interrupt
+  * @param  status: pointer to status block
+  * @retval None
+  */
+static void getStatus(sineCS_status* status)
+{
+	uint8_t flags = 0;
+
+	if(isOutputEnabled) flags |= SINE_STATUS_OUTPUT_ENABLED;
+	if(DC_EN_GPIO_Port->ODR & DC_EN_Pin) flags |= SINE_STATUS_POWER_ON;
+	if(isCalibrationModeEnabled) flags |= SINE_STATUS_CALIB_MODE;
+	if(envelope != envelopeTarget) flags |= SINE_STATUS_RAMP_ACTIVE;
+	if(isDeadTimeSweepActive) flags |= SINE_STATUS_DEAD_TIME_SWEEP;
+	if(isSettingsSaveRequired || (eepromState == EEPROM_WRITER_BUSY)) flags |= SINE_STATUS_EEPROM_BUSY;
+	if(eepromState == EEPROM_WRITER_ERROR) flags |= SINE_STATUS_EEPROM_ERROR;
+	if(isFullPeriodEnabled) flags |= SINE_STATUS_FULL_PERIOD;
+
+	status->version = SINE_STATUS_VERSION;
+	status->flags = flags;
+	status->fwVersion = SINE_FW_VERSION;
+	status->mode = (uint8_t)generatorMode;
+	status->burst = burstState;
+	status->amplitude = (uint16_t)(envelope >> 16);
+	status->targetAmplitude = sineAmplitude;
+	status->offset = sineOffset;
+	status->amplitude1A = sineAmplitude_1A;
+	status->rampRate = rampRate;
+	status->frequency = sineFrequency;
+	status->halfPeriods = halfPeriodsCounter;
+	status->commands = commandsCounter;
+	status->deadTime = deadTime;
+	for(uint8_t i = 0; i < SINE_CAL_POINTS; i++)
+	{
+		status->calibPoints[i] = calibPoints[i];
+	}
+	status->negativeGain = negativeGain;
+	status->negativeOffset = sineOffsetNegative;
+	status->calibPolarity = calibPolarity;
+	status->flagsExt = isLinearizationEnabled ? SINE_STATUS_EXT_LINEARIZATION : 0;
+	if(isLoopEnabled) status->flagsExt |= SINE_STATUS_EXT_LOOP;
+	if((loopGain == SINE_LOOP_GAIN_MIN) || (loopGain == SINE_LOOP_GAIN_MAX)) status->flagsExt |= SINE_STATUS_EXT_LOOP_LIMIT;
+	if(isRmsValid) status->flagsExt |= SINE_STATUS_EXT_RMS_VALID;
+	if(currentSense_GetCaptureState() == CAPTURE_ARMED) status->flagsExt |= SINE_STATUS_EXT_CAPTURE_ARMED;
+	if(currentSense_GetCaptureState() == CAPTURE_DONE) status->flagsExt |= SINE_STATUS_EXT_CAPTURE_DONE;
+	if(isWaveVerified) status->flagsExt |= SINE_STATUS_EXT_WAVE_VERIFIED;
+	if(isWaveActive) status->flagsExt |= SINE_STATUS_EXT_WAVE_ACTIVE;
+	status->rms = rmsMeasured;
+	status->rmsTarget = rmsTarget;
+	status->rms1A = rms1A;
+	status->adcZero = adcZero;
+	status->loopGain = loopGain;
+	status->sequenceSegment = sequenceLength ? sequenceIndex : SINE_SEQUENCE_IDLE;
+	status->sequenceLoops = (loopsDone > 0xFF) ? 0xFF : (uint8_t)loopsDone;
+}
+
+/**
+  * @brief  Get the oldest asynchronous event. Called from USB interrupt
+  * @param  event: pointer to event storage
+  * @retval 1 - event was taken, 0 - no events
+  */
+static uint8_t getEvent(sineCS_event* event)
+{
+	if(eventsHead == eventsTail) return 0;
+
+	*event = events[eventsTail & (SINE_EVENTS_NUM - 1)];
+	__DMB();
+	eventsTail++;
+
+	return 1;
+}
+
+/**
+  * @brief  Copy interrupts duration statistics. Called from USB interrupt
+  * @param  perf: pointer to statistics block
+  * @param  is_reset: 1 - clear statistics after reading
+  * @retval None
+  */
+static void getPerf(sineCS_perf* perf, uint8_t is_reset)
+{
+	uint32_t primask = __get_PRIMASK();
+	const sineCS_isrStats noStats = {0};
+
+	perf->version = SINE_PERF_VERSION;
+	perf->leanIsr = SINE_LEAN_ISR;
+	perf->reserved = 0;
+
+	__disable_irq();
+	for(uint8_t i = 0; i < SINE_ISR_NUM; i++)
+	{
+		perf->isr[i] = isrStats[i];
+		if(is_reset)
+		{
+			isrStats[i].count = 0;
+			isrStats[i].cycles = 0;
+			isrStats[i].maxCycles = 0;
+			isrStats[i].lastCycles = 0;
+		}
+	}
+	perf->commutator = commutatorLatency;
+	perf->bufferReady = bufferReadyLatency;
+	perf->recompute = recomputeStats;
+	perf->linearization = linearizationStats;
+	perf->harmonics = harmonicsStats;
+	perf->harmonicsUsed = harmonicsUsed;
+	perf->reserved2 = 0;
+	perf->clippedSamples = clippedSamples;
+	if(is_reset)
+	{
+		commutatorLatency.maxUs = 0;
+		commutatorLatency.lastUs = 0;
+		bufferReadyLatency = commutatorLatency;
+		recomputeStats = noStats;
+		linearizationStats = noStats;
+		harmonicsStats = noStats;
+	}
+	__set_PRIMASK(primask);
+}
+
+/**
+  * @brief  Account interrupt duration. Called at the end of measured interrupt handler
+  * @param  isr: SINE_ISR_x interrupt index
+  * @param  entry: SysTick value at handler entry
+  * @param  exit: SysTick value at handler exit
+  * @retval None
+  */
+void sineCS_IsrStatsUpdate(uint8_t isr, uint32_t entry, uint32_t exit)
+{
+	// SysTick counts down and may reload once during the handler
+	accountCycles(&isrStats[isr], (entry >= exit) ? (entry - exit) : (entry + SysTick->LOAD + 1 - exit));
+}
+
+/**
+  * @brief  Account measured duration
+  * @param  stats: duration statistics
+  * @param  cycles: duration in CPU cycles, maximal and last values saturate at 65535
+  * @retval None
+  */
+static void accountCycles(sineCS_isrStats* stats, uint32_t cycles)
+{
+	stats->count++;
+	stats->cycles += cycles;
+	if(cycles > 0xFFFF) cycles = 0xFFFF;
+	stats->lastCycles = (uint16_t)cycles;
+	if(cycles > stats->maxCycles) stats->maxCycles = (uint16_t)cycles;
+}
+
+/**
+  * @brief  Get CPU cycles counter made of HAL tick and SysTick value, measures intervals longer than SysTick period.
+  * Used from main loop only, where SysTick interrupt is never left pending
+  * @param  None
+  * @retval CPU cycles counter
+  */
+static uint32_t getCycles(void)
+{
+	uint32_t tick = 0;
+	uint32_t value = 0;
+
+	do
+	{
+		tick = HAL_GetTick();
+		value = SysTick->VAL;
+	}while(tick != HAL_GetTick());
+
+	return tick*(SysTick->LOAD + 1) + (SysTick->LOAD - value);
+}
+
+/**
+  * @brief  Account interrupt latency
+  * @param  latency: latency statistics
+  * @param  samples: whole DAC samples passed since the event
+  * @param  us: TIM2 counter, time since the last DAC sample
+  * @retval None
+  */
+static void updateLatency(sineCS_latency* latency, uint32_t samples, uint32_t us)
+{
+	us += samples*(1000000/DAC_SAMPLE_RATE) / SAMPLE_TIMER_TICK_US;
+	if(us > 0xFFFF) us = 0xFFFF;
+
+	latency->lastUs = (uint16_t)us;
+	if(us > latency->maxUs) latency->maxUs = (uint16_t)us;
+}
+
+/**
+  * @brief  Measure time from DMA half or full transfer to the moment, when the next buffer part is ready.
+  * DMA transfers are triggered by TIM2 update, so elapsed time is DMA position since the boundary plus TIM2 counter
+  * @param  dma_ch: DAC DMA channel
+  * @param  boundary: DMA remaining transfers number at the event: SINE_SAMPLES_NUM/2 or SINE_SAMPLES_NUM, in full
+  * period mode SINE_SAMPLES_NUM or SINE_FULL_PERIOD_SAMPLES
+  * @retval None
+  */
+static void measureBufferReadyLatency(DMA_Channel_TypeDef* dma_ch, uint16_t boundary)
+{
+	uint32_t us = 0;
+	uint32_t samples = 0;
+	uint32_t length = (generatorMode == SINE_MODE_FULL_PERIOD) ? SINE_FULL_PERIOD_SAMPLES : SINE_SAMPLES_NUM;
+
+	// TIM2 update between two reads makes position inconsistent with counter
+	do
+	{
+		us = htim2.Instance->CNT;
+		samples = boundary - dma_ch->CNDTR;
+	}while(htim2.Instance->CNT < us);
+	// DMA already passed the next boundary too: position is negative
+	if(samples >= length) samples += length;
+
+	updateLatency(&bufferReadyLatency, samples, us);
+}
+
+/**
+  * @brief  Post asynchronous event with half periods timestamp. Event is dropped if queue is full
+  * @param  type: SINE_EVENT_x event type
+  * @param  param: event parameter
+  * @retval None
+  */
+static void postEvent(uint8_t type, uint16_t param)
+{
+	uint32_t primask = __get_PRIMASK();
+	sineCS_event* event;
+
+	__disable_irq();
+	if((uint8_t)(eventsHead - eventsTail) < SINE_EVENTS_NUM)
+	{
+		event = &events[eventsHead & (SINE_EVENTS_NUM - 1)];
+		event->type = type;
+		event->reserved = 0;
+		event->param = param;
+		event->timestamp = halfPeriodsCounter;
+		eventsHead++;
+	}
+	__set_PRIMASK(primask);
+}
+
+/**
+  * @brief  Load the actual settings snapshot from journal. If journal is empty, calibration block of previous
+  * firmware versions is used. Output stays off, frequency is restored after generator is started
+  * @param  None
+  * @retval None
+  */
+static void loadSettings(void)
+{
+	sineCS_settings settings = {0};
+	uint8_t version = 0;
+
+	if(journal_Init() && journal_Load(SINE_SETTINGS_RECORD, &settings, sizeof(settings)/4, &version))
+	{
+		sineAmplitude_1A = settings.amplitude1A;
+		// records before version 2 have single calibration point
+		if(settings.calibPoints[0] == 0)
+		{
+			setLinearCalibration(settings.amplitude1A);
+		}
+		else
+		{
+			for(uint8_t i = 0; i < SINE_CAL_POINTS; i++)
+			{
+				calibPoints[i] = settings.calibPoints[i];
+			}
+			sineAmplitude_1A = calibPoints[0];
+		}
+		sineOffset = settings.offset;
+		if((settings.deadTime >= SINE_DEAD_TIME_MIN) && (settings.deadTime <= SINE_DEAD_TIME_MAX))
+		{
+			deadTime = settings.deadTime;
+		}
+		rampRate = settings.rampRate;
+		sineAmplitude = settings.amplitude;
+		lifetimeHalfPeriods = settings.halfPeriods;
+		powerOnsCounter = settings.powerOns;
+		if((settings.frequency != SINE_FREQ_TABLE) && (settings.frequency >= SINE_FREQ_MIN) && (settings.frequency <= SINE_FREQ_MAX))
+		{
+			workQueue_Post(SINE_CS_CMD_SET_FREQ, settings.frequency);
+		}
+		// records before version 3 have no polarity corrections
+		sineOffsetNegative = sineOffset;
+		if((settings.negativeGain >= SINE_POLARITY_GAIN_MIN) && (settings.negativeGain <= SINE_POLARITY_GAIN_MAX))
+		{
+			negativeGain = settings.negativeGain;
+			sineOffsetNegative = settings.negativeOffset;
+		}
+		if(settings.isFullPeriodEnabled)
+		{
+			workQueue_Post(SINE_CS_CMD_FULL_PERIOD_CTRL, 1);
+		}
+		// records before version 4 have no linearization curve, it is zero
+		for(uint8_t i = 0; i < SINE_LIN_KNOTS; i++)
+		{
+			linearization[i] = settings.linearization[i];
+		}
+		isLinearizationEnabled = settings.isLinearizationEnabled;
+		// records before version 5 have no shunt reference, loop stays open
+		rms1A = settings.rms1A;
+		isLoopEnabled = settings.isLoopEnabled && CURRENT_SENSE_CHANNEL_CONFIRMED;
+	}
+	else if(((*(__IO uint32_t *)EEPROM_CAL_DATA_ADDR) != 0) && (((*(__IO uint32_t *)EEPROM_CAL_DATA_ADDR) >> 24) == 0))
+	{
+		// old block: 1A amplitude, offset and dead-time halfwords; torn journal record has magic in the high byte
+		sineAmplitude_1A = (*(__IO uint16_t *)EEPROM_CAL_DATA_ADDR);
+		sineAmplitude = sineAmplitude_1A;
+		setLinearCalibration(sineAmplitude_1A);
+		sineOffset = (*(__IO uint16_t *)(EEPROM_CAL_DATA_ADDR+2));
+		sineOffsetNegative = sineOffset;
+		if(((*(__IO uint16_t *)(EEPROM_CAL_DATA_ADDR+4)) >= SINE_DEAD_TIME_MIN) &&
+				((*(__IO uint16_t *)(EEPROM_CAL_DATA_ADDR+4)) <= SINE_DEAD_TIME_MAX))
+		{
+			deadTime = (uint8_t)(*(__IO uint16_t *)(EEPROM_CAL_DATA_ADDR+4));
+		}
+	}
+}
+
+/**
+  * @brief  Fill calibration points proportionally to 1A value
+  * @param  ampl_1a: DAC amplitude at 1A
+  * @retval None
+  */
+static void setLinearCalibration(uint16_t ampl_1a)
+{
+	for(uint8_t i = 0; i < SINE_CAL_POINTS; i++)
+	{
+		calibPoints[i] = (uint16_t)(ampl_1a*(i + 1));
+	}
+}
+
+/**
+  * @brief  Start pending settings snapshot write and step EEPROM writer. Called from main loop
+  * @param  None
+  * @retval None
+  */
+static void processEepromWriter(void)
+{
+	eepromWriterState state;
+	sineCS_settings settings = {0};
+	uint32_t writes = eepromWriter_GetWrites();
+
+	if(isSettingsSaveRequired)
+	{
+		settings.amplitude1A = sineAmplitude_1A;
+		settings.offset = sineOffset;
+		settings.deadTime = deadTime;
+		settings.isOutputEnabled = isOutputEnabled;
+		settings.rampRate = rampRate;
+		settings.amplitude = sineAmplitude;
+		settings.frequency = sineFrequency;
+		settings.halfPeriods = lifetimeHalfPeriods + halfPeriodsCounter;
+		settings.powerOns = powerOnsCounter;
+		for(uint8_t i = 0; i < SINE_CAL_POINTS; i++)
+		{
+			settings.calibPoints[i] = calibPoints[i];
+		}
+		settings.negativeGain = negativeGain;
+		settings.negativeOffset = sineOffsetNegative;
+		settings.isFullPeriodEnabled = isFullPeriodEnabled;
+		for(uint8_t i = 0; i < SINE_LIN_KNOTS; i++)
+		{
+			settings.linearization[i] = linearization[i];
+		}
+		settings.isLinearizationEnabled = isLinearizationEnabled;
+		settings.rms1A = rms1A;
+		settings.isLoopEnabled = isLoopEnabled;
+		if(journal_Append(SINE_SETTINGS_RECORD, SINE_SETTINGS_VERSION, &settings, sizeof(settings)/4))
+		{
+			isSettingsSaveRequired = 0;
+		}
+	}
+
+	state = eepromWriter_Process(isEepromWriteAllowed());
+	// word programming stalls CPU longer than ADC ring lasts, late block interrupts have read overwritten samples
+	if(eepromWriter_GetWrites() != writes) currentSense_Discard();
+	if(state != eepromState)
+	{
+		eepromState = state;
+		if(state == EEPROM_WRITER_DONE)
+		{
+			postEvent(SINE_EVENT_SETTINGS_SAVED, (uint16_t)journal_GetSequence());
+		}
+		else if(state == EEPROM_WRITER_ERROR)
+		{
+			postEvent(SINE_EVENT_FAULT, SINE_FAULT_EEPROM);
+		}
+	}
+}
+
+/**
+  * @brief  Check if CPU can be stalled by EEPROM programming now. DMA keeps feeding DAC from RAM meanwhile, so the
+  * write must start right after buffer boundary and finish before the next refill or swap. Current sense window,
+  * which spans the stall, is discarded after the write
+  * @param  None
+  * @retval 1 - write can be started, 0 - write must wait
+  */
+static uint8_t isEepromWriteAllowed(void)
+{
+	uint32_t samples = 0;
+
+	// nothing is generated when power is off
+	if(!(DC_EN_GPIO_Port->ODR & DC_EN_Pin)) return 1;
+
+	// burst counter interrupt must not be stalled, gated generator reads no buffers
+	if((burstState == SINE_BURST_SYNC) || (burstState == SINE_BURST_RUNNING)) return 0;
+	if(burst_IsGated()) return 1;
+
+	// commutator compare interrupt is late if half period is shorter than programming time
+	if((generatorMode == SINE_MODE_DDS) && (sineFrequency > EEPROM_WRITE_FREQ_MAX)) return 0;
+
+	if(generatorMode == SINE_MODE_FULL_PERIOD)
+	{
+		// the idle half is rewritten after each half period boundary
+		samples = SINE_FULL_PERIOD_SAMPLES - hdac.DMA_Handle1->Instance->CNDTR;
+		if(samples >= SINE_SAMPLES_NUM) samples -= SINE_SAMPLES_NUM;
+		return (samples < EEPROM_WRITE_SLOT_SAMPLES);
+	}
+
+	samples = SINE_SAMPLES_NUM - hdac.DMA_Handle1->Instance->CNDTR;
+	if((generatorMode == SINE_MODE_DDS) && (samples >= SINE_SAMPLES_NUM/2))
+	{
+		// buffer halves are refilled at half transfer too
+		samples -= SINE_SAMPLES_NUM/2;
+	}
+	return (samples < EEPROM_WRITE_SLOT_SAMPLES);
+}
+
+/**
+  * @brief  Calculate shunt RMS of the last window and run the loop. Shunt zero is tracked while power is off
+  * @param  None
+  * @retval None
+  */
+static void processFeedback(void)
+{
+	currentSenseWindow window;
+	uint32_t mean = 0;
+	int64_t mean_sq = 0;
+
+	if(!currentSense_GetWindow(&window) || (window.samples == 0)) return;
+
+	mean = window.sum/window.samples;
+	if(!(DC_EN_GPIO_Port->ODR & DC_EN_Pin))
+	{
+		adcZero = (uint16_t)mean;
+		rmsMeasured = 0;
+		isRmsValid = 0;
+		loopIntegral = 0;
+		loopGain = SINE_LOOP_GAIN_ONE;
+		return;
+	}
+
+	// mean of (sample - zero)^2
+	mean_sq = (int64_t)(window.sumSq/window.samples) - 2*(int64_t)adcZero*mean + (int64_t)adcZero*adcZero;
+	if(mean_sq < 0) mean_sq = 0;
+	rmsMeasured = sqrtInt((uint32_t)mean_sq);
+	isRmsValid = 1;
+
+	if(loopSettleWindows)
+	{
+		// window holds samples of previous amplitude
+		loopSettleWindows--;
+		return;
+	}
+	regulate(rmsMeasured);
+}
+
+/**
+  * @brief  PI regulator step: correct envelope to hold commanded RMS current. Regulator runs only with steady
+  * envelope and confirmed shunt ADC channel, ramps and calibration are not disturbed
+  * @param  rms: measured shunt RMS, ADC discretes
+  * @retval None
+  */
+static void regulate(uint16_t rms)
+{
+	int32_t error = 0;
+	int32_t gain = 0;
+	uint32_t target = 0;
+
+	rmsTarget = (uint16_t)(((uint32_t)rms1A*commandedCurrent)/10);
+	if(!CURRENT_SENSE_CHANNEL_CONFIRMED || !isLoopEnabled || isCalibrationModeEnabled || !isOutputEnabled || (rms1A == 0) ||
+			(rmsTarget == 0) || (envelope != envelopeTarget) || isWaveApplyRequired || isWaveActive)
+	{
+		return;
+	}
+
+	// relative error, 1/65536
+	error = (int32_t)((((int32_t)rmsTarget - rms) * 65536) / rmsTarget);
+	loopIntegral += (int32_t)(((int64_t)error*SINE_LOOP_KI) >> 16);
+	if(loopIntegral > (SINE_LOOP_GAIN_MAX - SINE_LOOP_GAIN_ONE)) loopIntegral = SINE_LOOP_GAIN_MAX - SINE_LOOP_GAIN_ONE;
+	if(loopIntegral < (SINE_LOOP_GAIN_MIN - SINE_LOOP_GAIN_ONE)) loopIntegral = SINE_LOOP_GAIN_MIN - SINE_LOOP_GAIN_ONE;
+
+	gain = SINE_LOOP_GAIN_ONE + loopIntegral + (int32_t)(((int64_t)error*SINE_LOOP_KP) >> 16);
+	if(gain > SINE_LOOP_GAIN_MAX) gain = SINE_LOOP_GAIN_MAX;
+	if(gain < SINE_LOOP_GAIN_MIN) gain = SINE_LOOP_GAIN_MIN;
+	loopGain = (uint32_t)gain;
+
+	// correction is applied at once, without ramp and ramp events
+	target = (uint32_t)sineAmplitude*loopGain;
+	if(target > ((uint32_t)SINE_RAW_AMPL_MAX << 16)) target = (uint32_t)SINE_RAW_AMPL_MAX << 16;
+	envelopeTarget = target;
+	envelope = target;
+	isWaveApplyRequired = 1;
+	loopSettleWindows = SINE_LOOP_SETTLE_WINDOWS;
+}
+
+/**
+  * @brief  Calculate RMS window for current frequency: the shortest whole number of periods, which is not shorter
+  * than SINE_RMS_WINDOW_MIN samples
+  * @param  None
+  * @retval window length in samples
+  */
+static uint32_t calcRmsWindow(void)
+{
+	// period is DAC_SAMPLE_RATE*1000/frequency samples
+	const uint32_t period_x_freq = (uint32_t)DAC_SAMPLE_RATE*1000;
+	uint32_t periods = (SINE_RMS_WINDOW_MIN*sineFrequency + period_x_freq - 1)/period_x_freq;
+
+	return (periods*period_x_freq + sineFrequency/2)/sineFrequency;
+}
+
+/**
+  * @brief  Integer square root
+  * @param  value: radicand
+  * @retval floor of square root
+  */
+static uint16_t sqrtInt(uint32_t value)
+{
+	uint32_t root = 0;
+	uint32_t bit = 1UL << 30;
+
+	while(bit > value) bit >>= 2;
+	while(bit)
+	{
+		if(value >= root + bit)
+		{
+			value -= root + bit;
+			root = (root >> 1) + bit;
+		}
+		else
+		{
+			root >>= 1;
+		}
+		bit >>= 2;
+	}
+	return (uint16_t)root;
+}
+
+/**
+  * @brief  Apply current envelope and offset to DAC waveform. Power is switched off after soft stop
+  * @param  None
+  * @retval None
+  */
+static void applyEnvelope(void)
+{
+	uint16_t amplitude = (uint16_t)(envelope >> 16);
+	uint16_t offset = sineOffset;
+	uint16_t offset_negative = sineOffsetNegative;
+	uint32_t amplitude_negative = 0;
+
+	if(!isOutputEnabled && (amplitude == 0))
+	{
+		powerStageOff();
+		// set DAC output to zero
+		offset = 0;
+		offset_negative = 0;
+	}
+
+	if(generatorMode == SINE_MODE_DDS)
+	{
+		// new parameters are picked up by phase accumulator at the next half period
+		ddsParams = amplitude | ((uint32_t)offset << 16);
+	}
+	else if(generatorMode == SINE_MODE_FULL_PERIOD)
+	{
+		// halves are rewritten by processFullPeriod() when DMA leaves them
+		halfParams[0] = amplitude | ((uint32_t)offset << 16);
+		// corrected amplitude must not exceed DAC range
+		amplitude_negative = ((uint32_t)amplitude*negativeGain) >> 12;
+		if(amplitude_negative > (4095U - offset_negative)) amplitude_negative = 4095U - offset_negative;
+		halfParams[1] = amplitude_negative | ((uint32_t)offset_negative << 16);
+		pendingHalves = 0x03;
+	}
+	else
+	{
+		calcHalfSineWave(amplitude, offset);
+	}
+}
+
+/**
+  * @brief  Switch power stage off. Output state and counters are saved once output is switched off
+  * @param  None
+  * @retval None
+  */
+static void powerStageOff(void)
+{
+	if(DC_EN_GPIO_Port->ODR & DC_EN_Pin) isSettingsSaveRequired = 1;
+	DC_EN_GPIO_Port->ODR &= ~DC_EN_Pin;
+	// LED indication
+	LED_GPIO_Port->ODR &= ~LED_Pin;
+}
+
+/**
+  * @brief  Move envelope one step towards target. Called from DMA callback at DAC buffer period boundary,
+  * waveform is recalculated in main loop
+  * @param  None
+  * @retval None
+  */
+static void stepEnvelope(void)
+{
+	uint32_t env = envelope;
+	uint32_t target = envelopeTarget;
+
+	if(env == target) return;
+
+	if(env < target)
+	{
+		env = ((target - env) > rampStep) ? (env + rampStep) : target;
+	}
+	else
+	{
+		env = ((env - target) > rampStep) ? (env - rampStep) : target;
+	}
+	envelope = env;
+	isEnvelopeStepped = 1;
+	if(env == target)
+	{
+		postEvent(SINE_EVENT_RAMP_COMPLETE, (uint16_t)(env >> 16));
+	}
+}
+
+/**
+  * @brief  Execute single driver command
+  * @param  item: command from work queue
+  * @retval None
+  */
+static void executeCommand(workItem* item)
+{
+	switch(item->cmd)
+	{
+		case SINE_CS_CMD_POWER_CTRL:
+			powerControl((uint8_t)(item->value & 0x01));
+			break;
+
+		case SINE_CS_CMD_CALIB_MODE_CTRL:
+			calibrationModeControl((uint8_t)(item->value & 0x01));
+			break;
+
+		case SINE_CS_CMD_SAVE_CALIB_DATA:
+			saveCalibrationData();
+			break;
+
+		case SINE_CS_CMD_SAVE_SETTINGS:
+			saveSettings();
+			break;
+
+		case SINE_CS_CMD_SET_CAL_POINT:
+			setCalibrationPoint((uint8_t)((item->value > SINE_CAL_POINTS) ? 0 : item->value));
+			break;
+
+		case SINE_CS_CMD_FULL_PERIOD_CTRL:
+			fullPeriodControl((uint8_t)(item->value & 0x01));
+			break;
+
+		case SINE_CS_CMD_CALIB_POLARITY:
+			calibrationPolarityControl((uint8_t)(item->value & 0x01));
+			break;
+
+		case SINE_CS_CMD_LINEARIZATION_CTRL:
+			linearizationControl((uint8_t)(item->value & 0x01));
+			break;
+
+		case SINE_CS_CMD_SET_LINEARIZATION:
+			setLinearization();
+			break;
+
+		case SINE_CS_CMD_LOOP_CTRL:
+			loopControl((uint8_t)(item->value & 0x01));
+			break;
+
+		case SINE_CS_CMD_CAPTURE_CTRL:
+			captureControl((uint8_t)(item->value & 0xFF));
+			break;
+
+		case SINE_CS_CMD_WAVE_ACTIVATE:
+			activateWave(item->value, waveWrites);
+			break;
+
+		case SINE_CS_CMD_WAVE_CTRL:
+			waveControl((uint8_t)(item->value & 0x01));
+			break;
+
+		case SINE_CS_CMD_SET_HARMONIC:
+			setHarmonic(item->value);
+			break;
+
+		case SINE_CS_CMD_HARMONICS_CTRL:
+			harmonicsControl((uint8_t)(item->value & 0x01));
+			break;
+
+		case SINE_CS_CMD_SEQUENCE_CTRL:
+			sequenceControl(item->value);
+			break;
+
+		case SINE_CS_CMD_BURST_CTRL:
+			burstControl(item->value);
+			break;
+
+		case SINE_CS_CMD_SET_RAW_OFFSET:
+			setSineOffset(item->value);
+			break;
+
+		case SINE_CS_CMD_SET_RAW_AMPL:
+			setSineRawAmplitude(item->value);
+			break;
+
+		case SINE_CS_CMD_SET_AMPL:
+			setSineAmplitude((uint8_t)(item->value & 0xFF));
+			break;
+
+		case SINE_CS_CMD_SET_FREQ:
+			setFrequency(item->value);
+			break;
+
+		case SINE_CS_CMD_SET_RAMP_RATE:
+			setRampRate((uint16_t)item->value);
+			break;
+
+		case SINE_CS_CMD_SET_DEAD_TIME:
+			setDeadTime((uint8_t)((item->value > SINE_DEAD_TIME_MAX) ? SINE_DEAD_TIME_MAX : item->value));
+			break;
+
+		case SINE_CS_CMD_DEAD_TIME_SWEEP:
+			deadTimeSweepControl((uint8_t)(item->value & 0x01));
+			break;
+
+		default:
+			break;
+	}
+}
+
+/**
+  * @brief  Calculate half sine wave period with given amplitude and offset in DAC discretes into inactive buffer.
+  * DMA source is switched to this buffer at the end of current half period. The buffer version is odd while
+  * writing, so DMA callback never switches to partially written buffer and never waits for the writer
+  * @param  amplitude: 0...4095 - sine wave amplitude in DAC discretes
+  * @param  offset: 0...4095 - sine wave offset in DAC discretes
+  * @retval None
+  */
+static void calcHalfSineWave(uint16_t amplitude, uint16_t offset)
+{
+  bufferVersion++; // write started
+  __DMB();
+  buildHalfPeriod(sineHalfPeriod[activeBuffer ^ 1], amplitude, offset);
+  __DMB();
+  bufferVersion++; // write finished
+}
+
+/**
+  * @brief  Build half period into DAC buffer and correct it by linearization curve if enabled. Build duration is
+  * accounted in performance statistics. Called from main loop
+  * @param  buf: SINE_SAMPLES_NUM samples buffer
+  * @param  amplitude: 0...4095 - sine wave amplitude in DAC discretes
+  * @param  offset: 0...4095 - sine wave offset in DAC discretes
+  * @retval None
+  */
+static void buildHalfPeriod(uint16_t* buf, uint16_t amplitude, uint16_t offset)
+{
+	uint32_t start = getCycles();
+	uint32_t linearization_start = 0;
+
+	if(isWaveActive)
+	{
+		sineKernel_CalcHalfPeriodWave(buf, waveSlot, amplitude, offset);
+	}
+	else
+	{
+		sineKernel_CalcHalfPeriod(buf, amplitude, offset);
+	}
+	if(isLinearizationEnabled)
+	{
+		linearization_start = getCycles();
+		sineKernel_Linearize(buf, SINE_SAMPLES_NUM, linearization);
+		accountCycles(&linearizationStats, getCycles() - linearization_start);
+	}
+	accountCycles(&recomputeStats, getCycles() - start);
+}
+
+/**
+  * @brief  Apply uploaded linearization curve. Used in calibration mode, the curve is saved with calibration data
+  * @param  None
+  * @retval None
+  */
+static void setLinearization(void)
+{
+	if(isCalibrationModeEnabled)
+	{
+		for(uint8_t i = 0; i < SINE_LIN_KNOTS; i++)
+		{
+			linearization[i] = linearizationUpload[i];
+		}
+		isWaveUpdateRequired = 1;
+	}
+	isLinearizationUploaded = 0;
+}
+
+/**
+  * @brief  Rewrite pending half of full period buffer, when DMA does not read it. New parameters start with a whole
+  * period: the first half is written while DMA plays the second one, the second half while DMA plays the new first
+  * one. The switch waits up to one half period more. If DMA reaches the half while it is written, DMA callback
+  * reports underrun; the half is completed anyway and is played correctly from the next period
+  * @param  None
+  * @retval None
+  */
+static void processFullPeriod(void)
+{
+	uint32_t switches = halfSwitches;
+	uint8_t half = idleHalf;
+	uint32_t params = 0;
+
+	if((generatorMode != SINE_MODE_FULL_PERIOD) || !(pendingHalves & (1 << half))) return;
+	// second half first would play one period of old first and new second half
+	if((pendingHalves == 0x03) && (half != 0)) return;
+
+	writingHalf = half + 1;
+	__DMB();
+	// boundary between reading idle half and marking it: check the new idle half at the next call
+	if(switches != halfSwitches)
+	{
+		writingHalf = 0;
+		return;
+	}
+	params = halfParams[half];
+	buildHalfPeriod(sineHalfPeriod[half], (uint16_t)(params & 0xFFFF), (uint16_t)(params >> 16));
+	__DMB();
+	writingHalf = 0;
+	pendingHalves &= ~(1 << half);
+}
+
+/**
+  * @brief  Restart DAC DMA and commutator timer in the mode required by current frequency. TIM2 is stopped meanwhile,
+  * so DAC, DMA and TIM21 are frozen and start again synchronously from zero crossing. Burst mode is ended
+  * @param  None
+  * @retval None
+  */
+static void restartGenerator(void)
+{
+	DMA_Channel_TypeDef* dma_ch = hdac.DMA_Handle1->Instance;
+	TIM_TypeDef* tim = htim21.Instance;
+
+	// gated generator must not be started with power stage on
+	if(burstState != SINE_BURST_OFF) stopBurst();
+
+	// stop sample clock, commutator counter mode can be changed only when it is disabled
+	htim2.Instance->CR1 &= ~TIM_CR1_CEN;
+	tim->CR1 &= ~TIM_CR1_CEN;
+	dma_ch->CCR &= ~DMA_CCR_EN;
+	// both commutator channels are inactive while generator is stopped
+	tim->CCMR1 = (tim->CCMR1 & ~(TIM_CCMR1_OC1M | TIM_CCMR1_OC2M)) | TIM_CCMR1_OC1M_2 | TIM_CCMR1_OC2M_2;
+
+	isWaveApplyRequired = 0;
+	if(sineFrequency == SINE_FREQ_TABLE)
+	{
+		if(isFullPeriodEnabled)
+		{
+			generatorMode = SINE_MODE_FULL_PERIOD;
+			// DMA is stopped, so both halves are written immediately
+			applyEnvelope();
+			for(uint8_t half = 0; half < 2; half++)
+			{
+				buildHalfPeriod(sineHalfPeriod[half], (uint16_t)(halfParams[half] & 0xFFFF), (uint16_t)(halfParams[half] >> 16));
+			}
+			pendingHalves = 0;
+			writingHalf = 0;
+			idleHalf = 1;
+			dma_ch->CCR |= DMA_CCR_HTIE;
+		}
+		else
+		{
+			generatorMode = SINE_MODE_TABLE;
+			// DMA is stopped, so new buffer is activated immediately
+			applyEnvelope();
+			activeBuffer ^= 1;
+			appliedVersion = bufferVersion;
+			dma_ch->CCR &= ~DMA_CCR_HTIE;
+		}
+
+		// commutator edges are generated by timer hardware, no compare interrupts
+		tim->DIER &= ~(TIM_DIER_CC1IE | TIM_DIER_CC2IE);
+		tim->CR1 |= TIM_CR1_CMS_0;
+		tim->CCMR1 |= TIM_CCMR1_OC1PE | TIM_CCMR1_OC2PE;
+		tim->ARR = COMM_TABLE_PERIOD;
+		tim->CCR1 = COMM_TABLE_CH1_PULSE(deadTime);
+		tim->CCR2 = COMM_TABLE_CH2_PULSE(deadTime);
+	}
+	else
+	{
+		generatorMode = SINE_MODE_DDS;
+		applyEnvelope();
+		sineKernel_DdsStart(&dds, sineFrequency, ddsParams);
+		// prefill whole buffer, then each half is refilled while DMA reads the other one
+		halfPeriodsCounter += sineKernel_DdsFill(&dds, sineHalfPeriod[activeBuffer], SINE_SAMPLES_NUM, &ddsParams);
+		if(isLinearizationEnabled) sineKernel_Linearize(sineHalfPeriod[activeBuffer], SINE_SAMPLES_NUM, linearization);
+		dma_ch->CCR |= DMA_CCR_HTIE;
+
+		// channel 1 is switched on at the first crossing, channel 2 at the second one. Compare values are
+		// written from interrupt and must take effect immediately
+		tim->CR1 &= ~TIM_CR1_CMS;
+		tim->CCMR1 &= ~(TIM_CCMR1_OC1PE | TIM_CCMR1_OC2PE);
+		tim->DIER |= TIM_DIER_CC1IE | TIM_DIER_CC2IE;
+		tim->ARR = 0xFFFF;
+		tim->CCR1 = 1 + deadTime;
+		tim->CCR2 = sineKernel_NextCrossing(&dds, 1) + 1 + deadTime;
+	}
+	__HAL_DMA_CLEAR_FLAG(hdac.DMA_Handle1, __HAL_DMA_GET_GI_FLAG_INDEX(hdac.DMA_Handle1));
+	if(generatorMode == SINE_MODE_FULL_PERIOD)
+	{
+		// the first half is played with channel 1 switched on
+		dma_ch->CMAR = (uint32_t)sineHalfPeriod[0];
+		dma_ch->CNDTR = SINE_FULL_PERIOD_SAMPLES;
+	}
+	else
+	{
+		dma_ch->CMAR = (uint32_t)sineHalfPeriod[activeBuffer];
+		dma_ch->CNDTR = SINE_SAMPLES_NUM;
+	}
+	dma_ch->CCR |= DMA_CCR_EN;
+
+	// reload ARR and reset commutator counter
+	tim->EGR = TIM_EGR_UG;
+	tim->SR = 0;
+	if(generatorMode != SINE_MODE_DDS)
+	{
+		// channel 1 - PWM mode 2, channel 2 - PWM mode 1
+		tim->CNT = COMM_TABLE_START_CNT;
+		tim->CCMR1 = (tim->CCMR1 & ~(TIM_CCMR1_OC1M | TIM_CCMR1_OC2M)) | TIM_CCMR1_OC1M | TIM_CCMR1_OC2M_2 | TIM_CCMR1_OC2M_1;
+	}
+	else
+	{
+		// both channels become active on compare match
+		tim->CCMR1 = (tim->CCMR1 & ~(TIM_CCMR1_OC1M | TIM_CCMR1_OC2M)) | TIM_CCMR1_OC1M_0 | TIM_CCMR1_OC2M_0;
+	}
+	tim->CR1 |= TIM_CR1_CEN;
+
+	// ADC keeps sampling synchronously with DAC, the window is changed and capture ring is realigned
+	htim2.Instance->CNT = 0;
+	currentSense_SetWindow(calcRmsWindow());
+	currentSense_Resync();
+	loopSettleWindows = SINE_LOOP_SETTLE_WINDOWS;
+
+	htim2.Instance->CR1 |= TIM_CR1_CEN;
+}
+
+// refill the first half of DAC buffer in phase accumulator mode, release positive half in full period mode
+void HAL_DAC_ConvHalfCpltCallbackCh1(DAC_HandleTypeDef* hdac)
+{
+	if(generatorMode == SINE_MODE_FULL_PERIOD)
+	{
+		halfPeriodsCounter++;
+		// negative half is started while it is being written
+		if(writingHalf == 2) postEvent(SINE_EVENT_BUFFER_UNDERRUN, SINE_MODE_FULL_PERIOD);
+		idleHalf = 0;
+		halfSwitches++;
+		measureBufferReadyLatency(hdac->DMA_Handle1->Instance, SINE_SAMPLES_NUM);
+		return;
+	}
+	if(generatorMode == SINE_MODE_DDS)
+	{
+		// DMA already finished the second half: the first one is refilled too late
+		if(__HAL_DMA_GET_FLAG(hdac->DMA_Handle1, __HAL_DMA_GET_TC_FLAG_INDEX(hdac->DMA_Handle1)))
+		{
+			postEvent(SINE_EVENT_BUFFER_UNDERRUN, SINE_MODE_DDS);
+		}
+		halfPeriodsCounter += sineKernel_DdsFill(&dds, sineHalfPeriod[activeBuffer], SINE_SAMPLES_NUM/2, &ddsParams);
+		if(isLinearizationEnabled) sineKernel_Linearize(sineHalfPeriod[activeBuffer], SINE_SAMPLES_NUM/2, linearization);
+		measureBufferReadyLatency(hdac->DMA_Handle1->Instance, SINE_SAMPLES_NUM/2);
+	}
+}
+
+// switch DAC DMA source to the new buffer at the half period boundary
+void HAL_DAC_ConvCpltCallbackCh1(DAC_HandleTypeDef* hdac)
+{
+	DMA_Channel_TypeDef* dma_ch = hdac->DMA_Handle1->Instance;
+	uint32_t version = bufferVersion;
+
+	if(generatorMode == SINE_MODE_FULL_PERIOD)
+	{
+		halfPeriodsCounter++;
+		if(writingHalf == 1) postEvent(SINE_EVENT_BUFFER_UNDERRUN, SINE_MODE_FULL_PERIOD);
+		idleHalf = 1;
+		halfSwitches++;
+		measureBufferReadyLatency(dma_ch, SINE_FULL_PERIOD_SAMPLES);
+		// envelope is stepped once per period after both halves are rewritten, two steps keep the ramp rate
+		if(!pendingHalves && !isWaveApplyRequired && !isEnvelopeStepped)
+		{
+			stepEnvelope();
+			stepEnvelope();
+		}
+		return;
+	}
+	if(generatorMode == SINE_MODE_DDS)
+	{
+		if(__HAL_DMA_GET_FLAG(hdac->DMA_Handle1, __HAL_DMA_GET_HT_FLAG_INDEX(hdac->DMA_Handle1)))
+		{
+			postEvent(SINE_EVENT_BUFFER_UNDERRUN, SINE_MODE_DDS);
+		}
+		halfPeriodsCounter += sineKernel_DdsFill(&dds, sineHalfPeriod[activeBuffer] + SINE_SAMPLES_NUM/2, SINE_SAMPLES_NUM/2,
+				&ddsParams);
+		if(isLinearizationEnabled)
+		{
+			sineKernel_Linearize(sineHalfPeriod[activeBuffer] + SINE_SAMPLES_NUM/2, SINE_SAMPLES_NUM/2, linearization);
+		}
+		measureBufferReadyLatency(dma_ch, SINE_SAMPLES_NUM);
+		stepEnvelope();
+		return;
+	}
+	halfPeriodsCounter++;
+
+	// switch only to completely written buffer with new parameters, otherwise replay current one
+	if(((version & 1) == 0) && (version != appliedVersion))
+	{
+		appliedVersion = version;
+		activeBuffer ^= 1;
+		// memory address can be changed only when channel is disabled. Next DAC request comes one sample later
+		dma_ch->CCR &= ~DMA_CCR_EN;
+		dma_ch->CMAR = (uint32_t)sineHalfPeriod[activeBuffer];
+		dma_ch->CNDTR = SINE_SAMPLES_NUM;
+		dma_ch->CCR |= DMA_CCR_EN;
+	}
+	else if(version & 1)
+	{
+		// new buffer is still being written, current half period is replayed
+		postEvent(SINE_EVENT_BUFFER_UNDERRUN, SINE_MODE_TABLE);
+	}
+	measureBufferReadyLatency(dma_ch, SINE_SAMPLES_NUM);
+
+	// next envelope step only after the previous one is played
+	if((bufferVersion == appliedVersion) && !isWaveApplyRequired && !isEnvelopeStepped)
+	{
+		stepEnvelope();
+	}
+}
+
+/**
+  * @brief  Realize dead-time function in phase accumulator mode: the next compare value is the next zero crossing
+  * of phase accumulator. In table mode compare interrupts are disabled, PWM outputs switch without CPU
+  * @param  htim: active timer handle
+  * @retval None
+  */
+void HAL_TIM_OC_DelayElapsedCallback(TIM_HandleTypeDef *htim)
+{
+	TIM_TypeDef* tim = htim->Instance;
+	uint32_t us = 0;
+	uint16_t ticks = 0;
+
+	if(generatorMode == SINE_MODE_DDS)
+	{
+		// compare match happens at TIM2 update, TIM21 ticks since match plus TIM2 counter is the latency
+		do
+		{
+			us = htim2.Instance->CNT;
+			ticks = (uint16_t)(tim->CNT - ((htim->Channel == HAL_TIM_ACTIVE_CHANNEL_1) ? tim->CCR1 : tim->CCR2));
+		}while(htim2.Instance->CNT < us);
+		updateLatency(&commutatorLatency, ticks, us);
+
+		// channel just switched on is switched off one tick after the next crossing, switched off channel is switched on
+		// dead-time after that
+		if(htim->Channel == HAL_TIM_ACTIVE_CHANNEL_1)
+		{
+			htim->Instance->CCR1 = sineKernel_NextCrossing(&dds, 0) + (((htim->Instance->CCMR1 & TIM_CCMR1_OC1M) == TIM_CCMR1_OC1M_0) ? 1 : 1 + deadTime);
+			htim->Instance->CCMR1 ^= (TIM_CCMR1_OC1M_1 | TIM_CCMR1_OC1M_0);
+		}
+		if(htim->Channel == HAL_TIM_ACTIVE_CHANNEL_2)
+		{
+			htim->Instance->CCR2 = sineKernel_NextCrossing(&dds, 1) + (((htim->Instance->CCMR1 & TIM_CCMR1_OC2M) == TIM_CCMR1_OC2M_0) ? 1 : 1 + deadTime);
+			htim->Instance->CCMR1 ^= (TIM_CCMR1_OC2M_1 | TIM_CCMR1_OC2M_0);
+		}
 	}
 }
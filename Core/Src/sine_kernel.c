@@ -0,0 +1,204 @@
+#include "sine_kernel.h"
+#include "sine_array.h"
+
+/**
+  * @brief  Calculate half sine wave period with given amplitude and offset in DAC discretes
+  * @param  buf: SINE_SAMPLES_NUM samples buffer
+  * @param  amplitude: 0...4095 - sine wave amplitude in DAC discretes
+  * @param  offset: 0...4095 - sine wave offset in DAC discretes
+  * @retval None
+  */
+void sineKernel_CalcHalfPeriod(uint16_t* buf, uint16_t amplitude, uint16_t offset)
+{
+	uint32_t temp = 0;
+
+	// second quarter is mirrored from the first one
+	buf[0] = (uint16_t)((amplitude*sineQuarter[0])>>12) + offset;
+	for(uint16_t i = 1; i < SINE_QUARTER_SAMPLES; i++)
+	{
+		temp = (uint32_t)(amplitude*sineQuarter[i]);
+		buf[i] = (uint16_t)(temp>>12) + offset;
+		buf[SINE_SAMPLES_NUM - i] = buf[i];
+	}
+	buf[SINE_QUARTER_SAMPLES] = (uint16_t)((amplitude*sineQuarter[SINE_QUARTER_SAMPLES])>>12) + offset;
+}
+
+/**
+  * @brief  Calculate half period of uploaded waveform with given amplitude and offset in DAC discretes
+  * @param  buf: SINE_SAMPLES_NUM samples buffer
+  * @param  wave: SINE_SAMPLES_NUM samples, 0...SINE_WAVE_MAX
+  * @param  amplitude: 0...4095 - waveform amplitude in DAC discretes
+  * @param  offset: 0...4095 - waveform offset in DAC discretes
+  * @retval None
+  */
+void sineKernel_CalcHalfPeriodWave(uint16_t* buf, const uint16_t* wave, uint16_t amplitude, uint16_t offset)
+{
+	for(uint16_t i = 0; i < SINE_SAMPLES_NUM; i++)
+	{
+		buf[i] = (uint16_t)(((uint32_t)amplitude*wave[i])>>12) + offset;
+	}
+}
+
+/**
+  * @brief  Synthesize half period from sine table harmonics. Each harmonic position in the table is stepped by its
+  * order, so only additions and multiplications are used. Negative samples can not be played in a half period and
+  * are clipped to 0, as samples above SINE_WAVE_MAX are clipped to it
+  * @param  wave: SINE_SAMPLES_NUM samples, 0...SINE_WAVE_MAX
+  * @param  harmonics: harmonics list, zero amplitude entries are skipped
+  * @param  num: 1...SINE_HARMONICS_MAX - list length
+  * @retval clipped samples number
+  */
+uint16_t sineKernel_CalcHarmonics(uint16_t* wave, const sineHarmonic* harmonics, uint8_t num)
+{
+	uint16_t pos[SINE_HARMONICS_MAX];
+	uint16_t step[SINE_HARMONICS_MAX];
+	uint16_t amplitude[SINE_HARMONICS_MAX];
+	uint8_t used = 0;
+	uint16_t clipped = 0;
+	int32_t sum = 0;
+
+	for(uint8_t h = 0; (h < num) && (h < SINE_HARMONICS_MAX); h++)
+	{
+		if(harmonics[h].amplitude == 0) continue;
+		pos[used] = harmonics[h].phase % SINE_HARMONIC_PHASES;
+		step[used] = harmonics[h].order % SINE_HARMONIC_PHASES;
+		amplitude[used] = harmonics[h].amplitude;
+		used++;
+	}
+
+	for(uint16_t i = 0; i < SINE_SAMPLES_NUM; i++)
+	{
+		sum = 0;
+		for(uint8_t h = 0; h < used; h++)
+		{
+			// the second half of harmonic period is negative
+			if(pos[h] < SINE_SAMPLES_NUM)
+			{
+				sum += (int32_t)amplitude[h]*SINE_HALF_SAMPLE(pos[h]);
+			}
+			else
+			{
+				sum -= (int32_t)amplitude[h]*SINE_HALF_SAMPLE(pos[h] - SINE_SAMPLES_NUM);
+			}
+			pos[h] += step[h];
+			if(pos[h] >= SINE_HARMONIC_PHASES) pos[h] -= SINE_HARMONIC_PHASES;
+		}
+		sum >>= 12;
+		if((sum < 0) || (sum > SINE_WAVE_MAX))
+		{
+			sum = (sum < 0) ? 0 : SINE_WAVE_MAX;
+			clipped++;
+		}
+		wave[i] = (uint16_t)sum;
+	}
+
+	return clipped;
+}
+
+/**
+  * @brief  Start phase accumulator from zero crossing
+  * @param  dds: synthesis state
+  * @param  freq: sine wave frequency, mHz
+  * @param  params: amplitude | offset << 16 of the first half period
+  * @retval None
+  */
+void sineKernel_DdsStart(sineDds* dds, uint32_t freq, uint32_t params)
+{
+	dds->tuningWord = (uint32_t)(((uint64_t)freq << 33) / (DAC_SAMPLE_RATE * 1000ULL));
+	dds->halfPeriodInt = (uint16_t)(0x100000000ULL / dds->tuningWord);
+	dds->halfPeriodFrac = (uint32_t)(0x100000000ULL % dds->tuningWord);
+	dds->phase = 0;
+	dds->activeParams = params;
+	dds->crossing[0].tick = 0;
+	dds->crossing[0].frac = 0;
+	dds->crossing[1] = dds->crossing[0];
+}
+
+/**
+  * @brief  Generate samples by phase accumulator. Amplitude and offset are changed only at half period boundary
+  * @param  dds: synthesis state
+  * @param  buf: pointer to DAC buffer part
+  * @param  len: samples number
+  * @param  params: amplitude | offset << 16, latched at each phase wrap
+  * @retval number of started half periods
+  */
+uint16_t sineKernel_DdsFill(sineDds* dds, uint16_t* buf, uint16_t len, volatile const uint32_t* params)
+{
+	uint32_t phase = dds->phase;
+	uint32_t tuning_word = dds->tuningWord;
+	uint32_t active = dds->activeParams;
+	uint32_t amplitude = active & 0xFFFF;
+	uint16_t offset = (uint16_t)(active >> 16);
+	uint16_t idx = 0;
+	uint16_t wraps = 0;
+
+	for(uint16_t i = 0; i < len; i++)
+	{
+		idx = (uint16_t)(((phase >> 16) * SINE_SAMPLES_NUM) >> 16);
+		buf[i] = (uint16_t)((amplitude*SINE_HALF_SAMPLE(idx))>>12) + offset;
+
+		phase += tuning_word;
+		if(phase < tuning_word)
+		{
+			// phase wrapped: next sample starts new half period
+			wraps++;
+			active = *params;
+			amplitude = active & 0xFFFF;
+			offset = (uint16_t)(active >> 16);
+		}
+	}
+	dds->phase = phase;
+	dds->activeParams = active;
+
+	return wraps;
+}
+
+/**
+  * @brief  Calculate next zero crossing position for commutator channel. Crossing k is at ceil(k*2^32/tuningWord)
+  * sample, the same sample where phase accumulator wraps
+  * @param  dds: synthesis state
+  * @param  channel: 0 - channel 1, 1 - channel 2
+  * @retval crossing position in TIM21 ticks
+  */
+uint16_t sineKernel_NextCrossing(sineDds* dds, uint8_t channel)
+{
+	sineCrossing* crossing = &dds->crossing[channel];
+
+	crossing->tick += dds->halfPeriodInt;
+	crossing->frac += dds->halfPeriodFrac;
+	if(crossing->frac >= dds->tuningWord)
+	{
+		crossing->frac -= dds->tuningWord;
+		crossing->tick++;
+	}
+	return crossing->tick + (crossing->frac != 0);
+}
+
+/**
+  * @brief  Correct DAC codes by linearization curve. Cost is fixed per sample: one table lookup, one multiplication
+  * and clamping, no division, so buffer build time grows linearly with samples number. Code 0 is output switched
+  * off and stays uncorrected
+  * @param  buf: DAC samples to correct in place
+  * @param  len: samples number
+  * @param  knots: SINE_LIN_KNOTS corrections in DAC discretes
+  * @retval None
+  */
+void sineKernel_Linearize(uint16_t* buf, uint16_t len, const int8_t* knots)
+{
+	uint16_t code = 0;
+	uint16_t knot = 0;
+	int32_t lower = 0;
+	int32_t value = 0;
+
+	for(uint16_t i = 0; i < len; i++)
+	{
+		if(buf[i] == 0) continue;
+		code = (buf[i] > 4095) ? 4095 : buf[i];
+		knot = code >> SINE_LIN_STEP_SHIFT;
+		lower = knots[knot];
+		value = code + lower + (((knots[knot + 1] - lower)*(int32_t)(code & ((1 << SINE_LIN_STEP_SHIFT) - 1))) >> SINE_LIN_STEP_SHIFT);
+		if(value < 0) value = 0;
+		if(value > 4095) value = 4095;
+		buf[i] = (uint16_t)value;
+	}
+}
@@ -23,6 +23,9 @@
 #include "stm32l0xx_it.h"
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
+#include "sine_cs.h"
+#include "current_sense.h"
+#include "burst.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -60,6 +63,7 @@ extern PCD_HandleTypeDef hpcd_USB_FS;
 extern DMA_HandleTypeDef hdma_dac_ch1;
 extern TIM_HandleTypeDef htim21;
 /* USER CODE BEGIN EV */
+extern DAC_HandleTypeDef hdac;
 
 /* USER CODE END EV */
 
@@ -149,11 +153,34 @@ void SysTick_Handler(void)
 void DMA1_Channel2_3_IRQHandler(void)
 {
   /* USER CODE BEGIN DMA1_Channel2_3_IRQn 0 */
+  SINE_ISR_STATS_ENTER();
+#if SINE_LEAN_ISR
+  // channel 2 runs in circular mode only, so DAC callbacks are called directly. Both flags are set if the handler
+  // is late, the older half transfer is handled first
+  uint32_t flags = DMA1->ISR;
 
+  if (flags & DMA_ISR_HTIF2)
+  {
+    DMA1->IFCR = DMA_IFCR_CHTIF2;
+    HAL_DAC_ConvHalfCpltCallbackCh1(&hdac);
+  }
+  if (flags & DMA_ISR_TCIF2)
+  {
+    DMA1->IFCR = DMA_IFCR_CTCIF2;
+    HAL_DAC_ConvCpltCallbackCh1(&hdac);
+  }
+  if (flags & DMA_ISR_TEIF2)
+  {
+    // transfer error is rare, HAL handles it and reports to DAC handle
+    HAL_DMA_IRQHandler(&hdma_dac_ch1);
+  }
+  SINE_ISR_STATS_EXIT(SINE_ISR_DAC_DMA);
+  return;
+#endif
   /* USER CODE END DMA1_Channel2_3_IRQn 0 */
   HAL_DMA_IRQHandler(&hdma_dac_ch1);
   /* USER CODE BEGIN DMA1_Channel2_3_IRQn 1 */
-
+  SINE_ISR_STATS_EXIT(SINE_ISR_DAC_DMA);
   /* USER CODE END DMA1_Channel2_3_IRQn 1 */
 }
 
@@ -163,11 +190,30 @@ void DMA1_Channel2_3_IRQHandler(void)
 void TIM21_IRQHandler(void)
 {
   /* USER CODE BEGIN TIM21_IRQn 0 */
+  SINE_ISR_STATS_ENTER();
+#if SINE_LEAN_ISR
+  // only compare interrupts are enabled, in phase accumulator mode
+  uint32_t flags = TIM21->SR & TIM21->DIER;
 
+  TIM21->SR = ~(flags & (TIM_SR_CC1IF | TIM_SR_CC2IF));
+  if (flags & TIM_SR_CC1IF)
+  {
+    htim21.Channel = HAL_TIM_ACTIVE_CHANNEL_1;
+    HAL_TIM_OC_DelayElapsedCallback(&htim21);
+  }
+  if (flags & TIM_SR_CC2IF)
+  {
+    htim21.Channel = HAL_TIM_ACTIVE_CHANNEL_2;
+    HAL_TIM_OC_DelayElapsedCallback(&htim21);
+  }
+  htim21.Channel = HAL_TIM_ACTIVE_CHANNEL_CLEARED;
+  SINE_ISR_STATS_EXIT(SINE_ISR_COMMUTATOR);
+  return;
+#endif
   /* USER CODE END TIM21_IRQn 0 */
   HAL_TIM_IRQHandler(&htim21);
   /* USER CODE BEGIN TIM21_IRQn 1 */
-
+  SINE_ISR_STATS_EXIT(SINE_ISR_COMMUTATOR);
   /* USER CODE END TIM21_IRQn 1 */
 }
 
@@ -187,5 +233,21 @@ void USB_IRQHandler(void)
 
 /* USER CODE BEGIN 1 */
 
+/**
+  * @brief This function handles DMA1 channel 1 interrupt, shunt ADC samples.
+  */
+void DMA1_Channel1_IRQHandler(void)
+{
+  currentSense_DmaHandler();
+}
+
+/**
+  * @brief This function handles TIM22 global interrupt, burst counter end.
+  */
+void TIM22_IRQHandler(void)
+{
+  burst_IrqHandler();
+}
+
 /* USER CODE END 1 */
 
@@ -0,0 +1,45 @@
+#include "work_queue.h"
+
+static workItem queue[WORK_QUEUE_SIZE];
+static volatile uint8_t head = 0;
+static volatile uint8_t tail = 0;
+
+/**
+  * @brief  Post command into the queue. Can be called from any interrupt context
+  * @param  cmd: command code
+  * @param  value: command argument
+  * @retval 1 - command posted, 0 - queue is full
+  */
+uint8_t workQueue_Post(uint8_t cmd, uint32_t value)
+{
+	uint8_t is_posted = 0;
+	uint32_t primask = __get_PRIMASK();
+
+	__disable_irq();
+	if((uint8_t)(head - tail) < WORK_QUEUE_SIZE)
+	{
+		queue[head & (WORK_QUEUE_SIZE - 1)].cmd = cmd;
+		queue[head & (WORK_QUEUE_SIZE - 1)].value = value;
+		head++;
+		is_posted = 1;
+	}
+	__set_PRIMASK(primask);
+
+	return is_posted;
+}
+
+/**
+  * @brief  Get the oldest command from the queue. Called from main loop only
+  * @param  item: pointer to command storage
+  * @retval 1 - command was taken, 0 - queue is empty
+  */
+uint8_t workQueue_Get(workItem* item)
+{
+	if(head == tail) return 0;
+
+	*item = queue[tail & (WORK_QUEUE_SIZE - 1)];
+	__DMB();
+	tail++;
+
+	return 1;
+}
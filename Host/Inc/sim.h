@@ -0,0 +1,75 @@
+#ifndef __SIM_H
+#define __SIM_H
+
+#include "stm32l0xx_hal.h"
+
+// Host simulator of STM32L052 peripherals used by firmware. Peripheral registers live at their device addresses,
+// firmware writes into the modelled pages are trapped and applied by the peripheral model, which never calls
+// firmware code. Interrupts are dispatched at tick boundaries, when PRIMASK is cleared and at each __disable_irq(),
+// which also takes one tick, so busy loops over critical sections let time pass. Main loop work takes no time.
+// One tick is 1 us, a TIM2 count at 1 MHz
+#define SIM_PROCESS_US 			10 		// main loop is called every SIM_PROCESS_US ticks
+#define SIM_EEPROM_WRITE_US 	3200 	// data EEPROM word erase and program, CPU is stalled
+#define SIM_ADC_CONVERSION_US 	4 		// ADC trigger to end of conversion, 39,5 cycles sampling at 16 MHz
+#define SIM_CORE_CLOCK 			32000000 	// SysTick clock, Hz
+
+// output stage: current is proportional to DAC code above stage zero, commutator sets the sign. Shunt is on DC
+// side, shunt amplifier gives rectified current over its own zero
+#define SIM_STAGE_ZERO_CODE 	372 	// DAC code of zero current, equals default sine offset
+#define SIM_STAGE_CODES_PER_A 	124 	// DAC codes per 1A, default calibration
+#define SIM_SHUNT_ZERO_CODE 	100 	// shunt ADC code at zero current
+#define SIM_SHUNT_CODES_PER_A 	400 	// shunt ADC codes per 1A
+
+#define SIM_IRQ_SLOTS 			(32 + 16) 	// exceptions and device interrupts, indexed by IRQn + 16
+
+// output sample at each DAC update
+typedef struct
+{
+	uint32_t time; 			// us
+	uint16_t dacCode; 		// DAC output register
+	uint8_t ch1; 			// TIM21 channel 1 output, positive half
+	uint8_t ch2; 			// TIM21 channel 2 output, negative half
+	uint8_t dcEn; 			// output stage power
+	float current; 			// A, signed by commutator, zero in dead-time
+}simSample;
+
+typedef struct
+{
+	uint32_t count; 		// handler calls
+	uint64_t ns; 			// host time in handler, nested handlers and register traps are excluded. Kernel signal
+							// delivery of traps is not, so it is a rough figure for handlers with register accesses
+	uint32_t accesses; 		// trapped register accesses: writes to modelled registers and ADC reads
+}simIrqStats;
+
+// simulator core
+void sim_Init(void);
+uint32_t sim_GetTime(void);
+void sim_Tick(void);
+void sim_Run(uint32_t us);
+void sim_Dispatch(void);
+void sim_SetMainLoop(void (*loop)(void));
+void sim_SetIrqHandler(IRQn_Type irq, void (*handler)(void));
+void sim_SetIrqHook(void (*hook)(IRQn_Type irq, uint8_t is_exit));
+void sim_GetIrqStats(IRQn_Type irq, simIrqStats* stats);
+void sim_ResetIrqStats(void);
+void sim_PendIrq(IRQn_Type irq);
+void sim_SetPreemptive(void (*isr)(void));
+void sim_Preempt(void);
+void* sim_Alias(uint32_t address);
+
+// peripheral model, called by simulator core
+void simPeriph_Reset(void);
+void simPeriph_Tick(void);
+void simPeriph_Write(uint32_t address, uint32_t old, uint32_t value);
+void simPeriph_Read(uint32_t address);
+uint8_t simPeriph_IrqLevel(IRQn_Type irq);
+void simPeriph_SetSampleHook(void (*hook)(const simSample* sample));
+float simPeriph_Current(void);
+
+// USB device model: start of frame each ms
+void simPcd_Tick(void);
+
+// board: CubeMX peripheral init and generator start, as main() does before its loop
+void simBoard_Init(void);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef __SIM_USB_H
+#define __SIM_USB_H
+
+#include <stdint.h>
+
+// Host side of full speed USB bus. Each transaction advances simulated time by its bus time: packet lengths
+// without bit stuffing and a minimal inter-packet delay. SOF packets and host frame scheduling are not modelled,
+// the transactions of a transfer follow each other at once. NAKed transactions are retried at once too
+#define SIM_USB_BITS_PER_US 	12 		// full speed, 12 Mbit/s
+#define SIM_USB_TOKEN_BITS 		35 		// SYNC, PID, address, endpoint, CRC5, EOP
+#define SIM_USB_DATA_BITS 		35 		// SYNC, PID, CRC16, EOP, data bits are added
+#define SIM_USB_HANDSHAKE_BITS 	19 		// SYNC, PID, EOP
+#define SIM_USB_GAP_BITS 		2 		// inter-packet delay
+#define SIM_USB_TIMEOUT_US 		100000 	// NAKed transaction is retried within this time
+#define SIM_USB_ADDRESS 		5 		// assigned by simUsb_Connect()
+#define SIM_USB_RESET_US 		10000 	// bus reset length
+
+typedef struct
+{
+	uint32_t transfers; 	// control transfers and single packet transfers, host round trips
+	uint32_t transactions; 	// NAKed ones included
+	uint32_t naks;
+	uint64_t bits; 			// bus time, bit times
+}simUsbStats;
+
+int32_t simUsb_Connect(void);
+int32_t simUsb_ControlTransfer(uint8_t bm_request, uint8_t request, uint16_t value, uint16_t index, uint8_t* data,
+		uint16_t length);
+int32_t simUsb_Out(uint8_t ep, const uint8_t* data, uint16_t length);
+int32_t simUsb_In(uint8_t ep, uint8_t* data, uint16_t length);
+uint8_t simUsb_GetAddress(void);
+void simUsb_GetStats(simUsbStats* stats);
+void simUsb_ResetStats(void);
+
+#endif
@@ -0,0 +1,613 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include "sim.h"
+#include "stm32l0xx_it.h"
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+#define SIM_PAGE_SIZE 		0x1000UL
+#define SIM_EFLAGS_TF 		0x100 		// x86 trap flag, single step
+#define SIM_FAULT_WRITE 	0x2 		// page fault error code: write access
+#define SIM_IRQ_BIT(slot) 	(1ULL << (slot))
+
+// device address ranges, each one is a shared memory object mapped twice: at device address for firmware and
+// at any address for the model, which writes registers without traps
+typedef struct
+{
+	uint32_t base;
+	uint32_t size;
+	uint8_t* alias;
+}simRegion;
+
+static simRegion regions[] = {
+	{PERIPH_BASE, 0x30000, NULL}, 						// APB, AHB peripherals
+	{IOPPERIPH_BASE, 0x2000, NULL}, 					// GPIO ports
+	{SCS_BASE, 0x1000, NULL}, 							// SysTick, NVIC, SCB
+	{DATA_EEPROM_BASE, 0x1000, NULL}, 					// data EEPROM
+	{OB_BASE, 0x1000, NULL}, 							// option bytes and unique ID
+};
+
+// pages with modelled registers: firmware writes are trapped. Reads are trapped too in ADC page, data register
+// read clears end of conversion flag
+static const uint32_t writeTrapPages[] = {
+	TIM2_BASE, DAC_BASE & ~(SIM_PAGE_SIZE - 1), TIM21_BASE & ~(SIM_PAGE_SIZE - 1), TIM22_BASE & ~(SIM_PAGE_SIZE - 1),
+	DMA1_BASE, FLASH_R_BASE, CRC_BASE, IOPPERIPH_BASE, IOPPERIPH_BASE + SIM_PAGE_SIZE, DATA_EEPROM_BASE
+};
+#define SIM_READ_TRAP_PAGE 	(ADC1_BASE & ~(SIM_PAGE_SIZE - 1))
+
+// register access under single step
+static volatile uint32_t trapAddress = 0; 	// word address, 0 - no access is stepped
+static volatile uint32_t trapOld = 0;
+static volatile uint8_t trapIsWrite = 0;
+static sigset_t trapMask;
+static uint64_t trapStartNs = 0;
+
+// interrupts
+static void (*vectors[SIM_IRQ_SLOTS])(void);
+static uint8_t priorities[SIM_IRQ_SLOTS];
+static simIrqStats irqStats[SIM_IRQ_SLOTS];
+static uint64_t enabled = 0;
+static uint64_t pending = 0;
+static uint8_t activePriority = 4; 				// thread mode, below any interrupt priority
+static uint8_t depth = 0; 						// nested handlers
+static int activeSlot = -1; 					// innermost running handler
+static volatile uint32_t primask = 0;
+static void (*irqHook)(IRQn_Type irq, uint8_t is_exit) = NULL;
+static uint64_t excludedNs = 0; 				// host time of traps, model ticks and nested handlers
+
+// preemptive mode: interrupt is a signal to main thread, hardware is not ticked
+static uint8_t isPreemptive = 0;
+static void (*preemptIsr)(void) = NULL;
+static pthread_t preemptThread;
+static volatile sig_atomic_t isPreemptPending = 0;
+static volatile sig_atomic_t isPreemptActive = 0;
+
+static uint32_t simTime = 0;
+static uint32_t nextProcess = 0;
+static uint32_t sysTickClocks = 0;
+static void (*mainLoop)(void) = NULL;
+
+static uint64_t nowNs(void);
+static int pageProtection(uint32_t page);
+static void protectPages(void);
+static void onFault(int sig, siginfo_t* info, void* context);
+static void onStep(int sig, siginfo_t* info, void* context);
+static void onPreempt(int sig);
+static void runPreempt(void);
+static int nextIrq(void);
+static void runHandler(int slot);
+static void tickSysTick(void);
+static void setDefaultVectors(void);
+
+/**
+  * @brief  Map device memory, install register traps and reset peripheral models. Called once per process
+  * @param  None
+  * @retval None
+  */
+void sim_Init(void)
+{
+	struct sigaction action;
+	void* view;
+	int fd;
+
+	for(uint32_t i = 0; i < sizeof(regions)/sizeof(regions[0]); i++)
+	{
+		fd = memfd_create("sim", 0);
+		if((fd < 0) || (ftruncate(fd, regions[i].size) != 0))
+		{
+			perror("sim: memfd");
+			exit(EXIT_FAILURE);
+		}
+		view = mmap((void*)(uintptr_t)regions[i].base, regions[i].size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+		regions[i].alias = mmap(NULL, regions[i].size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if((view != (void*)(uintptr_t)regions[i].base) || (regions[i].alias == MAP_FAILED))
+		{
+			fprintf(stderr, "sim: cannot map 0x%08X\n", (unsigned)regions[i].base);
+			exit(EXIT_FAILURE);
+		}
+		close(fd);
+	}
+
+	// traps must not be interrupted by anything, preemption signal included
+	memset(&action, 0, sizeof(action));
+	action.sa_flags = SA_SIGINFO;
+	sigfillset(&action.sa_mask);
+	action.sa_sigaction = onFault;
+	sigaction(SIGSEGV, &action, NULL);
+	action.sa_sigaction = onStep;
+	sigaction(SIGTRAP, &action, NULL);
+
+	setDefaultVectors();
+	memset(priorities, 0, sizeof(priorities));
+	enabled = 0;
+	pending = 0;
+	simTime = 0;
+	nextProcess = 0;
+	simPeriph_Reset();
+	protectPages();
+}
+
+/**
+  * @brief  Get simulated time
+  * @param  None
+  * @retval us since sim_Init()
+  */
+uint32_t sim_GetTime(void)
+{
+	return simTime;
+}
+
+/**
+  * @brief  Advance hardware by one tick without interrupt dispatch
+  * @param  None
+  * @retval None
+  */
+void sim_Tick(void)
+{
+	uint64_t start = depth ? nowNs() : 0;
+
+	if(isPreemptive) return;
+
+	simTime++;
+	simPeriph_Tick();
+	simPcd_Tick();
+	tickSysTick();
+
+	if(depth) excludedNs += nowNs() - start;
+}
+
+/**
+  * @brief  Run hardware, interrupts and main loop
+  * @param  us: simulated time to run
+  * @retval None
+  */
+void sim_Run(uint32_t us)
+{
+	uint32_t end = simTime + us;
+
+	while((int32_t)(simTime - end) < 0)
+	{
+		sim_Tick();
+		sim_Dispatch();
+		if((int32_t)(simTime - nextProcess) >= 0)
+		{
+			nextProcess = simTime + SIM_PROCESS_US;
+			if(mainLoop != NULL) mainLoop();
+		}
+	}
+}
+
+/**
+  * @brief  Take pending interrupts with priority above the current one, while PRIMASK is cleared
+  * @param  None
+  * @retval None
+  */
+void sim_Dispatch(void)
+{
+	int slot;
+
+	if(isPreemptive) return;
+	while(!primask && ((slot = nextIrq()) >= 0))
+	{
+		runHandler(slot);
+	}
+}
+
+/**
+  * @brief  Set function called by sim_Run() each SIM_PROCESS_US
+  * @param  loop: main loop body, NULL - no main loop
+  * @retval None
+  */
+void sim_SetMainLoop(void (*loop)(void))
+{
+	mainLoop = loop;
+}
+
+/**
+  * @brief  Replace interrupt handler, firmware handlers are installed by sim_Init()
+  * @param  irq: interrupt number
+  * @param  handler: new handler
+  * @retval None
+  */
+void sim_SetIrqHandler(IRQn_Type irq, void (*handler)(void))
+{
+	vectors[irq + 16] = handler;
+}
+
+/**
+  * @brief  Set function called before and after each interrupt handler, its time is not counted in statistics
+  * @param  hook: function, NULL - no hook
+  * @retval None
+  */
+void sim_SetIrqHook(void (*hook)(IRQn_Type irq, uint8_t is_exit))
+{
+	irqHook = hook;
+}
+
+/**
+  * @brief  Get interrupt handler statistics
+  * @param  irq: interrupt number
+  * @param  stats: pointer to statistics storage
+  * @retval None
+  */
+void sim_GetIrqStats(IRQn_Type irq, simIrqStats* stats)
+{
+	*stats = irqStats[irq + 16];
+}
+
+/**
+  * @brief  Clear statistics of all interrupts
+  * @param  None
+  * @retval None
+  */
+void sim_ResetIrqStats(void)
+{
+	memset(irqStats, 0, sizeof(irqStats));
+}
+
+/**
+  * @brief  Pend event interrupt, level interrupts are pended by peripheral model
+  * @param  irq: interrupt number
+  * @retval None
+  */
+void sim_PendIrq(IRQn_Type irq)
+{
+	pending |= SIM_IRQ_BIT(irq + 16);
+}
+
+/**
+  * @brief  Switch to preemptive mode: hardware stops, sim_Preempt() from any thread runs interrupt handler in main
+  * thread at once, or when main thread clears PRIMASK. Handler runs with PRIMASK cleared, like Cortex-M0+ does
+  * @param  isr: handler, it is not reentered
+  * @retval None
+  */
+void sim_SetPreemptive(void (*isr)(void))
+{
+	struct sigaction action;
+
+	preemptIsr = isr;
+	preemptThread = pthread_self();
+	memset(&action, 0, sizeof(action));
+	sigemptyset(&action.sa_mask);
+	action.sa_handler = onPreempt;
+	sigaction(SIGUSR1, &action, NULL);
+	isPreemptive = 1;
+}
+
+/**
+  * @brief  Request preemptive interrupt. Can be called from any thread
+  * @param  None
+  * @retval None
+  */
+void sim_Preempt(void)
+{
+	pthread_kill(preemptThread, SIGUSR1);
+}
+
+/**
+  * @brief  Get model view of device memory, writes through it are not trapped
+  * @param  address: device address
+  * @retval pointer, NULL - address is not modelled
+  */
+void* sim_Alias(uint32_t address)
+{
+	for(uint32_t i = 0; i < sizeof(regions)/sizeof(regions[0]); i++)
+	{
+		if((address - regions[i].base) < regions[i].size) return regions[i].alias + (address - regions[i].base);
+	}
+	return NULL;
+}
+
+// CMSIS core functions, routed here by shim core_cm0plus.h
+
+/**
+  * @brief  CPSID: on Cortex-M0+ instruction itself takes no time, here each critical section entry is a tick, so
+  * busy loops over critical sections let hardware run. Interrupts pending before are taken first
+  * @param  None
+  * @retval None
+  */
+void sim_DisableIrq(void)
+{
+	if(!isPreemptive)
+	{
+		sim_Tick();
+		if(!primask) sim_Dispatch();
+	}
+	primask = 1;
+}
+
+void sim_EnableIrq(void)
+{
+	sim_SetPrimask(0);
+}
+
+uint32_t sim_GetPrimask(void)
+{
+	return primask;
+}
+
+void sim_SetPrimask(uint32_t value)
+{
+	primask = value & 1;
+	if(primask) return;
+	if(!isPreemptive)
+	{
+		sim_Dispatch();
+		return;
+	}
+	if(!isPreemptActive)
+	{
+		while(isPreemptPending)
+		{
+			isPreemptPending = 0;
+			runPreempt();
+		}
+	}
+}
+
+void sim_NvicEnableIrq(IRQn_Type irq)
+{
+	if(irq >= 0) enabled |= SIM_IRQ_BIT(irq + 16);
+}
+
+uint32_t sim_NvicGetEnableIrq(IRQn_Type irq)
+{
+	return (irq >= 0) && (enabled & SIM_IRQ_BIT(irq + 16));
+}
+
+void sim_NvicDisableIrq(IRQn_Type irq)
+{
+	if(irq >= 0) enabled &= ~SIM_IRQ_BIT(irq + 16);
+}
+
+uint32_t sim_NvicGetPendingIrq(IRQn_Type irq)
+{
+	return (irq >= 0) && (pending & SIM_IRQ_BIT(irq + 16));
+}
+
+void sim_NvicSetPendingIrq(IRQn_Type irq)
+{
+	if(irq >= 0) pending |= SIM_IRQ_BIT(irq + 16);
+}
+
+void sim_NvicClearPendingIrq(IRQn_Type irq)
+{
+	// level interrupt pends again at once, if its flag is still set
+	if(irq >= 0) pending &= ~SIM_IRQ_BIT(irq + 16);
+}
+
+void sim_NvicSetPriority(IRQn_Type irq, uint32_t priority)
+{
+	priorities[irq + 16] = (uint8_t)(priority & ((1UL << __NVIC_PRIO_BITS) - 1));
+}
+
+uint32_t sim_NvicGetPriority(IRQn_Type irq)
+{
+	return priorities[irq + 16];
+}
+
+void sim_NvicSystemReset(void)
+{
+	fprintf(stderr, "sim: system reset requested at %u us\n", (unsigned)simTime);
+	exit(EXIT_FAILURE);
+}
+
+static uint64_t nowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+  * @brief  Get firmware view protection of device page
+  * @param  page: page address
+  * @retval PROT_x flags, -1 - page is not trapped
+  */
+static int pageProtection(uint32_t page)
+{
+	if(page == SIM_READ_TRAP_PAGE) return PROT_NONE;
+	for(uint32_t i = 0; i < sizeof(writeTrapPages)/sizeof(writeTrapPages[0]); i++)
+	{
+		if(page == writeTrapPages[i]) return PROT_READ;
+	}
+	return -1;
+}
+
+static void protectPages(void)
+{
+	for(uint32_t i = 0; i < sizeof(writeTrapPages)/sizeof(writeTrapPages[0]); i++)
+	{
+		mprotect((void*)(uintptr_t)writeTrapPages[i], SIM_PAGE_SIZE, PROT_READ);
+	}
+	mprotect((void*)(uintptr_t)SIM_READ_TRAP_PAGE, SIM_PAGE_SIZE, PROT_NONE);
+}
+
+/**
+  * @brief  Register access fault: the page is opened and the instruction is single stepped with all signals
+  * blocked. Faults outside modelled pages get default action
+  */
+static void onFault(int sig, siginfo_t* info, void* context)
+{
+	ucontext_t* uc = (ucontext_t*)context;
+	uintptr_t address = (uintptr_t)info->si_addr;
+	uint32_t page = (uint32_t)address & ~(SIM_PAGE_SIZE - 1);
+
+	(void)sig;
+	if(trapAddress || (address > 0xFFFFFFFFUL) || (pageProtection(page) < 0))
+	{
+		signal(SIGSEGV, SIG_DFL);
+		return;
+	}
+	trapStartNs = nowNs();
+	trapAddress = (uint32_t)address & ~3UL;
+	trapOld = *(volatile uint32_t*)sim_Alias(trapAddress);
+	trapIsWrite = (uc->uc_mcontext.gregs[REG_ERR] & SIM_FAULT_WRITE) ? 1 : 0;
+	mprotect((void*)(uintptr_t)page, SIM_PAGE_SIZE, PROT_READ | PROT_WRITE);
+
+	uc->uc_mcontext.gregs[REG_EFL] |= SIM_EFLAGS_TF;
+	trapMask = uc->uc_sigmask;
+	sigfillset(&uc->uc_sigmask);
+	sigdelset(&uc->uc_sigmask, SIGTRAP);
+}
+
+/**
+  * @brief  Register access is done: page is closed again, peripheral model applies the access
+  */
+static void onStep(int sig, siginfo_t* info, void* context)
+{
+	ucontext_t* uc = (ucontext_t*)context;
+	uint32_t address = trapAddress;
+	uint32_t page = address & ~(SIM_PAGE_SIZE - 1);
+
+	(void)sig;
+	(void)info;
+	if(!address)
+	{
+		signal(SIGTRAP, SIG_DFL);
+		return;
+	}
+	uc->uc_mcontext.gregs[REG_EFL] &= ~SIM_EFLAGS_TF;
+	uc->uc_sigmask = trapMask;
+	mprotect((void*)(uintptr_t)page, SIM_PAGE_SIZE, pageProtection(page));
+	trapAddress = 0;
+	if(activeSlot >= 0) irqStats[activeSlot].accesses++;
+
+	if(trapIsWrite || (*(volatile uint32_t*)sim_Alias(address) != trapOld))
+	{
+		simPeriph_Write(address, trapOld, *(volatile uint32_t*)sim_Alias(address));
+	}
+	else
+	{
+		simPeriph_Read(address);
+	}
+	excludedNs += nowNs() - trapStartNs;
+}
+
+static void onPreempt(int sig)
+{
+	(void)sig;
+	if(primask || isPreemptActive)
+	{
+		isPreemptPending = 1;
+		return;
+	}
+	runPreempt();
+}
+
+static void runPreempt(void)
+{
+	isPreemptActive = 1;
+	preemptIsr();
+	isPreemptActive = 0;
+}
+
+/**
+  * @brief  Find interrupt to be taken: level interrupts are pended by their flags, the highest priority wins,
+  * lower number wins among equal priorities. Only priority above the active one preempts
+  * @param  None
+  * @retval slot index, -1 - nothing to take
+  */
+static int nextIrq(void)
+{
+	int slot = -1;
+	uint8_t priority = activePriority;
+
+	if(SysTick->CTRL & SysTick_CTRL_TICKINT_Msk) enabled |= SIM_IRQ_BIT(SysTick_IRQn + 16);
+	else enabled &= ~SIM_IRQ_BIT(SysTick_IRQn + 16);
+
+	for(int i = 16; i < SIM_IRQ_SLOTS; i++)
+	{
+		if(simPeriph_IrqLevel((IRQn_Type)(i - 16))) pending |= SIM_IRQ_BIT(i);
+	}
+	for(int i = 0; i < SIM_IRQ_SLOTS; i++)
+	{
+		if((pending & enabled & SIM_IRQ_BIT(i)) && (priorities[i] < priority))
+		{
+			slot = i;
+			priority = priorities[i];
+		}
+	}
+	return slot;
+}
+
+/**
+  * @brief  Enter interrupt handler. Host time of nested handlers, register traps and model ticks is excluded
+  * @param  slot: interrupt slot
+  * @retval None
+  */
+static void runHandler(int slot)
+{
+	uint8_t saved_priority = activePriority;
+	int saved_slot = activeSlot;
+	uint64_t entry = nowNs();
+	uint64_t excluded = 0;
+	uint64_t start = 0;
+
+	if(vectors[slot] == NULL)
+	{
+		fprintf(stderr, "sim: no handler for IRQ %d\n", slot - 16);
+		abort();
+	}
+	pending &= ~SIM_IRQ_BIT(slot);
+	activePriority = priorities[slot];
+	activeSlot = slot;
+	depth++;
+
+	if(irqHook != NULL) irqHook((IRQn_Type)(slot - 16), 0);
+	excluded = excludedNs;
+	start = nowNs();
+	vectors[slot]();
+	irqStats[slot].ns += (nowNs() - start) - (excludedNs - excluded);
+	irqStats[slot].count++;
+	if(irqHook != NULL) irqHook((IRQn_Type)(slot - 16), 1);
+
+	depth--;
+	activeSlot = saved_slot;
+	activePriority = saved_priority;
+	excludedNs = excluded + (nowNs() - entry);
+}
+
+/**
+  * @brief  SysTick down counter at SIM_CORE_CLOCK, interrupt is pended at reload
+  * @param  None
+  * @retval None
+  */
+static void tickSysTick(void)
+{
+	uint32_t load = SysTick->LOAD & SysTick_LOAD_RELOAD_Msk;
+
+	if(!(SysTick->CTRL & SysTick_CTRL_ENABLE_Msk) || !load) return;
+
+	sysTickClocks += SIM_CORE_CLOCK/1000000;
+	if(sysTickClocks > load)
+	{
+		sysTickClocks -= load + 1;
+		SysTick->CTRL |= SysTick_CTRL_COUNTFLAG_Msk;
+		if(SysTick->CTRL & SysTick_CTRL_TICKINT_Msk) pending |= SIM_IRQ_BIT(SysTick_IRQn + 16);
+	}
+	SysTick->VAL = load - sysTickClocks;
+}
+
+static void setDefaultVectors(void)
+{
+	memset(vectors, 0, sizeof(vectors));
+	vectors[SysTick_IRQn + 16] = SysTick_Handler;
+	vectors[DMA1_Channel1_IRQn + 16] = DMA1_Channel1_IRQHandler;
+	vectors[DMA1_Channel2_3_IRQn + 16] = DMA1_Channel2_3_IRQHandler;
+	vectors[TIM21_IRQn + 16] = TIM21_IRQHandler;
+	vectors[TIM22_IRQn + 16] = TIM22_IRQHandler;
+	vectors[USB_IRQn + 16] = USB_IRQHandler;
+}
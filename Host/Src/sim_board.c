@@ -0,0 +1,35 @@
+// CubeMX init functions of main.c are static, so main.c is built here with its main() renamed
+#define main sim_FirmwareMain
+#include "main.c"
+#undef main
+
+#include "sim.h"
+
+/**
+  * @brief  Peripheral init and generator start, as main() does before its loop. SystemClock_Config() is not run,
+  * clock registers are not modelled
+  * @param  None
+  * @retval None
+  */
+void simBoard_Init(void)
+{
+	SystemCoreClock = SIM_CORE_CLOCK;
+	HAL_Init();
+
+	MX_GPIO_Init();
+	MX_DMA_Init();
+	MX_DAC_Init();
+	MX_TIM2_Init();
+	MX_TIM21_Init();
+	MX_USB_DEVICE_Init();
+
+	sineCS_drv->Init();
+	HAL_DAC_Start_DMA(&hdac, DAC_CHANNEL_1, (uint32_t*)sineHalfPeriod[0], SINE_SAMPLES_NUM, DAC_ALIGN_12B_R);
+	__HAL_DMA_DISABLE_IT(&hdma_dac_ch1, DMA_IT_HT);
+	__HAL_TIM_SET_COUNTER(&htim21, COMM_TABLE_START_CNT);
+	HAL_TIM_PWM_Start(&htim21, TIM_CHANNEL_1);
+	HAL_TIM_PWM_Start(&htim21, TIM_CHANNEL_2);
+	HAL_TIM_Base_Start(&htim2);
+
+	sim_SetMainLoop(sineCS_drv->Process);
+}
@@ -0,0 +1,17 @@
+#include "sim.h"
+
+// HAL parts which wait for hardware time or are not built for host
+
+/**
+  * @brief  Delay in simulated time: hardware runs and interrupts are taken, main loop is blocked as on device
+  * @param  Delay: ms
+  * @retval None
+  */
+void HAL_Delay(uint32_t Delay)
+{
+	for(uint32_t i = 0; i < Delay*1000U; i++)
+	{
+		sim_Tick();
+		sim_Dispatch();
+	}
+}
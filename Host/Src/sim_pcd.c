@@ -0,0 +1,647 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+#include "sim_usb.h"
+#include "usbd_def.h"
+
+// USB device peripheral model behind HAL PCD API, single buffered endpoints only. Endpoint status, packet memory
+// and correct transfer flags follow USB FS peripheral, HAL_PCD_IRQHandler() services them as HAL does and calls
+// the same callbacks of usbd_conf.c
+#define SIM_PMA_SIZE 			1024 	// packet memory, bytes
+#define SIM_PMA_BTABLE_ENTRY 	8 		// buffer table bytes per endpoint number
+#define SIM_EP_NUM 				8
+#define SIM_EP_BIT(num) 		(1U << (num))
+#define SIM_SOF_US 				1000
+
+typedef enum
+{
+	EP_DISABLED = 0,
+	EP_STALL,
+	EP_NAK,
+	EP_VALID
+}simEpStatus;
+
+// endpoint register: transmit and receive status, counts of packets in packet memory
+typedef struct
+{
+	simEpStatus tx;
+	simEpStatus rx;
+	uint16_t txCount; 		// IN packet bytes
+	uint16_t rxLimit; 		// OUT packet max bytes
+	uint16_t rxCount; 		// received OUT packet bytes
+}simEp;
+
+static PCD_HandleTypeDef* pcd = NULL;
+static uint8_t pma[SIM_PMA_SIZE];
+static simEp eps[SIM_EP_NUM];
+static uint8_t isStarted = 0;
+static uint8_t isConnected = 0;
+static uint8_t isResetPending = 0;
+static uint8_t isSofPending = 0;
+static uint8_t isSetup = 0; 			// endpoint 0 received packet is SETUP
+static uint8_t ctrRx = 0; 				// correct transfer flags, bit per endpoint number
+static uint8_t ctrTx = 0;
+static uint8_t deviceAddress = 0;
+static uint32_t sofUs = 0;
+
+// host side
+static simUsbStats stats;
+static uint32_t busBits = 0; 			// bit times not yet run
+
+static PCD_EPTypeDef* getEp(PCD_HandleTypeDef* hpcd, uint8_t ep_addr);
+static void checkPma(PCD_HandleTypeDef* hpcd, PCD_EPTypeDef* ep);
+static void startIn(PCD_EPTypeDef* ep);
+static void startOut(PCD_EPTypeDef* ep);
+static void serviceControl(PCD_HandleTypeDef* hpcd);
+static void serviceEndpoint(PCD_HandleTypeDef* hpcd, uint8_t num);
+static void runBus(uint32_t bits);
+static int32_t transaction(uint8_t ep_addr, uint8_t* data, uint16_t length, uint8_t is_setup);
+
+HAL_StatusTypeDef HAL_PCD_Init(PCD_HandleTypeDef* hpcd)
+{
+	if(hpcd == NULL) return HAL_ERROR;
+
+	if(hpcd->State == HAL_PCD_STATE_RESET)
+	{
+		hpcd->Lock = HAL_UNLOCKED;
+		HAL_PCD_MspInit(hpcd);
+	}
+	hpcd->State = HAL_PCD_STATE_BUSY;
+
+	for(uint8_t i = 0; i < hpcd->Init.dev_endpoints; i++)
+	{
+		hpcd->IN_ep[i].is_in = 1;
+		hpcd->IN_ep[i].num = i;
+		hpcd->IN_ep[i].type = EP_TYPE_CTRL;
+		hpcd->IN_ep[i].maxpacket = 0;
+		hpcd->IN_ep[i].xfer_buff = NULL;
+		hpcd->IN_ep[i].xfer_len = 0;
+		hpcd->OUT_ep[i].is_in = 0;
+		hpcd->OUT_ep[i].num = i;
+		hpcd->OUT_ep[i].type = EP_TYPE_CTRL;
+		hpcd->OUT_ep[i].maxpacket = 0;
+		hpcd->OUT_ep[i].xfer_buff = NULL;
+		hpcd->OUT_ep[i].xfer_len = 0;
+	}
+	hpcd->USB_Address = 0;
+	hpcd->State = HAL_PCD_STATE_READY;
+
+	pcd = hpcd;
+	memset(eps, 0, sizeof(eps));
+	ctrRx = 0;
+	ctrTx = 0;
+	isResetPending = 0;
+	isSofPending = 0;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_DeInit(PCD_HandleTypeDef* hpcd)
+{
+	if(hpcd == NULL) return HAL_ERROR;
+
+	hpcd->State = HAL_PCD_STATE_BUSY;
+	isStarted = 0;
+	HAL_PCD_MspDeInit(hpcd);
+	hpcd->State = HAL_PCD_STATE_RESET;
+	pcd = NULL;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_Start(PCD_HandleTypeDef* hpcd)
+{
+	(void)hpcd;
+	isStarted = 1;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_Stop(PCD_HandleTypeDef* hpcd)
+{
+	(void)hpcd;
+	isStarted = 0;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_SetAddress(PCD_HandleTypeDef* hpcd, uint8_t address)
+{
+	// as FS peripheral HAL does: new address is applied after status stage of SET_ADDRESS
+	hpcd->USB_Address = address;
+	if(address == 0) deviceAddress = 0;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_EP_Open(PCD_HandleTypeDef* hpcd, uint8_t ep_addr, uint16_t ep_mps, uint8_t ep_type)
+{
+	PCD_EPTypeDef* ep = getEp(hpcd, ep_addr);
+
+	ep->num = ep_addr & EP_ADDR_MSK;
+	ep->is_in = (ep_addr & 0x80U) ? 1 : 0;
+	ep->maxpacket = ep_mps;
+	ep->type = ep_type;
+	checkPma(hpcd, ep);
+
+	if(ep->is_in)
+	{
+		eps[ep->num].tx = EP_NAK;
+	}
+	else
+	{
+		eps[ep->num].rxLimit = ep_mps;
+		eps[ep->num].rx = EP_VALID;
+	}
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_EP_Close(PCD_HandleTypeDef* hpcd, uint8_t ep_addr)
+{
+	(void)hpcd;
+	if(ep_addr & 0x80U) eps[ep_addr & EP_ADDR_MSK].tx = EP_DISABLED;
+	else eps[ep_addr & EP_ADDR_MSK].rx = EP_DISABLED;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_EP_Flush(PCD_HandleTypeDef* hpcd, uint8_t ep_addr)
+{
+	(void)hpcd;
+	(void)ep_addr;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_EP_SetStall(PCD_HandleTypeDef* hpcd, uint8_t ep_addr)
+{
+	PCD_EPTypeDef* ep = getEp(hpcd, ep_addr);
+
+	ep->is_stall = 1;
+	if(ep->is_in) eps[ep->num].tx = EP_STALL;
+	else eps[ep->num].rx = EP_STALL;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_EP_ClrStall(PCD_HandleTypeDef* hpcd, uint8_t ep_addr)
+{
+	PCD_EPTypeDef* ep = getEp(hpcd, ep_addr);
+
+	ep->is_stall = 0;
+	if(ep->is_in)
+	{
+		eps[ep->num].tx = EP_NAK;
+	}
+	else
+	{
+		eps[ep->num].rxLimit = ep->maxpacket;
+		eps[ep->num].rx = EP_VALID;
+	}
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_EP_Transmit(PCD_HandleTypeDef* hpcd, uint8_t ep_addr, uint8_t* pBuf, uint32_t len)
+{
+	PCD_EPTypeDef* ep = &hpcd->IN_ep[ep_addr & EP_ADDR_MSK];
+
+	ep->xfer_buff = pBuf;
+	ep->xfer_len = len;
+	ep->xfer_count = 0;
+	ep->is_in = 1;
+	ep->num = ep_addr & EP_ADDR_MSK;
+	startIn(ep);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_EP_Receive(PCD_HandleTypeDef* hpcd, uint8_t ep_addr, uint8_t* pBuf, uint32_t len)
+{
+	PCD_EPTypeDef* ep = &hpcd->OUT_ep[ep_addr & EP_ADDR_MSK];
+
+	ep->xfer_buff = pBuf;
+	ep->xfer_len = len;
+	ep->xfer_count = 0;
+	ep->is_in = 0;
+	ep->num = ep_addr & EP_ADDR_MSK;
+	startOut(ep);
+	return HAL_OK;
+}
+
+uint32_t HAL_PCD_EP_GetRxCount(PCD_HandleTypeDef* hpcd, uint8_t ep_addr)
+{
+	return hpcd->OUT_ep[ep_addr & EP_ADDR_MSK].xfer_count;
+}
+
+HAL_StatusTypeDef HAL_PCDEx_PMAConfig(PCD_HandleTypeDef* hpcd, uint16_t ep_addr, uint16_t ep_kind, uint32_t pmaadress)
+{
+	PCD_EPTypeDef* ep = getEp(hpcd, (uint8_t)ep_addr);
+
+	if(ep_kind == PCD_SNG_BUF)
+	{
+		ep->doublebuffer = 0;
+		ep->pmaadress = (uint16_t)pmaadress;
+	}
+	else
+	{
+		ep->doublebuffer = 1;
+		ep->pmaaddr0 = (uint16_t)(pmaadress & 0xFFFFU);
+		ep->pmaaddr1 = (uint16_t)(pmaadress >> 16);
+	}
+	return HAL_OK;
+}
+
+/**
+  * @brief  Service bus reset, correct transfers, lowest endpoint number first, and start of frame
+  * @param  hpcd: PCD handle
+  * @retval None
+  */
+void HAL_PCD_IRQHandler(PCD_HandleTypeDef* hpcd)
+{
+	uint8_t num;
+
+	if(isResetPending)
+	{
+		isResetPending = 0;
+		memset(eps, 0, sizeof(eps));
+		ctrRx = 0;
+		ctrTx = 0;
+		HAL_PCD_ResetCallback(hpcd);
+		HAL_PCD_SetAddress(hpcd, 0);
+	}
+
+	while(ctrRx | ctrTx)
+	{
+		num = (uint8_t)__builtin_ctz(ctrRx | ctrTx);
+		if(num == 0) serviceControl(hpcd);
+		else serviceEndpoint(hpcd, num);
+	}
+
+	if(isSofPending)
+	{
+		isSofPending = 0;
+		HAL_PCD_SOFCallback(hpcd);
+	}
+}
+
+/**
+  * @brief  Start of frame each ms while host is connected
+  * @param  None
+  * @retval None
+  */
+void simPcd_Tick(void)
+{
+	if(!isStarted || !isConnected) return;
+
+	if(++sofUs >= SIM_SOF_US)
+	{
+		sofUs = 0;
+		isSofPending = 1;
+		sim_PendIrq(USB_IRQn);
+	}
+}
+
+/**
+  * @brief  Bus reset, then device gets address and configuration 1
+  * @param  None
+  * @retval 0 - device is configured, -1 - request is stalled or not answered
+  */
+int32_t simUsb_Connect(void)
+{
+	if(!isStarted || (pcd == NULL)) return -1;
+
+	isConnected = 1;
+	isResetPending = 1;
+	sim_PendIrq(USB_IRQn);
+	sim_Run(SIM_USB_RESET_US);
+
+	if(simUsb_ControlTransfer(0x00, USB_REQ_SET_ADDRESS, SIM_USB_ADDRESS, 0, NULL, 0) < 0) return -1;
+	if(simUsb_ControlTransfer(0x00, USB_REQ_SET_CONFIGURATION, 1, 0, NULL, 0) < 0) return -1;
+	return 0;
+}
+
+/**
+  * @brief  Control transfer: setup, data and status stages
+  * @param  bm_request: request type, bit 7 set - data stage is IN
+  * @param  request: request code
+  * @param  value: wValue
+  * @param  index: wIndex
+  * @param  data: data stage buffer
+  * @param  length: wLength
+  * @retval data stage bytes, -1 - request is stalled or not answered
+  */
+int32_t simUsb_ControlTransfer(uint8_t bm_request, uint8_t request, uint16_t value, uint16_t index, uint8_t* data,
+		uint16_t length)
+{
+	uint8_t setup[8] = {bm_request, request, LOBYTE(value), HIBYTE(value), LOBYTE(index), HIBYTE(index),
+			LOBYTE(length), HIBYTE(length)};
+	int32_t count = 0;
+	int32_t packet;
+
+	stats.transfers++;
+	if(transaction(0x00, setup, sizeof(setup), 1) < 0) return -1;
+
+	if(bm_request & 0x80U)
+	{
+		do
+		{
+			packet = transaction(0x80, data + count, MIN(length - count, USB_MAX_EP0_SIZE), 0);
+			if(packet < 0) return -1;
+			count += packet;
+		}while((packet == USB_MAX_EP0_SIZE) && (count < length));
+		if(transaction(0x00, NULL, 0, 0) < 0) return -1;
+		return count;
+	}
+
+	while(count < length)
+	{
+		packet = transaction(0x00, data + count, MIN(length - count, USB_MAX_EP0_SIZE), 0);
+		if(packet < 0) return -1;
+		count += packet;
+	}
+	if(transaction(0x80, NULL, 0, 0) < 0) return -1;
+	return count;
+}
+
+/**
+  * @brief  Single packet OUT transfer
+  * @param  ep: endpoint address
+  * @param  data: packet
+  * @param  length: packet bytes
+  * @retval bytes sent, -1 - endpoint is stalled or not answered
+  */
+int32_t simUsb_Out(uint8_t ep, const uint8_t* data, uint16_t length)
+{
+	stats.transfers++;
+	return transaction(ep & EP_ADDR_MSK, (uint8_t*)data, length, 0);
+}
+
+/**
+  * @brief  Single packet IN transfer
+  * @param  ep: endpoint address
+  * @param  data: buffer
+  * @param  length: buffer bytes
+  * @retval bytes received, -1 - endpoint is stalled or not answered
+  */
+int32_t simUsb_In(uint8_t ep, uint8_t* data, uint16_t length)
+{
+	stats.transfers++;
+	return transaction(ep | 0x80U, data, length, 0);
+}
+
+uint8_t simUsb_GetAddress(void)
+{
+	return deviceAddress;
+}
+
+void simUsb_GetStats(simUsbStats* result)
+{
+	*result = stats;
+}
+
+void simUsb_ResetStats(void)
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+static PCD_EPTypeDef* getEp(PCD_HandleTypeDef* hpcd, uint8_t ep_addr)
+{
+	if(ep_addr & 0x80U) return &hpcd->IN_ep[ep_addr & EP_ADDR_MSK];
+	return &hpcd->OUT_ep[ep_addr & EP_ADDR_MSK];
+}
+
+/**
+  * @brief  Packet buffer of opened endpoint must be single, fit in packet memory above buffer table and must not
+  * overlap buffers of other opened endpoints. Failure is a firmware configuration error
+  * @param  hpcd: PCD handle
+  * @param  ep: endpoint being opened
+  * @retval None
+  */
+static void checkPma(PCD_HandleTypeDef* hpcd, PCD_EPTypeDef* ep)
+{
+	uint32_t table = (ep->num + 1U)*SIM_PMA_BTABLE_ENTRY;
+	uint32_t start = ep->pmaadress;
+	uint32_t end = start + ep->maxpacket;
+	PCD_EPTypeDef* other;
+
+	for(uint8_t i = 0; i < SIM_EP_NUM; i++)
+	{
+		if((eps[i].tx != EP_DISABLED) || (eps[i].rx != EP_DISABLED)) table = MAX(table, (i + 1U)*SIM_PMA_BTABLE_ENTRY);
+	}
+	if(ep->doublebuffer || (start < table) || (end > SIM_PMA_SIZE))
+	{
+		fprintf(stderr, "sim: EP 0x%02X buffer 0x%03X...0x%03X is out of packet memory\n",
+				(unsigned)(ep->num | (ep->is_in << 7)), (unsigned)start, (unsigned)end);
+		abort();
+	}
+
+	for(uint8_t i = 0; i < SIM_EP_NUM; i++)
+	{
+		for(uint8_t is_in = 0; is_in < 2; is_in++)
+		{
+			other = is_in ? &hpcd->IN_ep[i] : &hpcd->OUT_ep[i];
+			if((other == ep) || ((is_in ? eps[i].tx : eps[i].rx) == EP_DISABLED)) continue;
+			if((start < other->pmaadress + other->maxpacket) && (other->pmaadress < end))
+			{
+				fprintf(stderr, "sim: EP 0x%02X buffer overlaps EP 0x%02X buffer\n",
+						(unsigned)(ep->num | (ep->is_in << 7)), (unsigned)(i | (is_in << 7)));
+				abort();
+			}
+		}
+	}
+}
+
+// next IN packet to packet memory, as USB_EPStartXfer() does
+static void startIn(PCD_EPTypeDef* ep)
+{
+	uint16_t count = (uint16_t)MIN(ep->xfer_len, ep->maxpacket);
+
+	if(count) memcpy(&pma[ep->pmaadress], ep->xfer_buff, count);
+	eps[ep->num].txCount = count;
+	eps[ep->num].tx = EP_VALID;
+}
+
+static void startOut(PCD_EPTypeDef* ep)
+{
+	uint16_t count = (uint16_t)MIN(ep->xfer_len, ep->maxpacket);
+
+	ep->xfer_len -= count;
+	eps[ep->num].rxLimit = count;
+	eps[ep->num].rx = EP_VALID;
+}
+
+/**
+  * @brief  Endpoint 0: SETUP and OUT packets go first, each packet is passed to device library, which splits
+  * transfers itself
+  * @param  hpcd: PCD handle
+  * @retval None
+  */
+static void serviceControl(PCD_HandleTypeDef* hpcd)
+{
+	PCD_EPTypeDef* ep;
+
+	if(ctrRx & SIM_EP_BIT(0))
+	{
+		ctrRx &= ~SIM_EP_BIT(0);
+		ep = &hpcd->OUT_ep[0];
+		ep->xfer_count = eps[0].rxCount;
+
+		if(isSetup)
+		{
+			isSetup = 0;
+			memcpy(hpcd->Setup, &pma[ep->pmaadress], ep->xfer_count);
+			HAL_PCD_SetupStageCallback(hpcd);
+			return;
+		}
+
+		if(ep->xfer_count && (ep->xfer_buff != NULL))
+		{
+			memcpy(ep->xfer_buff, &pma[ep->pmaadress], ep->xfer_count);
+			ep->xfer_buff += ep->xfer_count;
+			HAL_PCD_DataOutStageCallback(hpcd, 0);
+		}
+		if(!isSetup)
+		{
+			eps[0].rxLimit = ep->maxpacket;
+			eps[0].rx = EP_VALID;
+		}
+		return;
+	}
+
+	ctrTx &= ~SIM_EP_BIT(0);
+	ep = &hpcd->IN_ep[0];
+	ep->xfer_count = eps[0].txCount;
+	ep->xfer_buff += ep->xfer_count;
+	HAL_PCD_DataInStageCallback(hpcd, 0);
+
+	if((hpcd->USB_Address > 0) && (ep->xfer_len == 0))
+	{
+		deviceAddress = hpcd->USB_Address;
+		hpcd->USB_Address = 0;
+	}
+}
+
+/**
+  * @brief  Other endpoints: OUT transfer ends at requested length or short packet, bulk IN transfer is sent
+  * packet by packet, interrupt IN transfer is a single packet
+  * @param  hpcd: PCD handle
+  * @param  num: endpoint number
+  * @retval None
+  */
+static void serviceEndpoint(PCD_HandleTypeDef* hpcd, uint8_t num)
+{
+	PCD_EPTypeDef* ep;
+	uint16_t count;
+
+	if(ctrRx & SIM_EP_BIT(num))
+	{
+		ctrRx &= ~SIM_EP_BIT(num);
+		ep = &hpcd->OUT_ep[num];
+		count = eps[num].rxCount;
+		if(count) memcpy(ep->xfer_buff, &pma[ep->pmaadress], count);
+		ep->xfer_count += count;
+		ep->xfer_buff += count;
+
+		if((ep->xfer_len == 0) || (count < ep->maxpacket)) HAL_PCD_DataOutStageCallback(hpcd, num);
+		else startOut(ep);
+	}
+
+	if(ctrTx & SIM_EP_BIT(num))
+	{
+		ctrTx &= ~SIM_EP_BIT(num);
+		ep = &hpcd->IN_ep[num];
+		count = eps[num].txCount;
+
+		if(ep->type != EP_TYPE_BULK)
+		{
+			ep->xfer_len = 0;
+			HAL_PCD_DataInStageCallback(hpcd, num);
+			return;
+		}
+
+		ep->xfer_len = (ep->xfer_len > count) ? (ep->xfer_len - count) : 0;
+		if(ep->xfer_len == 0)
+		{
+			HAL_PCD_DataInStageCallback(hpcd, num);
+		}
+		else
+		{
+			ep->xfer_buff += count;
+			ep->xfer_count += count;
+			startIn(ep);
+		}
+	}
+}
+
+/**
+  * @brief  Run simulated time of bus transaction, fractions of us are carried to the next one
+  * @param  bits: transaction bit times
+  * @retval None
+  */
+static void runBus(uint32_t bits)
+{
+	stats.transactions++;
+	stats.bits += bits;
+	busBits += bits;
+	sim_Run(busBits/SIM_USB_BITS_PER_US);
+	busBits %= SIM_USB_BITS_PER_US;
+}
+
+/**
+  * @brief  Bus transaction: endpoint status is sampled at token, NAK is retried. Received data and correct
+  * transfer flag reach device after transaction time, then USB interrupt is pended
+  * @param  ep_addr: endpoint address, bit 7 set - IN
+  * @param  data: packet data
+  * @param  length: OUT packet bytes, IN buffer bytes
+  * @param  is_setup: SETUP token, endpoint 0 takes it in any status
+  * @retval packet bytes, -1 - stall, no answer or device buffer overrun
+  */
+static int32_t transaction(uint8_t ep_addr, uint8_t* data, uint16_t length, uint8_t is_setup)
+{
+	uint8_t num = ep_addr & EP_ADDR_MSK;
+	uint8_t is_in = (ep_addr & 0x80U) ? 1 : 0;
+	uint32_t start = sim_GetTime();
+	uint32_t data_bits = SIM_USB_GAP_BITS + SIM_USB_DATA_BITS + 8U*length;
+	uint32_t handshake_bits = SIM_USB_GAP_BITS + SIM_USB_HANDSHAKE_BITS + SIM_USB_GAP_BITS;
+	simEpStatus status;
+	uint16_t count;
+
+	if(!isConnected || (pcd == NULL)) return -1;
+
+	for(;;)
+	{
+		status = is_in ? eps[num].tx : eps[num].rx;
+		if(is_setup && (status != EP_DISABLED)) status = EP_VALID;
+
+		if(status == EP_VALID) break;
+		if(status == EP_DISABLED) return -1;
+		if(status == EP_STALL)
+		{
+			runBus(SIM_USB_TOKEN_BITS + (is_in ? 0 : data_bits) + handshake_bits);
+			return -1;
+		}
+		stats.naks++;
+		runBus(SIM_USB_TOKEN_BITS + (is_in ? 0 : data_bits) + handshake_bits);
+		if((sim_GetTime() - start) > SIM_USB_TIMEOUT_US) return -1;
+	}
+
+	if(is_in)
+	{
+		count = eps[num].txCount;
+		if(count > length) return -1;
+		if(count) memcpy(data, &pma[pcd->IN_ep[num].pmaadress], count);
+		eps[num].tx = EP_NAK;
+		runBus(SIM_USB_TOKEN_BITS + SIM_USB_GAP_BITS + SIM_USB_DATA_BITS + 8U*count + handshake_bits);
+		ctrTx |= SIM_EP_BIT(num);
+		sim_PendIrq(USB_IRQn);
+		return count;
+	}
+
+	if(!is_setup && (length > eps[num].rxLimit)) return -1;
+	eps[num].rx = EP_NAK;
+	runBus(SIM_USB_TOKEN_BITS + data_bits + handshake_bits);
+	// SETUP completion sets both directions of control endpoint to NAK, after device has served previous packet
+	if(is_setup)
+	{
+		eps[num].rx = EP_NAK;
+		eps[num].tx = EP_NAK;
+	}
+	if(length) memcpy(&pma[pcd->OUT_ep[num].pmaadress], data, length);
+	eps[num].rxCount = length;
+	isSetup = is_setup;
+	ctrRx |= SIM_EP_BIT(num);
+	sim_PendIrq(USB_IRQn);
+	return length;
+}
@@ -0,0 +1,762 @@
+#include <stddef.h>
+#include "sim.h"
+#include "main.h"
+
+// Peripheral models. Registers are read and written through model views, so nothing is trapped here.
+// Modelled: TIM2, TIM21, TIM22 up and center-aligned counting with preload, output compare and PWM modes,
+// update and compare pulse trigger outputs, external clock mode 1 from ITR0. DAC channel 1 with trigger and DMA
+// request. ADC triggered conversions with DMA request and overrun. DMA1 channels with request selection, sizes,
+// increments, circular mode and flags. GPIO output registers and TIM21 channels on PA2, PA3. CRC unit in default
+// configuration, CRC-32/MPEG-2. Data EEPROM word programming with CPU stall and PELOCK.
+// Not modelled: prescalers (TIM2 counts ticks), clock tree, trigger selection of DAC and ADC (TIM2 TRGO is the only
+// source), timer repetition counters, inputs and break
+
+#define SIM_REG(reg) 					((uint32_t)(uintptr_t)&(reg))
+#define SIM_IN(address, base, size) 	(((address) - (uint32_t)(base)) < (uint32_t)(size))
+
+#define SIM_TIM_UPDATE 		0x01
+#define SIM_TIM_CC(ch) 		(0x02 << (ch)) 	// compare flag is set
+#define SIM_TIM_TRGO 		0x40
+
+#define SIM_DMA_REQUEST_ADC 	0 		// channel 1
+#define SIM_DMA_REQUEST_DAC 	9 		// channel 2
+#define SIM_DMA_REQUEST_TIM2 	8 		// TIM2_CH2 on channel 3, TIM2_CH4 on channel 4
+#define SIM_DMA_GIF 			0x1
+#define SIM_DMA_TCIF 			0x2
+#define SIM_DMA_HTIF 			0x4
+#define SIM_DMA_TEIF 			0x8
+
+#define SIM_COMM_CH1_PIN 	GPIO_PIN_2
+#define SIM_COMM_CH2_PIN 	GPIO_PIN_3
+
+typedef struct
+{
+	uint32_t base; 			// device address
+	TIM_TypeDef* regs; 		// model view
+	uint16_t arr; 			// active auto-reload
+	uint16_t ccr[4]; 		// active compare values
+	uint8_t isDown; 		// center-aligned counting direction
+	uint8_t ref[4]; 		// OCxREF
+}simTimer;
+
+static simTimer tim2 = {TIM2_BASE};
+static simTimer tim21 = {TIM21_BASE};
+static simTimer tim22 = {TIM22_BASE};
+static DAC_TypeDef* dac = NULL;
+static ADC_TypeDef* adc = NULL;
+static DMA_TypeDef* dma = NULL;
+static DMA_Request_TypeDef* dmaSelect = NULL;
+static uint16_t dmaNumber[8]; 			// programmed transfers number, reload value of circular mode
+static GPIO_TypeDef* gpioa = NULL;
+static GPIO_TypeDef* gpiob = NULL;
+static GPIO_TypeDef* gpioh = NULL;
+static FLASH_TypeDef* flash = NULL;
+static CRC_TypeDef* crc = NULL;
+
+static uint8_t adcConversion = 0; 		// ticks to end of conversion, 0 - no conversion
+static uint16_t adcValue = 0; 			// sampled at trigger
+static uint8_t flashKeyStep = 0; 		// PEKEYR unlock sequence
+static simSample sample;
+static void (*sampleHook)(const simSample* sample) = NULL;
+
+static void timerWrite(simTimer* t, uint32_t offset, uint32_t old, uint32_t value);
+static uint32_t timerCount(simTimer* t);
+static uint32_t timerUpdate(simTimer* t);
+static void timerCompare(simTimer* t, uint8_t is_down, uint32_t* events);
+static void timerRefs(simTimer* t);
+static uint8_t timerMode(simTimer* t, uint8_t ch);
+static uint8_t timerOutput(simTimer* t, uint8_t ch);
+static void tim2Trgo(void);
+static void tim21Trgo(void);
+static uint8_t dmaRequest(uint8_t channel, uint8_t request);
+static DMA_Channel_TypeDef* dmaChannel(uint8_t channel);
+static void dmaWrite(uint32_t offset, uint32_t old, uint32_t value);
+static uint32_t busRead(uint32_t address, uint8_t size);
+static void busWrite(uint32_t address, uint8_t size, uint32_t value);
+static void dacTrigger(void);
+static void adcTrigger(void);
+static void adcComplete(void);
+static void adcWrite(uint32_t address, uint32_t old, uint32_t value);
+static void gpioWrite(GPIO_TypeDef* port, uint32_t offset, uint32_t old, uint32_t value);
+static void flashWrite(uint32_t offset, uint32_t old, uint32_t value);
+static void eepromWrite(uint32_t address, uint32_t old, uint32_t value);
+static void crcWrite(uint32_t offset, uint32_t old, uint32_t value);
+static void updatePins(void);
+static void recordSample(void);
+
+/**
+  * @brief  Set reset values of modelled registers
+  * @param  None
+  * @retval None
+  */
+void simPeriph_Reset(void)
+{
+	simTimer* timers[] = {&tim2, &tim21, &tim22};
+
+	for(uint8_t i = 0; i < 3; i++)
+	{
+		timers[i]->regs = sim_Alias(timers[i]->base);
+		timers[i]->regs->ARR = 0xFFFF;
+		timers[i]->arr = 0xFFFF;
+	}
+	dac = sim_Alias(DAC_BASE);
+	adc = sim_Alias(ADC1_BASE);
+	dma = sim_Alias(DMA1_BASE);
+	dmaSelect = sim_Alias(DMA1_CSELR_BASE);
+	gpioa = sim_Alias(GPIOA_BASE);
+	gpiob = sim_Alias(GPIOB_BASE);
+	gpioh = sim_Alias(GPIOH_BASE);
+	flash = sim_Alias(FLASH_R_BASE);
+	crc = sim_Alias(CRC_BASE);
+
+	flash->PECR = FLASH_PECR_PELOCK | FLASH_PECR_PRGLOCK | FLASH_PECR_OPTLOCK;
+	crc->DR = 0xFFFFFFFF;
+	crc->INIT = 0xFFFFFFFF;
+	crc->POL = 0x04C11DB7;
+	// unique ID for USB serial number
+	*(uint32_t*)sim_Alias(UID_BASE) = 0x53494D00;
+	*(uint32_t*)sim_Alias(UID_BASE + 4) = 0x484F5354;
+	*(uint32_t*)sim_Alias(UID_BASE + 0x14) = 0x00000001;
+}
+
+/**
+  * @brief  One us: TIM2 counts, its update triggers DAC, ADC and clocks TIM21. TIM2 compare requests read DAC
+  * output and commutator pins
+  * @param  None
+  * @retval None
+  */
+void simPeriph_Tick(void)
+{
+	uint32_t events = timerCount(&tim2);
+
+	if(events & SIM_TIM_TRGO) tim2Trgo();
+	if((events & SIM_TIM_CC(1)) && (tim2.regs->DIER & TIM_DIER_CC2DE)) dmaRequest(3, SIM_DMA_REQUEST_TIM2);
+	if((events & SIM_TIM_CC(3)) && (tim2.regs->DIER & TIM_DIER_CC4DE)) dmaRequest(4, SIM_DMA_REQUEST_TIM2);
+
+	if(adcConversion && !--adcConversion) adcComplete();
+	updatePins();
+}
+
+/**
+  * @brief  Apply firmware write to modelled page, memory already holds written value
+  * @param  address: word address
+  * @param  old: word before write
+  * @param  value: written word
+  * @retval None
+  */
+void simPeriph_Write(uint32_t address, uint32_t old, uint32_t value)
+{
+	if(SIM_IN(address, TIM2_BASE, 0x400)) timerWrite(&tim2, address - TIM2_BASE, old, value);
+	else if(SIM_IN(address, TIM21_BASE, 0x400)) timerWrite(&tim21, address - TIM21_BASE, old, value);
+	else if(SIM_IN(address, TIM22_BASE, 0x400)) timerWrite(&tim22, address - TIM22_BASE, old, value);
+	else if(SIM_IN(address, DMA1_BASE, 0x400)) dmaWrite(address - DMA1_BASE, old, value);
+	else if(SIM_IN(address, ADC1_BASE, 0x400)) adcWrite(address, old, value);
+	else if(SIM_IN(address, GPIOA_BASE, 0x400)) gpioWrite(gpioa, address - GPIOA_BASE, old, value);
+	else if(SIM_IN(address, GPIOB_BASE, 0x400)) gpioWrite(gpiob, address - GPIOB_BASE, old, value);
+	else if(SIM_IN(address, GPIOH_BASE, 0x400)) gpioWrite(gpioh, address - GPIOH_BASE, old, value);
+	else if(SIM_IN(address, FLASH_R_BASE, 0x400)) flashWrite(address - FLASH_R_BASE, old, value);
+	else if(SIM_IN(address, DATA_EEPROM_BASE, DATA_EEPROM_END + 1 - DATA_EEPROM_BASE)) eepromWrite(address, old, value);
+	else if(SIM_IN(address, CRC_BASE, 0x400)) crcWrite(address - CRC_BASE, old, value);
+	else if(address == SIM_REG(DAC->SWTRIGR))
+	{
+		if(value & DAC_SWTRIGR_SWTRIG1) dac->DOR1 = dac->DHR12R1 & 0xFFF;
+		dac->SWTRIGR = 0;
+	}
+	else if((address == SIM_REG(DAC->DHR12R1)) && !(dac->CR & DAC_CR_TEN1))
+	{
+		// without trigger output follows holding register
+		dac->DOR1 = value & 0xFFF;
+	}
+}
+
+/**
+  * @brief  Apply firmware read of ADC page
+  * @param  address: word address
+  * @retval None
+  */
+void simPeriph_Read(uint32_t address)
+{
+	if(address == SIM_REG(ADC1->DR)) adc->ISR &= ~ADC_ISR_EOC;
+}
+
+/**
+  * @brief  Get interrupt request line level
+  * @param  irq: interrupt number
+  * @retval 1 - interrupt flag is set and enabled
+  */
+uint8_t simPeriph_IrqLevel(IRQn_Type irq)
+{
+	switch(irq)
+	{
+		case DMA1_Channel1_IRQn:
+			return (dma->ISR & dmaChannel(1)->CCR & 0xE) ? 1 : 0;
+		case DMA1_Channel2_3_IRQn:
+			return ((dma->ISR >> 4) & dmaChannel(2)->CCR & 0xE) || ((dma->ISR >> 8) & dmaChannel(3)->CCR & 0xE);
+		case TIM21_IRQn:
+			return (tim21.regs->SR & tim21.regs->DIER & 0x5F) ? 1 : 0;
+		case TIM22_IRQn:
+			return (tim22.regs->SR & tim22.regs->DIER & 0x5F) ? 1 : 0;
+		default:
+			return 0;
+	}
+}
+
+/**
+  * @brief  Set function called at each DAC update, after commutator is clocked
+  * @param  hook: function, NULL - no hook
+  * @retval None
+  */
+void simPeriph_SetSampleHook(void (*hook)(const simSample* sample))
+{
+	sampleHook = hook;
+}
+
+/**
+  * @brief  Output stage current: DAC code above stage zero, sign is set by commutator. Both channels off or both on
+  * give no current
+  * @param  None
+  * @retval A
+  */
+float simPeriph_Current(void)
+{
+	uint8_t ch1 = timerOutput(&tim21, 0);
+	uint8_t ch2 = timerOutput(&tim21, 1);
+	int32_t code = (int32_t)(dac->DOR1 & 0xFFF) - SIM_STAGE_ZERO_CODE;
+	float current = (code > 0) ? (float)code/SIM_STAGE_CODES_PER_A : 0.0f;
+
+	if(!(gpioa->ODR & DC_EN_Pin) || (ch1 == ch2)) return 0.0f;
+	return ch1 ? current : -current;
+}
+
+static void timerWrite(simTimer* t, uint32_t offset, uint32_t old, uint32_t value)
+{
+	TIM_TypeDef* r = t->regs;
+
+	switch(offset)
+	{
+		case offsetof(TIM_TypeDef, SR):
+			// flags are cleared by writing 0
+			r->SR = old & value;
+			break;
+		case offsetof(TIM_TypeDef, EGR):
+			if(value & TIM_EGR_UG)
+			{
+				r->CNT = 0;
+				t->isDown = 0;
+				t->arr = (uint16_t)r->ARR;
+				t->ccr[0] = (uint16_t)r->CCR1;
+				t->ccr[1] = (uint16_t)r->CCR2;
+				t->ccr[2] = (uint16_t)r->CCR3;
+				t->ccr[3] = (uint16_t)r->CCR4;
+				if(!(r->CR1 & TIM_CR1_URS)) r->SR |= TIM_SR_UIF;
+				// reset and update master modes give trigger output at UG
+				if(((r->CR2 & TIM_CR2_MMS) == 0) || ((r->CR2 & TIM_CR2_MMS) == TIM_CR2_MMS_1))
+				{
+					if(t == &tim2) tim2Trgo();
+					if(t == &tim21) tim21Trgo();
+				}
+			}
+			r->SR |= value & (TIM_EGR_CC1G | TIM_EGR_CC2G | TIM_EGR_CC3G | TIM_EGR_CC4G);
+			r->EGR = 0;
+			break;
+		case offsetof(TIM_TypeDef, CR1):
+		case offsetof(TIM_TypeDef, CCMR1):
+		case offsetof(TIM_TypeDef, CCMR2):
+		case offsetof(TIM_TypeDef, CCER):
+			timerRefs(t);
+			updatePins();
+			break;
+		default:
+			// counter, auto-reload and compare registers are used at once, unless preload is enabled
+			break;
+	}
+}
+
+/**
+  * @brief  Count one clock
+  * @param  t: timer
+  * @retval SIM_TIM_x events
+  */
+static uint32_t timerCount(simTimer* t)
+{
+	TIM_TypeDef* r = t->regs;
+	uint32_t arr = (r->CR1 & TIM_CR1_ARPE) ? t->arr : (r->ARR & 0xFFFF);
+	uint32_t cnt = r->CNT & 0xFFFF;
+	uint32_t events = 0;
+	uint8_t is_down = 0;
+
+	if(!(r->CR1 & TIM_CR1_CEN)) return 0;
+
+	if(r->CR1 & TIM_CR1_CMS)
+	{
+		// center-aligned: overflow at ARR, underflow at 0
+		is_down = t->isDown;
+		if(!is_down)
+		{
+			if(++cnt >= arr)
+			{
+				cnt = arr;
+				t->isDown = 1;
+				events |= SIM_TIM_UPDATE;
+			}
+		}
+		else
+		{
+			if(cnt) cnt--;
+			if(!cnt)
+			{
+				t->isDown = 0;
+				events |= SIM_TIM_UPDATE;
+			}
+		}
+	}
+	else if(cnt >= arr)
+	{
+		cnt = 0;
+		events |= SIM_TIM_UPDATE;
+	}
+	else
+	{
+		cnt++;
+	}
+	r->CNT = cnt;
+
+	if(events & SIM_TIM_UPDATE) events |= timerUpdate(t);
+	timerCompare(t, is_down, &events);
+	timerRefs(t);
+	return events;
+}
+
+/**
+  * @brief  Update event of counter: preloaded registers are transferred
+  * @param  t: timer
+  * @retval SIM_TIM_TRGO in update master mode, else 0
+  */
+static uint32_t timerUpdate(simTimer* t)
+{
+	TIM_TypeDef* r = t->regs;
+
+	if(r->CR1 & TIM_CR1_UDIS) return 0;
+
+	t->arr = (uint16_t)r->ARR;
+	if(r->CCMR1 & TIM_CCMR1_OC1PE) t->ccr[0] = (uint16_t)r->CCR1;
+	if(r->CCMR1 & TIM_CCMR1_OC2PE) t->ccr[1] = (uint16_t)r->CCR2;
+	if(r->CCMR2 & TIM_CCMR2_OC3PE) t->ccr[2] = (uint16_t)r->CCR3;
+	if(r->CCMR2 & TIM_CCMR2_OC4PE) t->ccr[3] = (uint16_t)r->CCR4;
+	r->SR |= TIM_SR_UIF;
+	if(r->CR1 & TIM_CR1_OPM) r->CR1 &= ~TIM_CR1_CEN;
+
+	return ((r->CR2 & TIM_CR2_MMS) == TIM_CR2_MMS_1) ? SIM_TIM_TRGO : 0;
+}
+
+/**
+  * @brief  Compare match of all channels. In center-aligned mode 1 flags are set only when counting down
+  * @param  t: timer
+  * @param  is_down: direction of the last count
+  * @param  events: SIM_TIM_x events to be updated
+  * @retval None
+  */
+static void timerCompare(simTimer* t, uint8_t is_down, uint32_t* events)
+{
+	TIM_TypeDef* r = t->regs;
+	volatile uint32_t* ccr = &r->CCR1;
+	uint32_t cms = r->CR1 & TIM_CR1_CMS;
+	uint32_t cnt = r->CNT & 0xFFFF;
+	uint32_t value = 0;
+
+	for(uint8_t ch = 0; ch < 4; ch++)
+	{
+		value = (((ch < 2) ? r->CCMR1 : r->CCMR2) & (TIM_CCMR1_OC1PE << (8*(ch & 1)))) ? t->ccr[ch] : (ccr[ch] & 0xFFFF);
+		if(cnt != value) continue;
+
+		switch(timerMode(t, ch))
+		{
+			case 1: t->ref[ch] = 1; break;
+			case 2: t->ref[ch] = 0; break;
+			case 3: t->ref[ch] ^= 1; break;
+			default: break;
+		}
+		if((cms == TIM_CR1_CMS_0) && !is_down) continue;
+		if((cms == TIM_CR1_CMS_1) && is_down) continue;
+
+		r->SR |= TIM_SR_CC1IF << ch;
+		*events |= SIM_TIM_CC(ch);
+		// compare pulse master mode
+		if((ch == 0) && ((r->CR2 & TIM_CR2_MMS) == (TIM_CR2_MMS_1 | TIM_CR2_MMS_0))) *events |= SIM_TIM_TRGO;
+	}
+}
+
+/**
+  * @brief  Update forced and PWM output references
+  * @param  t: timer
+  * @retval None
+  */
+static void timerRefs(simTimer* t)
+{
+	TIM_TypeDef* r = t->regs;
+	volatile uint32_t* ccr = &r->CCR1;
+	uint32_t cnt = r->CNT & 0xFFFF;
+	uint32_t value = 0;
+	uint8_t is_down = (r->CR1 & TIM_CR1_CMS) ? t->isDown : 0;
+
+	for(uint8_t ch = 0; ch < 4; ch++)
+	{
+		value = (((ch < 2) ? r->CCMR1 : r->CCMR2) & (TIM_CCMR1_OC1PE << (8*(ch & 1)))) ? t->ccr[ch] : (ccr[ch] & 0xFFFF);
+		switch(timerMode(t, ch))
+		{
+			case 4: t->ref[ch] = 0; break;
+			case 5: t->ref[ch] = 1; break;
+			case 6: t->ref[ch] = is_down ? (cnt <= value) : (cnt < value); break;
+			case 7: t->ref[ch] = is_down ? (cnt > value) : (cnt >= value); break;
+			default: break;
+		}
+	}
+}
+
+static uint8_t timerMode(simTimer* t, uint8_t ch)
+{
+	uint32_t ccmr = (ch < 2) ? t->regs->CCMR1 : t->regs->CCMR2;
+
+	return (uint8_t)((ccmr >> (4 + 8*(ch & 1))) & 0x7);
+}
+
+static uint8_t timerOutput(simTimer* t, uint8_t ch)
+{
+	uint32_t ccer = t->regs->CCER >> (4*ch);
+
+	if(!(ccer & TIM_CCER_CC1E)) return 0;
+	return t->ref[ch] ^ ((ccer & TIM_CCER_CC1P) ? 1 : 0);
+}
+
+/**
+  * @brief  TIM2 trigger output: DAC and ADC triggers, TIM21 clock. Sample is recorded after commutator is clocked
+  * @param  None
+  * @retval None
+  */
+static void tim2Trgo(void)
+{
+	uint32_t events = 0;
+
+	dacTrigger();
+	adcTrigger();
+	if((tim21.regs->SMCR & (TIM_SMCR_SMS | TIM_SMCR_TS)) == TIM_SMCR_SMS)
+	{
+		events = timerCount(&tim21);
+		if(events & SIM_TIM_TRGO) tim21Trgo();
+	}
+	updatePins();
+	recordSample();
+}
+
+/**
+  * @brief  TIM21 trigger output clocks TIM22
+  * @param  None
+  * @retval None
+  */
+static void tim21Trgo(void)
+{
+	if((tim22.regs->SMCR & (TIM_SMCR_SMS | TIM_SMCR_TS)) == TIM_SMCR_SMS) timerCount(&tim22);
+}
+
+/**
+  * @brief  DMA request of peripheral
+  * @param  channel: 1...7
+  * @param  request: CSELR request number
+  * @retval 1 - transfer is made, 0 - channel is not enabled or selected
+  */
+static uint8_t dmaRequest(uint8_t channel, uint8_t request)
+{
+	DMA_Channel_TypeDef* c = dmaChannel(channel);
+	uint32_t ccr = c->CCR;
+	uint32_t remaining = c->CNDTR & 0xFFFF;
+	uint32_t index = dmaNumber[channel] - remaining;
+	uint8_t psize = (uint8_t)(1 << ((ccr & DMA_CCR_PSIZE) >> DMA_CCR_PSIZE_Pos));
+	uint8_t msize = (uint8_t)(1 << ((ccr & DMA_CCR_MSIZE) >> DMA_CCR_MSIZE_Pos));
+	uint32_t paddr = c->CPAR + ((ccr & DMA_CCR_PINC) ? index*psize : 0);
+	uint32_t maddr = c->CMAR + ((ccr & DMA_CCR_MINC) ? index*msize : 0);
+	uint32_t flags = SIM_DMA_GIF;
+	uint8_t shift = 4*(channel - 1);
+
+	if((((dmaSelect->CSELR >> shift) & 0xF) != request) || !(ccr & DMA_CCR_EN) || !remaining) return 0;
+
+	if(ccr & DMA_CCR_DIR) busWrite(paddr, psize, busRead(maddr, msize));
+	else busWrite(maddr, msize, busRead(paddr, psize));
+
+	remaining--;
+	if((dmaNumber[channel] - remaining) == dmaNumber[channel]/2) flags |= SIM_DMA_HTIF;
+	if(!remaining)
+	{
+		flags |= SIM_DMA_TCIF;
+		if(ccr & DMA_CCR_CIRC) remaining = dmaNumber[channel];
+	}
+	c->CNDTR = remaining;
+	if(flags != SIM_DMA_GIF) dma->ISR |= flags << shift;
+
+	return 1;
+}
+
+static DMA_Channel_TypeDef* dmaChannel(uint8_t channel)
+{
+	return (DMA_Channel_TypeDef*)((uint8_t*)dma + 8 + 20*(channel - 1));
+}
+
+static void dmaWrite(uint32_t offset, uint32_t old, uint32_t value)
+{
+	uint8_t channel = 0;
+	uint32_t bits = 0;
+
+	if(offset == offsetof(DMA_TypeDef, ISR))
+	{
+		dma->ISR = old;
+		return;
+	}
+	if(offset == offsetof(DMA_TypeDef, IFCR))
+	{
+		for(channel = 1; channel <= 7; channel++)
+		{
+			bits = (value >> (4*(channel - 1))) & 0xF;
+			// global flag clear clears all flags of channel
+			if(bits & SIM_DMA_GIF) bits = 0xF;
+			dma->ISR &= ~(bits << (4*(channel - 1)));
+		}
+		dma->IFCR = 0;
+		return;
+	}
+	if((offset < 8) || (offset >= 8 + 20*7)) return;
+
+	channel = (uint8_t)(1 + (offset - 8)/20);
+	if(((offset - 8) % 20) == offsetof(DMA_Channel_TypeDef, CNDTR))
+	{
+		// counter is read-only while channel is enabled
+		if(dmaChannel(channel)->CCR & DMA_CCR_EN) dmaChannel(channel)->CNDTR = old;
+		else dmaNumber[channel] = (uint16_t)value;
+	}
+}
+
+static uint32_t busRead(uint32_t address, uint8_t size)
+{
+	void* p = sim_Alias(address);
+
+	if(p == NULL) p = (void*)(uintptr_t)address;
+	if(address == SIM_REG(ADC1->DR)) adc->ISR &= ~ADC_ISR_EOC;
+
+	switch(size)
+	{
+		case 1: return *(uint8_t*)p;
+		case 2: return *(uint16_t*)p;
+		default: return *(uint32_t*)p;
+	}
+}
+
+static void busWrite(uint32_t address, uint8_t size, uint32_t value)
+{
+	void* p = sim_Alias(address);
+
+	if(p == NULL) p = (void*)(uintptr_t)address;
+	switch(size)
+	{
+		case 1: *(uint8_t*)p = (uint8_t)value; break;
+		case 2: *(uint16_t*)p = (uint16_t)value; break;
+		default: *(uint32_t*)p = value; break;
+	}
+}
+
+/**
+  * @brief  DAC channel 1 trigger: holding register goes to output, the next sample is requested from DMA
+  * @param  None
+  * @retval None
+  */
+static void dacTrigger(void)
+{
+	if((dac->CR & (DAC_CR_EN1 | DAC_CR_TEN1)) != (DAC_CR_EN1 | DAC_CR_TEN1)) return;
+
+	dac->DOR1 = dac->DHR12R1 & 0xFFF;
+	if(dac->CR & DAC_CR_DMAEN1) dmaRequest(2, SIM_DMA_REQUEST_DAC);
+}
+
+/**
+  * @brief  ADC external trigger: shunt is sampled now, conversion ends after SIM_ADC_CONVERSION_US
+  * @param  None
+  * @retval None
+  */
+static void adcTrigger(void)
+{
+	float current = simPeriph_Current();
+	uint32_t code = 0;
+
+	if(!(adc->CR & ADC_CR_ADSTART) || !(adc->CFGR1 & ADC_CFGR1_EXTEN) || adcConversion) return;
+
+	code = SIM_SHUNT_ZERO_CODE + (uint32_t)(((current < 0) ? -current : current)*SIM_SHUNT_CODES_PER_A + 0.5f);
+	adcValue = (uint16_t)((code > 4095) ? 4095 : code);
+	adcConversion = SIM_ADC_CONVERSION_US;
+}
+
+/**
+  * @brief  End of conversion. Unread data is not overwritten, overrun blocks DMA requests until OVR is cleared
+  * @param  None
+  * @retval None
+  */
+static void adcComplete(void)
+{
+	if(adc->ISR & ADC_ISR_EOC)
+	{
+		adc->ISR |= ADC_ISR_OVR;
+	}
+	else
+	{
+		adc->DR = adcValue;
+		adc->ISR |= ADC_ISR_EOC | ADC_ISR_EOS;
+	}
+	if((adc->CFGR1 & ADC_CFGR1_DMAEN) && !(adc->ISR & ADC_ISR_OVR)) dmaRequest(1, SIM_DMA_REQUEST_ADC);
+}
+
+static void adcWrite(uint32_t address, uint32_t old, uint32_t value)
+{
+	if(address == SIM_REG(ADC1->ISR))
+	{
+		adc->ISR = old & ~value;
+	}
+	else if(address == SIM_REG(ADC1->CR))
+	{
+		uint32_t cr = value & ~ADC_CR_ADCAL; 	// calibration is done at once
+
+		// enable and start are cleared by hardware only, after disable and stop commands
+		cr |= old & (ADC_CR_ADEN | ADC_CR_ADSTART);
+		if(cr & ADC_CR_ADDIS)
+		{
+			cr &= ~(ADC_CR_ADDIS | ADC_CR_ADEN | ADC_CR_ADSTART);
+			adcConversion = 0;
+		}
+		if(cr & ADC_CR_ADSTP)
+		{
+			cr &= ~(ADC_CR_ADSTP | ADC_CR_ADSTART);
+			adcConversion = 0;
+		}
+		if((cr & ADC_CR_ADEN) && !(old & ADC_CR_ADEN)) adc->ISR |= ADC_ISR_ADRDY;
+		adc->CR = cr;
+	}
+	else if(address == SIM_REG(ADC1->DR))
+	{
+		adc->DR = old;
+	}
+}
+
+static void gpioWrite(GPIO_TypeDef* port, uint32_t offset, uint32_t old, uint32_t value)
+{
+	(void)old;
+	if(offset == offsetof(GPIO_TypeDef, BSRR))
+	{
+		port->ODR = (port->ODR & ~(value >> 16)) | (value & 0xFFFF);
+		port->BSRR = 0;
+	}
+	else if(offset == offsetof(GPIO_TypeDef, BRR))
+	{
+		port->ODR &= ~(value & 0xFFFF);
+		port->BRR = 0;
+	}
+	updatePins();
+}
+
+static void flashWrite(uint32_t offset, uint32_t old, uint32_t value)
+{
+	switch(offset)
+	{
+		case offsetof(FLASH_TypeDef, SR):
+			// flags are cleared by writing 1
+			flash->SR = old & ~value;
+			break;
+		case offsetof(FLASH_TypeDef, PECR):
+			// lock is cleared only by key sequence
+			if(old & FLASH_PECR_PELOCK) flash->PECR = old;
+			break;
+		case offsetof(FLASH_TypeDef, PEKEYR):
+			if(value == FLASH_PEKEY1)
+			{
+				flashKeyStep = 1;
+			}
+			else
+			{
+				if((flashKeyStep == 1) && (value == FLASH_PEKEY2)) flash->PECR &= ~FLASH_PECR_PELOCK;
+				flashKeyStep = 0;
+			}
+			flash->PEKEYR = 0;
+			break;
+		default:
+			break;
+	}
+}
+
+/**
+  * @brief  Data EEPROM word write: CPU is stalled while word is erased and programmed, hardware runs
+  * @param  address: word address
+  * @param  old: word before write
+  * @param  value: written word
+  * @retval None
+  */
+static void eepromWrite(uint32_t address, uint32_t old, uint32_t value)
+{
+	(void)value;
+	if(flash->PECR & FLASH_PECR_PELOCK)
+	{
+		*(uint32_t*)sim_Alias(address) = old;
+		flash->SR |= FLASH_SR_WRPERR;
+		return;
+	}
+	for(uint32_t i = 0; i < SIM_EEPROM_WRITE_US; i++)
+	{
+		sim_Tick();
+	}
+	flash->SR |= FLASH_SR_EOP;
+}
+
+/**
+  * @brief  CRC unit, 32-bit polynomial without reversal: data register holds CRC, written word is shifted in
+  * @param  offset: register offset
+  * @param  old: register before write
+  * @param  value: written word
+  * @retval None
+  */
+static void crcWrite(uint32_t offset, uint32_t old, uint32_t value)
+{
+	uint32_t result = old;
+
+	if(offset == offsetof(CRC_TypeDef, DR))
+	{
+		result ^= value;
+		for(uint8_t i = 0; i < 32; i++)
+		{
+			result = (result & 0x80000000UL) ? ((result << 1) ^ crc->POL) : (result << 1);
+		}
+		crc->DR = result;
+	}
+	else if((offset == offsetof(CRC_TypeDef, CR)) && (value & CRC_CR_RESET))
+	{
+		crc->DR = crc->INIT;
+		crc->CR &= ~CRC_CR_RESET;
+	}
+}
+
+/**
+  * @brief  Input data registers follow outputs, TIM21 channels are on PA2, PA3
+  * @param  None
+  * @retval None
+  */
+static void updatePins(void)
+{
+	gpioa->IDR = (gpioa->ODR & ~(SIM_COMM_CH1_PIN | SIM_COMM_CH2_PIN)) |
+			(timerOutput(&tim21, 0) ? SIM_COMM_CH1_PIN : 0) | (timerOutput(&tim21, 1) ? SIM_COMM_CH2_PIN : 0);
+	gpiob->IDR = gpiob->ODR;
+}
+
+static void recordSample(void)
+{
+	if(sampleHook == NULL) return;
+
+	sample.time = sim_GetTime();
+	sample.dacCode = (uint16_t)(dac->DOR1 & 0xFFF);
+	sample.ch1 = timerOutput(&tim21, 0);
+	sample.ch2 = timerOutput(&tim21, 1);
+	sample.dcEn = (gpioa->ODR & DC_EN_Pin) ? 1 : 0;
+	sample.current = simPeriph_Current();
+	sampleHook(&sample);
+}
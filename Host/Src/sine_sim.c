@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "sim.h"
+#include "sim_usb.h"
+#include "usbd_cs_control.h"
+
+// Firmware on simulated board: generator is set over USB as host software does, output current waveform is
+// written as CSV, one row per DAC update
+#define SINE_SIM_SETTLE_MS 		20 		// output is recorded after commands are applied and envelope is settled
+
+static FILE* output = NULL;
+
+static void writeSample(const simSample* sample);
+static int command(uint8_t request, uint32_t value);
+static void usage(const char* name);
+
+int main(int argc, char** argv)
+{
+	uint32_t duration = 100; 		// ms
+	uint32_t frequency = 50000; 	// mHz
+	uint32_t amplitude = 10; 		// 0,1 A
+	const char* path = NULL;
+	int opt;
+
+	while((opt = getopt(argc, argv, "d:f:a:o:h")) != -1)
+	{
+		switch(opt)
+		{
+			case 'd':
+				duration = (uint32_t)strtoul(optarg, NULL, 0);
+				break;
+
+			case 'f':
+				frequency = (uint32_t)strtoul(optarg, NULL, 0);
+				break;
+
+			case 'a':
+				amplitude = (uint32_t)strtoul(optarg, NULL, 0);
+				break;
+
+			case 'o':
+				path = optarg;
+				break;
+
+			default:
+				usage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	output = (path != NULL) ? fopen(path, "w") : stdout;
+	if(output == NULL)
+	{
+		perror(path);
+		return EXIT_FAILURE;
+	}
+
+	sim_Init();
+	simBoard_Init();
+	if((simUsb_Connect() < 0) || command(CS_CONTROL_SET_RAMP_RATE, 0) || command(CS_CONTROL_SET_FREQ, frequency) ||
+			command(CS_CONTROL_SET_AMPL, amplitude) || command(CS_CONTROL_POWER_CTRL, 1))
+	{
+		fprintf(stderr, "sine_sim: device does not accept commands\n");
+		return EXIT_FAILURE;
+	}
+	sim_Run(SINE_SIM_SETTLE_MS*1000U);
+
+	fprintf(output, "time_us,dac_code,ch1,ch2,dc_en,current_a\n");
+	simPeriph_SetSampleHook(writeSample);
+	sim_Run(duration*1000U);
+	simPeriph_SetSampleHook(NULL);
+
+	if(output != stdout) fclose(output);
+	return EXIT_SUCCESS;
+}
+
+static void writeSample(const simSample* sample)
+{
+	fprintf(output, "%u,%u,%u,%u,%u,%.4f\n", (unsigned)sample->time, (unsigned)sample->dacCode,
+			(unsigned)sample->ch1, (unsigned)sample->ch2, (unsigned)sample->dcEn, (double)sample->current);
+}
+
+/**
+  * @brief  Vendor command, value is split into wValue and wIndex
+  * @param  request: CS_CONTROL_x request code
+  * @param  value: command value
+  * @retval 0 - command is queued, -1 - request is stalled
+  */
+static int command(uint8_t request, uint32_t value)
+{
+	return (simUsb_ControlTransfer(0x40, request, (uint16_t)value, (uint16_t)(value >> 16), NULL, 0) < 0) ? -1 : 0;
+}
+
+static void usage(const char* name)
+{
+	fprintf(stderr, "usage: %s [-d ms] [-f mHz] [-a 0,1 A] [-o file.csv]\n"
+			"  -d  recorded time, 100 ms by default\n"
+			"  -f  frequency, 50000 mHz by default\n"
+			"  -a  amplitude, 10 (1 A) by default\n"
+			"  -o  output file, standard output by default\n", name);
+}
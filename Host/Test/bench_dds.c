@@ -0,0 +1,104 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <x86intrin.h>
+#include "sine_kernel.h"
+
+// Phase accumulator cost per sample on host, table half period build as reference. Figures are host time and TSC
+// ticks, not Cortex-M0+ cycles: device cost is read by CS_CONTROL_GET_PERF, in phase accumulator mode DAC DMA
+// interrupt cycles per SINE_SAMPLES_NUM/2 samples are mostly sineKernel_DdsFill(). Samples are checked against sine
+// of accumulator phase, so the benchmark fails on wrong output rather than on slow one
+#define BENCH_FILLS 			20000
+#define BENCH_FILL_LEN 			(SINE_SAMPLES_NUM/2) 	// DMA half transfer
+#define BENCH_AMPLITUDE 		2000
+#define BENCH_OFFSET 			372
+#define BENCH_FREQ_NUM 			4
+
+static const uint32_t frequencies[BENCH_FREQ_NUM] = {500, 50000, 123456, 400000}; 	// mHz
+static uint16_t buf[BENCH_FILL_LEN];
+static volatile uint32_t params = BENCH_AMPLITUDE | ((uint32_t)BENCH_OFFSET << 16);
+static volatile uint32_t sink = 0;
+
+static uint64_t nowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// one table index step of error and truncation
+static int checkFill(const sineDds* dds, uint32_t phase)
+{
+	const double tolerance = BENCH_AMPLITUDE*3.14159265358979323846/SINE_SAMPLES_NUM + 2.0;
+	double expected;
+
+	for(uint16_t i = 0; i < BENCH_FILL_LEN; i++)
+	{
+		expected = BENCH_OFFSET + BENCH_AMPLITUDE*sin(3.14159265358979323846*phase/4294967296.0);
+		if(fabs(buf[i] - expected) > tolerance)
+		{
+			printf("FAIL: sample %u is %u, expected %.1f\n", i, buf[i], expected);
+			return -1;
+		}
+		phase += dds->tuningWord;
+	}
+	return 0;
+}
+
+int main(void)
+{
+	sineDds dds;
+	uint64_t start;
+	uint64_t ns;
+	uint64_t ticks;
+	uint64_t wraps;
+	uint64_t expected_wraps;
+	uint64_t samples = (uint64_t)BENCH_FILLS*BENCH_FILL_LEN;
+	int failures = 0;
+
+	printf("per sample, host        ns     TSC ticks\n");
+
+	start = nowNs();
+	ticks = __rdtsc();
+	for(uint32_t i = 0; i < BENCH_FILLS/2; i++)
+	{
+		// full half period per call, the same samples number
+		sineKernel_CalcHalfPeriod(buf, BENCH_AMPLITUDE + (i & 1), BENCH_OFFSET);
+		sink += buf[SINE_SAMPLES_NUM/4];
+	}
+	ticks = __rdtsc() - ticks;
+	ns = nowNs() - start;
+	printf("  table build     %10.2f %10.2f\n", (double)ns/samples, (double)ticks/samples);
+
+	for(uint32_t f = 0; f < BENCH_FREQ_NUM; f++)
+	{
+		sineKernel_DdsStart(&dds, frequencies[f], params);
+		sineKernel_DdsFill(&dds, buf, BENCH_FILL_LEN, &params);
+		if(checkFill(&dds, 0) != 0) failures++;
+
+		sineKernel_DdsStart(&dds, frequencies[f], params);
+		wraps = 0;
+		start = nowNs();
+		ticks = __rdtsc();
+		for(uint32_t i = 0; i < BENCH_FILLS; i++)
+		{
+			wraps += sineKernel_DdsFill(&dds, buf, BENCH_FILL_LEN, &params);
+			sink += buf[0];
+		}
+		ticks = __rdtsc() - ticks;
+		ns = nowNs() - start;
+		printf("  dds %7.3f Hz %10.2f %10.2f\n", frequencies[f]/1000.0, (double)ns/samples, (double)ticks/samples);
+
+		// accumulator wraps once per 2^32 of phase
+		expected_wraps = (samples*dds.tuningWord) >> 32;
+		if(wraps != expected_wraps)
+		{
+			printf("FAIL: %llu half periods at %u mHz, expected %llu\n", (unsigned long long)wraps, frequencies[f],
+					(unsigned long long)expected_wraps);
+			failures++;
+		}
+	}
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,125 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <x86intrin.h>
+#include "sine_kernel.h"
+
+// Harmonic synthesis cost for 1...SINE_HARMONICS_MAX harmonics on host. Each harmonic adds one table lookup and one
+// multiply per sample, so the cost of a build is linear in harmonics: n harmonics must not take more than
+// BENCH_LINEAR_MARGIN times n single harmonic builds, which hold the fixed per sample part too. Each figure is the best
+// of BENCH_RUNS runs. Synthesized waves are checked against the sum of sines, harmonic amplitudes fall as 1/order
+// like a square wave, so nothing is clipped
+#define BENCH_BUILDS 			500
+#define BENCH_RUNS 				7
+#define BENCH_AMPLITUDE 		2000 	// fundamental, sine table units
+#define BENCH_LINEAR_MARGIN 	1.5
+
+static uint16_t wave[SINE_SAMPLES_NUM];
+static sineHarmonic harmonics[SINE_HARMONICS_MAX];
+static volatile uint32_t sink = 0;
+
+typedef struct
+{
+	uint64_t ns;
+	uint64_t ticks;
+}benchCost;
+
+static uint64_t nowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+  * @brief  Best of BENCH_RUNS runs of BENCH_BUILDS syntheses
+  * @param  cost: result
+  * @param  num: harmonics number
+  * @retval None
+  */
+static void measure(benchCost* cost, uint8_t num)
+{
+	uint64_t start;
+	uint64_t ticks;
+	uint64_t ns;
+
+	cost->ns = UINT64_MAX;
+	cost->ticks = UINT64_MAX;
+	for(uint32_t run = 0; run < BENCH_RUNS; run++)
+	{
+		start = nowNs();
+		ticks = __rdtsc();
+		for(uint32_t i = 0; i < BENCH_BUILDS; i++)
+		{
+			sink += sineKernel_CalcHarmonics(wave, harmonics, num);
+			sink += wave[SINE_SAMPLES_NUM/2];
+		}
+		ticks = __rdtsc() - ticks;
+		ns = nowNs() - start;
+		if(ns < cost->ns) cost->ns = ns;
+		if(ticks < cost->ticks) cost->ticks = ticks;
+	}
+}
+
+// rounding of each table sample and of the sum
+static int checkWave(uint8_t num)
+{
+	const double pi = 3.14159265358979323846;
+	const double tolerance = num + 1.0;
+	double expected;
+	double phase;
+
+	if(sineKernel_CalcHarmonics(wave, harmonics, num) != 0)
+	{
+		printf("FAIL: samples of %u harmonics are clipped\n", num);
+		return -1;
+	}
+	for(uint16_t i = 0; i < SINE_SAMPLES_NUM; i++)
+	{
+		expected = 0.0;
+		for(uint8_t h = 0; h < num; h++)
+		{
+			phase = (double)(harmonics[h].phase + (uint32_t)harmonics[h].order*i)/SINE_HARMONIC_PHASES;
+			expected += harmonics[h].amplitude*sin(2.0*pi*phase);
+		}
+		if(fabs(wave[i] - expected) > tolerance)
+		{
+			printf("FAIL: sample %u of %u harmonics is %u, expected %.1f\n", i, num, wave[i], expected);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int main(void)
+{
+	benchCost cost[SINE_HARMONICS_MAX + 1];
+	double samples = (double)BENCH_BUILDS*SINE_SAMPLES_NUM;
+	double bound;
+	int failures = 0;
+
+	for(uint8_t h = 0; h < SINE_HARMONICS_MAX; h++)
+	{
+		harmonics[h].order = (uint8_t)(2*h + 1);
+		harmonics[h].amplitude = (uint16_t)(BENCH_AMPLITUDE/harmonics[h].order);
+		harmonics[h].phase = 0;
+	}
+
+	printf("harmonics  per build us  per sample ns  TSC ticks  bound ticks\n");
+	for(uint8_t num = 1; num <= SINE_HARMONICS_MAX; num++)
+	{
+		if(checkWave(num) != 0) failures++;
+		measure(&cost[num], num);
+		bound = BENCH_LINEAR_MARGIN*num*cost[1].ticks/samples;
+		printf("  %2u       %10.2f %14.2f %10.2f %12.2f\n", num, cost[num].ns/1000.0/BENCH_BUILDS, cost[num].ns/samples,
+				cost[num].ticks/samples, bound);
+		if(cost[num].ticks/samples > bound)
+		{
+			printf("FAIL: %u harmonics take %.2f single harmonic builds\n", num, (double)cost[num].ticks/cost[1].ticks);
+			failures++;
+		}
+	}
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
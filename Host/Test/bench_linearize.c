@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <x86intrin.h>
+#include "sine_kernel.h"
+
+// Linearization cost on top of half period build, both per sample on host. The correction is two knot lookups, one
+// multiply and clamps per sample, without division. The host compiler vectorizes the build loop, not the knot lookups,
+// so the correction takes about 5 builds here; BENCH_OVERHEAD_MAX catches a slow path such as a division per sample.
+// Each figure is the best of BENCH_RUNS runs, the other ones are disturbed by the host. Corrected samples are checked
+// against the interpolated curve
+#define BENCH_BUILDS 			2000
+#define BENCH_RUNS 				7
+#define BENCH_AMPLITUDE 		2000
+#define BENCH_OFFSET 			372
+#define BENCH_OVERHEAD_MAX 		8 		// linearization per sample, times the build per sample
+
+static uint16_t buf[SINE_SAMPLES_NUM];
+static uint16_t plain[SINE_SAMPLES_NUM];
+static int8_t knots[SINE_LIN_KNOTS];
+static volatile uint32_t sink = 0;
+
+typedef struct
+{
+	uint64_t ns;
+	uint64_t ticks;
+}benchCost;
+
+static uint64_t nowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+  * @brief  Best of BENCH_RUNS runs of BENCH_BUILDS half period builds
+  * @param  cost: result
+  * @param  is_linearized: 1 - each build is corrected by the curve
+  * @retval None
+  */
+static void measure(benchCost* cost, uint8_t is_linearized)
+{
+	uint64_t start;
+	uint64_t ticks;
+	uint64_t ns;
+
+	cost->ns = UINT64_MAX;
+	cost->ticks = UINT64_MAX;
+	for(uint32_t run = 0; run < BENCH_RUNS; run++)
+	{
+		start = nowNs();
+		ticks = __rdtsc();
+		for(uint32_t i = 0; i < BENCH_BUILDS; i++)
+		{
+			sineKernel_CalcHalfPeriod(buf, BENCH_AMPLITUDE + (i & 1), BENCH_OFFSET);
+			if(is_linearized) sineKernel_Linearize(buf, SINE_SAMPLES_NUM, knots);
+			sink += buf[SINE_SAMPLES_NUM/2];
+		}
+		ticks = __rdtsc() - ticks;
+		ns = nowNs() - start;
+		if(ns < cost->ns) cost->ns = ns;
+		if(ticks < cost->ticks) cost->ticks = ticks;
+	}
+}
+
+static int checkCurve(void)
+{
+	int32_t lower;
+	int32_t expected;
+	uint16_t knot;
+
+	sineKernel_CalcHalfPeriod(plain, BENCH_AMPLITUDE, BENCH_OFFSET);
+	sineKernel_CalcHalfPeriod(buf, BENCH_AMPLITUDE, BENCH_OFFSET);
+	sineKernel_Linearize(buf, SINE_SAMPLES_NUM, knots);
+	for(uint16_t i = 0; i < SINE_SAMPLES_NUM; i++)
+	{
+		knot = plain[i] >> SINE_LIN_STEP_SHIFT;
+		lower = knots[knot];
+		expected = plain[i] + lower + ((knots[knot + 1] - lower)*(plain[i] & ((1 << SINE_LIN_STEP_SHIFT) - 1)))/
+				(1 << SINE_LIN_STEP_SHIFT);
+		// floor and truncation differ by one below zero slope
+		if((plain[i] != 0) && ((buf[i] < expected - 1) || (buf[i] > expected)))
+		{
+			printf("FAIL: sample %u is %u, expected %d\n", i, buf[i], expected);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int main(void)
+{
+	benchCost build;
+	benchCost linearized;
+	double samples = (double)BENCH_BUILDS*SINE_SAMPLES_NUM;
+	double overhead;
+	int failures = 0;
+
+	// the curve rises and falls by several codes between knots
+	for(uint16_t i = 0; i < SINE_LIN_KNOTS; i++)
+	{
+		knots[i] = (int8_t)((i*7) % 11) - 5;
+	}
+	if(checkCurve() != 0) failures++;
+
+	measure(&build, 0);
+	measure(&linearized, 1);
+	overhead = (double)(linearized.ticks - build.ticks)/build.ticks;
+
+	printf("per sample, host        ns     TSC ticks\n");
+	printf("  build           %10.2f %10.2f\n", build.ns/samples, build.ticks/samples);
+	printf("  build+linearize %10.2f %10.2f\n", linearized.ns/samples, linearized.ticks/samples);
+	printf("  linearization overhead %.0f%% of build, bound %u00%%\n", overhead*100.0, BENCH_OVERHEAD_MAX);
+
+	if(overhead > BENCH_OVERHEAD_MAX)
+	{
+		printf("FAIL: linearization takes %.1f builds\n", overhead);
+		failures++;
+	}
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
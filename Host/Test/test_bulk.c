@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "sim.h"
+#include "sim_usb.h"
+#include "usbd_cs_control.h"
+
+// The same command stream over control requests and over bulk packets of CS_CONTROL_BULK_MAX_CMDS commands, each
+// packet followed by its reply. Bus time is counted by the USB model, host stacks usually take one frame per round
+// trip, so the estimate at one frame per transfer is printed too
+#define TEST_COMMANDS 			(100*CS_CONTROL_BULK_MAX_CMDS)
+#define TEST_AMPL_LOW 			10 		// 0,1 A, output is off
+#define TEST_AMPL_HIGH 			12
+#define TEST_FRAME_US 			1000
+#define TEST_SETTLE_US 			1000 	// main loop takes the last queued commands
+
+typedef struct
+{
+	simUsbStats bus;
+	uint32_t us; 			// simulated time
+	uint32_t executed; 		// commands executed by driver
+}testThroughput;
+
+extern volatile uint32_t commandsCounter;
+
+static int failures = 0;
+
+#define TEST_CHECK(cond, ...) 	do{ if(!(cond)) { printf("FAIL: " __VA_ARGS__); printf("\n"); failures++; } }while(0)
+
+static uint32_t commandValue(uint32_t i)
+{
+	return (i & 1) ? TEST_AMPL_HIGH : TEST_AMPL_LOW;
+}
+
+static void finish(testThroughput* result, uint32_t start, uint32_t executed)
+{
+	simUsb_GetStats(&result->bus);
+	result->us = sim_GetTime() - start;
+	sim_Run(TEST_SETTLE_US);
+	result->executed = commandsCounter - executed;
+}
+
+static void sendControl(testThroughput* result)
+{
+	uint32_t start = sim_GetTime();
+	uint32_t executed = commandsCounter;
+	uint32_t failed = 0;
+	uint32_t value;
+
+	simUsb_ResetStats();
+	for(uint32_t i = 0; i < TEST_COMMANDS; i++)
+	{
+		value = commandValue(i);
+		if(simUsb_ControlTransfer(0x40, CS_CONTROL_SET_AMPL, (uint16_t)value, (uint16_t)(value >> 16), NULL, 0) < 0)
+		{
+			failed++;
+		}
+	}
+	finish(result, start, executed);
+	TEST_CHECK(failed == 0, "%u control requests failed", failed);
+}
+
+static void sendBulk(testThroughput* result)
+{
+	uint8_t packet[CS_CONTROL_EP_SIZE];
+	uint8_t reply[CS_CONTROL_EP_SIZE];
+	uint8_t* record;
+	uint32_t start = sim_GetTime();
+	uint32_t executed = commandsCounter;
+	uint32_t failed = 0;
+	uint32_t value;
+	uint32_t n = 0;
+	uint16_t length = CS_CONTROL_BULK_HDR_SIZE + CS_CONTROL_BULK_MAX_CMDS*CS_CONTROL_BULK_CMD_SIZE;
+	uint16_t reply_length = CS_CONTROL_BULK_HDR_SIZE + CS_CONTROL_BULK_MAX_CMDS*CS_CONTROL_BULK_STATUS_SIZE;
+	uint8_t seq = 0;
+
+	simUsb_ResetStats();
+	while(n < TEST_COMMANDS)
+	{
+		packet[0] = seq;
+		packet[1] = CS_CONTROL_BULK_MAX_CMDS;
+		for(uint32_t i = 0; i < CS_CONTROL_BULK_MAX_CMDS; i++)
+		{
+			value = commandValue(n + i);
+			record = &packet[CS_CONTROL_BULK_HDR_SIZE + i*CS_CONTROL_BULK_CMD_SIZE];
+			record[0] = CS_CONTROL_SET_AMPL;
+			record[1] = (uint8_t)value;
+			record[2] = (uint8_t)(value >> 8);
+			record[3] = (uint8_t)(value >> 16);
+			record[4] = (uint8_t)(value >> 24);
+		}
+		if((simUsb_Out(CS_CONTROL_EPOUT_ADDR, packet, length) != length) ||
+				(simUsb_In(CS_CONTROL_EPIN_ADDR, reply, sizeof(reply)) != reply_length) ||
+				(reply[0] != seq) || (reply[1] != CS_CONTROL_BULK_MAX_CMDS))
+		{
+			failed++;
+		}
+		else
+		{
+			for(uint32_t i = 0; i < CS_CONTROL_BULK_MAX_CMDS; i++)
+			{
+				record = &reply[CS_CONTROL_BULK_HDR_SIZE + i*CS_CONTROL_BULK_STATUS_SIZE];
+				if((record[0] != CS_CONTROL_SET_AMPL) || (record[1] != CS_CONTROL_STATUS_OK)) failed++;
+			}
+		}
+		n += CS_CONTROL_BULK_MAX_CMDS;
+		seq++;
+	}
+	finish(result, start, executed);
+	TEST_CHECK(failed == 0, "%u bulk packets or commands failed", failed);
+}
+
+static void print(const char* name, const testThroughput* result)
+{
+	printf("  %-8s %10u %10u %10u %10.1f %10.1f\n", name, result->bus.transfers, result->bus.transactions,
+			result->bus.naks, (double)result->bus.bits/SIM_USB_BITS_PER_US/1000.0,
+			(double)result->bus.transfers*TEST_FRAME_US/1000.0);
+}
+
+int main(void)
+{
+	testThroughput control;
+	testThroughput bulk;
+
+	sim_Init();
+	simBoard_Init();
+	TEST_CHECK(simUsb_Connect() == 0, "device is not configured");
+	TEST_CHECK(simUsb_ControlTransfer(0x40, CS_CONTROL_SET_RAMP_RATE, 0, 0, NULL, 0) == 0, "ramp rate is not accepted");
+	if(failures) return EXIT_FAILURE;
+
+	sendControl(&control);
+	sendBulk(&bulk);
+
+	printf("%u commands      transfers transactions  NAKs   bus ms   1 frame/transfer ms\n", TEST_COMMANDS);
+	print("control", &control);
+	print("bulk", &bulk);
+
+	TEST_CHECK(control.executed == TEST_COMMANDS, "%u of %u control commands executed", control.executed,
+			TEST_COMMANDS);
+	TEST_CHECK(bulk.executed == TEST_COMMANDS, "%u of %u bulk commands executed", bulk.executed, TEST_COMMANDS);
+	TEST_CHECK(bulk.bus.bits < control.bus.bits, "bulk bus time is not below control one");
+	TEST_CHECK(bulk.bus.transfers < control.bus.transfers, "bulk round trips are not below control ones");
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <x86intrin.h>
+#include "sim.h"
+#include "sim_usb.h"
+#include "sine_cs.h"
+#include "sine_kernel.h"
+#include "usbd_cs_control.h"
+
+// Amplitude envelope cost per DAC buffer period in table mode, while the envelope ramps and when it is steady. The
+// DAC DMA interrupt only steps the envelope, one compare and one add: it writes no buffer sample and no register
+// beyond the buffer switch, which is counted by a single amplitude change. The main loop rebuilds the idle buffer once
+// per step, one quarter wave pass of the table: in TSC ticks it must stay within TEST_BUILD_MARGIN of a standalone
+// sineKernel_CalcHalfPeriod(). Interrupt host time holds the kernel delivery of register traps, so it is printed only
+#define TEST_PERIOD_US 			(1000000/RAMP_STEPS_PER_SECOND) 	// DAC buffer period
+#define TEST_PERIODS 			50
+#define TEST_WARMUP_PERIODS 	3
+#define TEST_SWITCH_PERIODS 	3 		// periods around a single amplitude change
+#define TEST_RAMP_RATE 			10 		// 0,1 A/s, 7A target is reached in 7 s, after the test
+#define TEST_AMPL 				70 		// 0,1 A
+#define TEST_BUILDS 			2000 	// standalone builds for reference
+#define TEST_BUILD_MARGIN 		4 		// main loop call with the rebuild, averaged in simulation, times standalone build
+
+typedef struct
+{
+	uint32_t irqs; 			// DAC DMA interrupts
+	uint64_t irqNs; 		// host time in them
+	uint32_t accesses; 		// register accesses in them
+	uint32_t bytes; 		// DAC buffer bytes changed inside them
+	uint32_t rebuilds; 		// main loop calls, which write a new buffer
+	uint64_t rebuildTicks; 	// TSC ticks of these calls
+	uint32_t envelope; 		// envelope change, 16.16 DAC discretes
+}testEnvelope;
+
+extern uint16_t sineHalfPeriod[2][SINE_SAMPLES_NUM];
+extern volatile uint32_t bufferVersion;
+extern volatile uint32_t envelope;
+extern volatile uint16_t sineAmplitude_1A;
+
+static uint8_t snapshot[sizeof(sineHalfPeriod)];
+static uint32_t bytesInIsr = 0;
+static uint32_t rebuilds = 0;
+static uint64_t rebuildTicks = 0;
+static uint32_t envelopeStart = 0;
+static volatile uint32_t sink = 0;
+
+static int failures = 0;
+
+#define TEST_CHECK(cond, ...) 	do{ if(!(cond)) { printf("FAIL: " __VA_ARGS__); printf("\n"); failures++; } }while(0)
+
+static void onIrq(IRQn_Type irq, uint8_t is_exit)
+{
+	if(irq != DMA1_Channel2_3_IRQn) return;
+
+	if(!is_exit)
+	{
+		memcpy(snapshot, sineHalfPeriod, sizeof(snapshot));
+		return;
+	}
+	for(size_t i = 0; i < sizeof(snapshot); i++)
+	{
+		if(snapshot[i] != ((uint8_t*)sineHalfPeriod)[i]) bytesInIsr++;
+	}
+}
+
+// firmware main loop, calls which write a new buffer are timed
+static void timedProcess(void)
+{
+	uint32_t version = bufferVersion;
+	uint64_t ticks = __rdtsc();
+
+	sineCS_drv->Process();
+	ticks = __rdtsc() - ticks;
+	if(bufferVersion != version)
+	{
+		rebuilds++;
+		rebuildTicks += ticks;
+	}
+}
+
+static int command(uint8_t request, uint32_t value)
+{
+	return (simUsb_ControlTransfer(0x40, request, (uint16_t)value, (uint16_t)(value >> 16), NULL, 0) < 0) ? -1 : 0;
+}
+
+static void start(void)
+{
+	sim_ResetIrqStats();
+	bytesInIsr = 0;
+	rebuilds = 0;
+	rebuildTicks = 0;
+	envelopeStart = envelope;
+}
+
+static void finish(testEnvelope* result)
+{
+	simIrqStats stats;
+
+	sim_GetIrqStats(DMA1_Channel2_3_IRQn, &stats);
+	result->irqs = stats.count;
+	result->irqNs = stats.ns;
+	result->accesses = stats.accesses;
+	result->bytes = bytesInIsr;
+	result->rebuilds = rebuilds;
+	result->rebuildTicks = rebuildTicks;
+	result->envelope = envelope - envelopeStart;
+}
+
+// standalone half period build, the best of several runs
+static uint64_t buildTicks(void)
+{
+	static uint16_t buf[SINE_SAMPLES_NUM];
+	uint64_t best = UINT64_MAX;
+	uint64_t ticks;
+
+	for(uint32_t run = 0; run < 5; run++)
+	{
+		ticks = __rdtsc();
+		for(uint32_t i = 0; i < TEST_BUILDS; i++)
+		{
+			sineKernel_CalcHalfPeriod(buf, (uint16_t)(sineAmplitude_1A + (i & 1)), 372);
+			sink += buf[SINE_SAMPLES_NUM/2];
+		}
+		ticks = __rdtsc() - ticks;
+		if(ticks < best) best = ticks;
+	}
+	return best/TEST_BUILDS;
+}
+
+static double perPeriod(uint64_t value)
+{
+	return (double)value/TEST_PERIODS;
+}
+
+int main(void)
+{
+	testEnvelope ramp;
+	testEnvelope steady;
+	testEnvelope single;
+	uint64_t build = 0;
+	uint32_t step = 0;
+	uint32_t switch_accesses = 0;
+
+	sim_Init();
+	simBoard_Init();
+	sim_SetMainLoop(timedProcess);
+	sim_SetIrqHook(onIrq);
+	if(simUsb_Connect() || command(CS_CONTROL_SET_RAMP_RATE, TEST_RAMP_RATE) || command(CS_CONTROL_SET_AMPL, TEST_AMPL) ||
+			command(CS_CONTROL_POWER_CTRL, 1))
+	{
+		printf("FAIL: device does not accept commands\n");
+		return EXIT_FAILURE;
+	}
+	sim_Run(TEST_WARMUP_PERIODS*TEST_PERIOD_US);
+	start();
+	sim_Run(TEST_PERIODS*TEST_PERIOD_US);
+	finish(&ramp);
+
+	// steady envelope at the same amplitude
+	if(command(CS_CONTROL_SET_RAMP_RATE, 0) || command(CS_CONTROL_SET_AMPL, TEST_AMPL))
+	{
+		printf("FAIL: device does not accept commands\n");
+		return EXIT_FAILURE;
+	}
+	sim_Run(TEST_WARMUP_PERIODS*TEST_PERIOD_US);
+	start();
+	sim_Run(TEST_PERIODS*TEST_PERIOD_US);
+	finish(&steady);
+
+	// one rebuild and one buffer switch
+	start();
+	if(command(CS_CONTROL_SET_AMPL, TEST_AMPL + 1))
+	{
+		printf("FAIL: device does not accept commands\n");
+		return EXIT_FAILURE;
+	}
+	sim_Run(TEST_SWITCH_PERIODS*TEST_PERIOD_US);
+	finish(&single);
+	switch_accesses = single.accesses - steady.accesses*TEST_SWITCH_PERIODS/TEST_PERIODS;
+
+	build = buildTicks();
+	step = (uint32_t)((((uint64_t)TEST_RAMP_RATE*sineAmplitude_1A) << 16)/(10*RAMP_STEPS_PER_SECOND));
+
+	printf("per DAC buffer period          ramp     steady\n");
+	printf("  DAC DMA interrupts     %10.1f %10.1f\n", perPeriod(ramp.irqs), perPeriod(steady.irqs));
+	printf("  envelope steps         %10.1f %10.1f\n", (double)ramp.envelope/step/TEST_PERIODS,
+			(double)steady.envelope/step/TEST_PERIODS);
+	printf("  buffer bytes in ISR    %10.1f %10.1f\n", perPeriod(ramp.bytes), perPeriod(steady.bytes));
+	printf("  ISR register accesses  %10.1f %10.1f, buffer switch %u\n", perPeriod(ramp.accesses),
+			perPeriod(steady.accesses), switch_accesses);
+	printf("  ISR host ns            %10.1f %10.1f\n", (double)ramp.irqNs/ramp.irqs, (double)steady.irqNs/steady.irqs);
+	printf("  rebuilds               %10.1f %10.1f\n", perPeriod(ramp.rebuilds), perPeriod(steady.rebuilds));
+	printf("  rebuild TSC ticks      %10.1f %10s, standalone build %llu\n",
+			ramp.rebuilds ? (double)ramp.rebuildTicks/ramp.rebuilds : 0.0, "-", (unsigned long long)build);
+
+	// one step and one rebuild per period: the ramp never moves faster than buffers are played
+	TEST_CHECK((ramp.envelope >= (TEST_PERIODS - 1)*step) && (ramp.envelope <= (TEST_PERIODS + 1)*step),
+			"envelope moved %u, expected %u steps of %u", ramp.envelope, TEST_PERIODS, step);
+	TEST_CHECK((ramp.rebuilds >= TEST_PERIODS - 1) && (ramp.rebuilds <= TEST_PERIODS + 1), "%u rebuilds in %u periods",
+			ramp.rebuilds, TEST_PERIODS);
+	TEST_CHECK((steady.envelope == 0) && (steady.rebuilds == 0), "steady envelope is rebuilt");
+	TEST_CHECK((ramp.bytes == 0) && (steady.bytes == 0), "DAC buffer is written in ISR");
+	TEST_CHECK(ramp.rebuildTicks <= (uint64_t)TEST_BUILD_MARGIN*build*ramp.rebuilds,
+			"rebuild takes %.1f standalone builds", (double)ramp.rebuildTicks/ramp.rebuilds/build);
+	TEST_CHECK((single.rebuilds == 1) && (switch_accesses != 0), "single amplitude change takes %u rebuilds",
+			single.rebuilds);
+	// the step itself touches no register
+	TEST_CHECK(ramp.accesses <= steady.accesses + ramp.rebuilds*switch_accesses,
+			"ramping interrupts make %u register accesses, steady ones %u", ramp.accesses, steady.accesses);
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,183 @@
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <time.h>
+#include "sim.h"
+#include "sine_cs.h"
+#include "sine_kernel.h"
+#include "stm32l0xx_it.h"
+
+// Versioned handoff of DAC buffers under real concurrency. Main thread is the writer: it changes amplitude and runs
+// firmware main loop, which rebuilds the idle buffer. Reader thread plays DMA: it raises transfer complete interrupt,
+// which preempts the writer at any instruction, then reads the buffer DMA is pointed to twice. Each read must be a
+// whole half period of one amplitude, a torn half mixes two of them or changes while it is played
+#define TEST_READS 				10000
+#define TEST_PLAY_NS 			10000 	// played half period is varied up to this time, the build takes a fraction of it
+#define TEST_ACK_TIMEOUT_S 		1
+#define TEST_AMPL_NUM 			3
+
+extern volatile uint32_t bufferVersion;
+extern volatile uint32_t appliedVersion;
+extern volatile uint16_t sineOffset;
+
+static const uint16_t amplitudes[TEST_AMPL_NUM] = {60, 150, 240}; 	// DAC codes of calibration mode range
+static uint16_t references[TEST_AMPL_NUM][SINE_SAMPLES_NUM];
+
+static sem_t ack;
+static volatile uint32_t busyWrites = 0; 	// interrupts taken while the idle buffer is being written
+static volatile uint8_t isDone = 0;
+
+typedef struct
+{
+	uint32_t reads;
+	uint32_t torn; 			// read is none of the amplitudes
+	uint32_t changed; 		// buffer changed between two reads
+	uint32_t switches; 		// amplitude differs from the previous read
+	uint32_t timeouts;
+}testHandoff;
+
+static testHandoff result;
+
+// DAC DMA transfer complete, runs in main thread from signal handler: semaphore post is async signal safe
+static void dmaIsr(void)
+{
+	DMA_TypeDef* dma = (DMA_TypeDef*)sim_Alias((uint32_t)DMA1);
+
+	if(bufferVersion & 1) busyWrites++;
+	dma->ISR |= DMA_ISR_TCIF2 | DMA_ISR_GIF2;
+	DMA1_Channel2_3_IRQHandler();
+	sem_post(&ack);
+}
+
+static int findAmplitude(const uint16_t* buf)
+{
+	for(int i = 0; i < TEST_AMPL_NUM; i++)
+	{
+		if(memcmp(buf, references[i], sizeof(references[i])) == 0) return i;
+	}
+	return -1;
+}
+
+static void* reader(void* arg)
+{
+	DMA_Channel_TypeDef* dma_ch = (DMA_Channel_TypeDef*)sim_Alias((uint32_t)DMA1_Channel2);
+	static uint16_t first[SINE_SAMPLES_NUM];
+	static uint16_t second[SINE_SAMPLES_NUM];
+	const uint16_t* buf;
+	struct timespec timeout;
+	struct timespec play = {0, 0};
+	int last = -1;
+	int index;
+	int status;
+
+	(void)arg;
+	// wake up at the requested time, default slack is longer than the whole play range
+	prctl(PR_SET_TIMERSLACK, 1);
+	for(uint32_t i = 0; i < TEST_READS; i++)
+	{
+		clock_gettime(CLOCK_REALTIME, &timeout);
+		timeout.tv_sec += TEST_ACK_TIMEOUT_S;
+		sim_Preempt();
+		do
+		{
+			status = sem_timedwait(&ack, &timeout);
+		}while((status != 0) && (errno == EINTR));
+		if(status != 0)
+		{
+			result.timeouts++;
+			break;
+		}
+
+		// DMA plays the buffer until the next transfer complete
+		buf = (const uint16_t*)(uintptr_t)dma_ch->CMAR;
+		memcpy(first, buf, sizeof(first));
+		memcpy(second, buf, sizeof(second));
+		result.reads++;
+		index = findAmplitude(first);
+		if(index < 0) result.torn++;
+		if(memcmp(first, second, sizeof(first)) != 0) result.changed++;
+		if((index >= 0) && (last >= 0) && (index != last)) result.switches++;
+		last = index;
+
+		// writer runs until the next transfer complete, interrupt hits it at a different point each time
+		play.tv_nsec = (long)((i*337) % TEST_PLAY_NS);
+		nanosleep(&play, NULL);
+	}
+	isDone = 1;
+	return NULL;
+}
+
+int main(void)
+{
+	pthread_t thread;
+	uint32_t version;
+	uint32_t n = 0;
+	int failures = 0;
+
+	sem_init(&ack, 0, 0);
+	sim_Init();
+	simBoard_Init();
+
+	// raw amplitudes are applied at once in calibration mode, without ramp and loop correction
+	sineCS_drv->PostCommand(SINE_CS_CMD_CALIB_MODE_CTRL, 1);
+	sineCS_drv->PostCommand(SINE_CS_CMD_SET_RAMP_RATE, 0);
+	sineCS_drv->PostCommand(SINE_CS_CMD_SET_RAW_AMPL, amplitudes[0]);
+	sineCS_drv->PostCommand(SINE_CS_CMD_POWER_CTRL, 1);
+	sineCS_drv->Process();
+	for(int i = 0; i < TEST_AMPL_NUM; i++)
+	{
+		sineKernel_CalcHalfPeriod(references[i], amplitudes[i], sineOffset);
+	}
+	// DMA takes the first waveform before the reader starts
+	dmaIsr();
+	sem_wait(&ack);
+	if(findAmplitude((const uint16_t*)(uintptr_t)DMA1_Channel2->CMAR) != 0)
+	{
+		printf("FAIL: the first waveform is not taken\n");
+		return EXIT_FAILURE;
+	}
+
+	version = appliedVersion;
+	sim_SetPreemptive(dmaIsr);
+	if(pthread_create(&thread, NULL, reader, NULL) != 0)
+	{
+		printf("FAIL: reader thread is not started\n");
+		return EXIT_FAILURE;
+	}
+	while(!isDone)
+	{
+		sineCS_drv->PostCommand(SINE_CS_CMD_SET_RAW_AMPL, amplitudes[n++ % TEST_AMPL_NUM]);
+		sineCS_drv->Process();
+	}
+	pthread_join(thread, NULL);
+
+	printf("%u reads, %u new waveforms, %u interrupts during buffer write, %u torn, %u changed while played\n",
+			result.reads, (appliedVersion - version)/2, busyWrites, result.torn, result.changed);
+
+	if(result.timeouts)
+	{
+		printf("FAIL: interrupt is not taken\n");
+		failures++;
+	}
+	if(result.torn || result.changed)
+	{
+		printf("FAIL: torn half periods\n");
+		failures++;
+	}
+	// handoff is exercised: DMA switches buffers and interrupts hit the writer in the middle
+	if(result.switches < TEST_READS/10)
+	{
+		printf("FAIL: %u switches in %u reads\n", result.switches, result.reads);
+		failures++;
+	}
+	if(busyWrites == 0)
+	{
+		printf("FAIL: no interrupt during buffer write\n");
+		failures++;
+	}
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,234 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "sim.h"
+#include "sim_usb.h"
+#include "sine_cs.h"
+#include "sine_kernel.h"
+#include "usbd_cs_control.h"
+
+// DAC DMA interrupt work per output period, amplitude is changed every period. Before: the original handoff,
+// waveform is staged in tempBuf and half transfer / transfer complete callbacks copy it into the single DMA
+// buffer. After: firmware as built, new waveform is written into the idle ping-pong buffer out of interrupt
+// context and transfer complete only switches DMA memory address. Each case runs in its own process, simulator
+// owns device address space
+#define TEST_PERIOD_US 			20000
+#define TEST_PERIODS 			20
+#define TEST_WARMUP_PERIODS 	3
+#define TEST_AMPL_LOW 			10 		// 0,1 A
+#define TEST_AMPL_HIGH 			12
+#define TEST_RAW_AMPL_LOW 		124 	// DAC codes, default calibration of the amplitudes above
+#define TEST_RAW_AMPL_HIGH 		149
+#define TEST_OFFSET 			372
+
+typedef struct
+{
+	uint32_t irqs; 			// DAC DMA interrupts
+	uint32_t accesses; 		// register accesses in them
+	uint32_t bytes; 		// DAC buffer bytes changed inside them
+	uint32_t switches; 		// new waveforms taken by DMA, firmware only
+}testIsrWork;
+
+extern uint16_t sineHalfPeriod[2][SINE_SAMPLES_NUM];
+extern volatile uint32_t appliedVersion;
+
+// original design replica
+static uint16_t baselineBuf[SINE_SAMPLES_NUM];
+static uint16_t tempBuf[SINE_SAMPLES_NUM];
+static volatile uint8_t isHalfSineParamsChanged = 0;
+static volatile uint8_t isFullSineParamsChanged = 0;
+static uint32_t baselinePeriod = 0;
+
+// interrupt hook: DAC buffers are compared before and after the handler
+static uint8_t* watched = NULL;
+static size_t watchedSize = 0;
+static uint8_t snapshot[sizeof(sineHalfPeriod)];
+static uint32_t bytesInIsr = 0;
+
+static void onIrq(IRQn_Type irq, uint8_t is_exit)
+{
+	if(irq != DMA1_Channel2_3_IRQn) return;
+
+	if(!is_exit)
+	{
+		memcpy(snapshot, watched, watchedSize);
+		return;
+	}
+	for(size_t i = 0; i < watchedSize; i++)
+	{
+		if(snapshot[i] != watched[i]) bytesInIsr++;
+	}
+}
+
+// original DAC DMA callbacks, behind HAL_DMA_IRQHandler()
+static void baselineDmaHandler(void)
+{
+	uint16_t bufferSize = sizeof(baselineBuf)/2;
+	uint32_t isr = DMA1->ISR;
+
+	DMA1->IFCR = DMA_IFCR_CGIF2;
+	if(isr & DMA_ISR_HTIF2)
+	{
+		if(isHalfSineParamsChanged)
+		{
+			isHalfSineParamsChanged = 0;
+			memcpy(baselineBuf, tempBuf, bufferSize);
+		}
+	}
+	if(isr & DMA_ISR_TCIF2)
+	{
+		if(isFullSineParamsChanged)
+		{
+			isFullSineParamsChanged = 0;
+			memcpy(baselineBuf + SINE_SAMPLES_NUM/2, tempBuf + SINE_SAMPLES_NUM/2, bufferSize);
+		}
+	}
+}
+
+// original calcHalfSineWave() from USB context, once per period
+static void baselineWriter(void)
+{
+	uint32_t period = sim_GetTime()/TEST_PERIOD_US;
+
+	if(period == baselinePeriod) return;
+	baselinePeriod = period;
+	sineKernel_CalcHalfPeriod(tempBuf, (period & 1) ? TEST_RAW_AMPL_HIGH : TEST_RAW_AMPL_LOW, TEST_OFFSET);
+	isHalfSineParamsChanged = 1;
+	isFullSineParamsChanged = 1;
+}
+
+static int command(uint8_t request, uint32_t value)
+{
+	return (simUsb_ControlTransfer(0x40, request, (uint16_t)value, (uint16_t)(value >> 16), NULL, 0) < 0) ? -1 : 0;
+}
+
+static void measure(testIsrWork* work, uint8_t is_baseline)
+{
+	simIrqStats stats;
+	uint32_t start;
+	uint32_t version = 0;
+
+	sim_Init();
+	simBoard_Init();
+
+	if(is_baseline)
+	{
+		// one 500 sample buffer in circular mode, both half transfer and transfer complete interrupts
+		sineKernel_CalcHalfPeriod(baselineBuf, TEST_RAW_AMPL_LOW, TEST_OFFSET);
+		DMA1_Channel2->CCR &= ~DMA_CCR_EN;
+		DMA1_Channel2->CMAR = (uint32_t)baselineBuf;
+		DMA1_Channel2->CNDTR = SINE_SAMPLES_NUM;
+		DMA1_Channel2->CCR |= DMA_CCR_HTIE | DMA_CCR_TCIE | DMA_CCR_EN;
+		sim_SetIrqHandler(DMA1_Channel2_3_IRQn, baselineDmaHandler);
+		sim_SetMainLoop(baselineWriter);
+		watched = (uint8_t*)baselineBuf;
+		watchedSize = sizeof(baselineBuf);
+	}
+	else
+	{
+		if(simUsb_Connect() || command(CS_CONTROL_SET_RAMP_RATE, 0) || command(CS_CONTROL_POWER_CTRL, 1))
+		{
+			printf("FAIL: device does not accept commands\n");
+			exit(EXIT_FAILURE);
+		}
+		watched = (uint8_t*)sineHalfPeriod;
+		watchedSize = sizeof(sineHalfPeriod);
+	}
+	sim_SetIrqHook(onIrq);
+
+	start = sim_GetTime();
+	for(uint32_t i = 0; i < TEST_WARMUP_PERIODS + TEST_PERIODS; i++)
+	{
+		if(i == TEST_WARMUP_PERIODS)
+		{
+			sim_ResetIrqStats();
+			bytesInIsr = 0;
+			version = appliedVersion;
+		}
+		if(!is_baseline && command(CS_CONTROL_SET_AMPL, (i & 1) ? TEST_AMPL_HIGH : TEST_AMPL_LOW))
+		{
+			printf("FAIL: amplitude is not accepted\n");
+			exit(EXIT_FAILURE);
+		}
+		sim_Run(start + (i + 1)*TEST_PERIOD_US - sim_GetTime());
+	}
+
+	sim_GetIrqStats(DMA1_Channel2_3_IRQn, &stats);
+	work->irqs = stats.count;
+	work->accesses = stats.accesses;
+	work->bytes = bytesInIsr;
+	work->switches = (appliedVersion - version)/2;
+}
+
+static int runCase(testIsrWork* work, uint8_t is_baseline)
+{
+	int fds[2];
+	int status = 0;
+	pid_t pid;
+
+	if(pipe(fds) != 0) return -1;
+	pid = fork();
+	if(pid < 0) return -1;
+	if(pid == 0)
+	{
+		close(fds[0]);
+		measure(work, is_baseline);
+		if(write(fds[1], work, sizeof(*work)) != sizeof(*work)) _exit(EXIT_FAILURE);
+		_exit(EXIT_SUCCESS);
+	}
+	close(fds[1]);
+	if(read(fds[0], work, sizeof(*work)) != sizeof(*work)) status = -1;
+	close(fds[0]);
+	waitpid(pid, NULL, 0);
+	return status;
+}
+
+int main(void)
+{
+	testIsrWork before;
+	testIsrWork after;
+	int failures = 0;
+
+	if(runCase(&before, 1) || runCase(&after, 0))
+	{
+		printf("FAIL: measurement process failed\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("DAC DMA ISR per period     before      after\n");
+	printf("  interrupts          %10.1f %10.1f\n", (double)before.irqs/TEST_PERIODS, (double)after.irqs/TEST_PERIODS);
+	printf("  buffer bytes changed%10.1f %10.1f\n", (double)before.bytes/TEST_PERIODS,
+			(double)after.bytes/TEST_PERIODS);
+	printf("  register accesses   %10.1f %10.1f\n", (double)before.accesses/TEST_PERIODS,
+			(double)after.accesses/TEST_PERIODS);
+
+	// half transfer and transfer complete of two 500 sample transfers before, one transfer complete per half after
+	if((before.irqs < 4*TEST_PERIODS - 1) || (before.irqs > 4*TEST_PERIODS + 1))
+	{
+		printf("FAIL: %u interrupts before, expected %u\n", before.irqs, 4*TEST_PERIODS);
+		failures++;
+	}
+	if((after.irqs < 2*TEST_PERIODS - 1) || (after.irqs > 2*TEST_PERIODS + 1))
+	{
+		printf("FAIL: %u interrupts after, expected %u\n", after.irqs, 2*TEST_PERIODS);
+		failures++;
+	}
+	if(before.bytes == 0)
+	{
+		printf("FAIL: baseline copies nothing in ISR, amplitude changes are not applied\n");
+		failures++;
+	}
+	if(after.switches < TEST_PERIODS - 1)
+	{
+		printf("FAIL: %u new waveforms in %u periods after\n", after.switches, TEST_PERIODS);
+		failures++;
+	}
+	if(after.bytes != 0)
+	{
+		printf("FAIL: %u DAC buffer bytes are written in ISR\n", after.bytes);
+		failures++;
+	}
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
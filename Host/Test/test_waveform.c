@@ -0,0 +1,121 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "sim.h"
+#include "sim_usb.h"
+#include "usbd_cs_control.h"
+
+// Output current of firmware on simulated board in table mode at 50 Hz: each half period has its own sign,
+// commutator keeps the current at zero between halves and never opens both channels
+#define TEST_PERIOD_US 			20000
+#define TEST_PERIODS 			10
+#define TEST_ZERO_A 			0.001f
+#define TEST_HALVES_MAX 		(2*TEST_PERIODS + 2)
+
+typedef struct
+{
+	int8_t sign;
+	uint32_t start; 		// us
+	uint32_t samples;
+	float peak; 			// A, absolute
+}testHalf;
+
+static testHalf halves[TEST_HALVES_MAX];
+static uint32_t halvesNum = 0;
+static uint32_t samplesNum = 0;
+static uint32_t shootThrough = 0;
+static uint32_t powerOff = 0;
+static uint32_t zeroGaps = 0; 			// sign changes with zero current samples between halves
+static uint32_t directChanges = 0; 	// sign changes without zero current between
+static int8_t lastSign = 0;
+static uint8_t isZeroSeen = 0;
+static int failures = 0;
+
+#define TEST_CHECK(cond, ...) 	do{ if(!(cond)) { printf("FAIL: " __VA_ARGS__); printf("\n"); failures++; } }while(0)
+
+static void onSample(const simSample* sample)
+{
+	int8_t sign = (sample->current > TEST_ZERO_A) ? 1 : ((sample->current < -TEST_ZERO_A) ? -1 : 0);
+
+	samplesNum++;
+	if(sample->ch1 && sample->ch2) shootThrough++;
+	if(!sample->dcEn) powerOff++;
+
+	if(sign == 0)
+	{
+		isZeroSeen = 1;
+		return;
+	}
+	if(sign != lastSign)
+	{
+		if(lastSign != 0)
+		{
+			if(isZeroSeen) zeroGaps++;
+			else directChanges++;
+		}
+		if(halvesNum < TEST_HALVES_MAX)
+		{
+			halves[halvesNum].sign = sign;
+			halves[halvesNum].start = sample->time;
+			halvesNum++;
+		}
+		lastSign = sign;
+	}
+	isZeroSeen = 0;
+	if(halvesNum && (halvesNum <= TEST_HALVES_MAX))
+	{
+		halves[halvesNum - 1].samples++;
+		if(fabsf(sample->current) > halves[halvesNum - 1].peak) halves[halvesNum - 1].peak = fabsf(sample->current);
+	}
+}
+
+static int command(uint8_t request, uint32_t value)
+{
+	return (simUsb_ControlTransfer(0x40, request, (uint16_t)value, (uint16_t)(value >> 16), NULL, 0) < 0) ? -1 : 0;
+}
+
+int main(void)
+{
+	uint32_t period;
+
+	sim_Init();
+	simBoard_Init();
+	TEST_CHECK(simUsb_Connect() == 0, "device is not configured");
+	TEST_CHECK(simUsb_GetAddress() == SIM_USB_ADDRESS, "device address %u", simUsb_GetAddress());
+	TEST_CHECK(command(CS_CONTROL_SET_RAMP_RATE, 0) == 0, "ramp rate is not accepted");
+	TEST_CHECK(command(CS_CONTROL_SET_FREQ, 50000) == 0, "frequency is not accepted");
+	TEST_CHECK(command(CS_CONTROL_SET_AMPL, 10) == 0, "amplitude is not accepted");
+	TEST_CHECK(command(CS_CONTROL_POWER_CTRL, 1) == 0, "power on is not accepted");
+	if(failures) return EXIT_FAILURE;
+
+	// settle, then record whole halves only: the first and the last ones can be cut
+	sim_Run(2*TEST_PERIOD_US);
+	simPeriph_SetSampleHook(onSample);
+	sim_Run(TEST_PERIODS*TEST_PERIOD_US);
+	simPeriph_SetSampleHook(NULL);
+
+	TEST_CHECK(samplesNum > 0, "no DAC updates");
+	TEST_CHECK(shootThrough == 0, "both commutator channels are on in %u samples", shootThrough);
+	TEST_CHECK(powerOff == 0, "output stage is off in %u samples", powerOff);
+	TEST_CHECK(directChanges == 0, "%u sign changes without dead-time", directChanges);
+	TEST_CHECK((halvesNum >= 2*TEST_PERIODS - 1) && (halvesNum <= 2*TEST_PERIODS + 1), "%u halves in %u periods",
+			halvesNum, TEST_PERIODS);
+	TEST_CHECK(zeroGaps + 1 == halvesNum, "%u dead-time gaps for %u halves", zeroGaps, halvesNum);
+
+	for(uint32_t i = 1; (i + 1 < halvesNum) && (i + 2 < TEST_HALVES_MAX); i++)
+	{
+		TEST_CHECK(halves[i].sign == -halves[i - 1].sign, "half %u has the sign of previous one", i);
+		TEST_CHECK(fabsf(halves[i].peak - halves[1].peak) < 0.02f*halves[1].peak,
+				"half %u peak %.3f A, half 1 peak %.3f A", i, halves[i].peak, halves[1].peak);
+		if(i >= 2)
+		{
+			period = halves[i].start - halves[i - 2].start;
+			TEST_CHECK((period > TEST_PERIOD_US - 100) && (period < TEST_PERIOD_US + 100), "period %u us", period);
+		}
+	}
+	TEST_CHECK((halvesNum > 1) && (fabsf(halves[1].peak - 1.0f) < 0.05f), "peak current is not 1 A");
+
+	printf("%u samples, %u halves, peak %.3f A, %s\n", samplesNum, halvesNum, (halvesNum > 1) ? halves[1].peak : 0.0f,
+			failures ? "failed" : "passed");
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
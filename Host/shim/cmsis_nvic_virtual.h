@@ -0,0 +1,27 @@
+#ifndef __SIM_CMSIS_NVIC_VIRTUAL_H
+#define __SIM_CMSIS_NVIC_VIRTUAL_H
+
+// host build: NVIC is modelled by simulator, SysTick priority is kept there too
+void sim_NvicEnableIrq(IRQn_Type irq);
+uint32_t sim_NvicGetEnableIrq(IRQn_Type irq);
+void sim_NvicDisableIrq(IRQn_Type irq);
+uint32_t sim_NvicGetPendingIrq(IRQn_Type irq);
+void sim_NvicSetPendingIrq(IRQn_Type irq);
+void sim_NvicClearPendingIrq(IRQn_Type irq);
+void sim_NvicSetPriority(IRQn_Type irq, uint32_t priority);
+uint32_t sim_NvicGetPriority(IRQn_Type irq);
+void sim_NvicSystemReset(void) __attribute__((noreturn));
+
+#define NVIC_SetPriorityGrouping(group) 	((void)(group))
+#define NVIC_GetPriorityGrouping() 			(0U)
+#define NVIC_EnableIRQ 						sim_NvicEnableIrq
+#define NVIC_GetEnableIRQ 					sim_NvicGetEnableIrq
+#define NVIC_DisableIRQ 					sim_NvicDisableIrq
+#define NVIC_GetPendingIRQ 					sim_NvicGetPendingIrq
+#define NVIC_SetPendingIRQ 					sim_NvicSetPendingIrq
+#define NVIC_ClearPendingIRQ 				sim_NvicClearPendingIrq
+#define NVIC_SetPriority 					sim_NvicSetPriority
+#define NVIC_GetPriority 					sim_NvicGetPriority
+#define NVIC_SystemReset 					sim_NvicSystemReset
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef __SIM_CORE_CM0PLUS_H
+#define __SIM_CORE_CM0PLUS_H
+
+// host build: CMSIS core header is used as is, intrinsics which touch PRIMASK or NVIC are routed to simulator.
+// CMSIS inline versions are renamed before inclusion, they contain Cortex-M instructions and are never called
+#define __enable_irq 		__cmsis_enable_irq
+#define __disable_irq 		__cmsis_disable_irq
+#define __get_PRIMASK 		__cmsis_get_PRIMASK
+#define __set_PRIMASK 		__cmsis_set_PRIMASK
+#define __ISB 				__cmsis_ISB
+#define __DSB 				__cmsis_DSB
+#define __DMB 				__cmsis_DMB
+
+#define CMSIS_NVIC_VIRTUAL
+
+#include_next "core_cm0plus.h"
+
+#undef __enable_irq
+#undef __disable_irq
+#undef __get_PRIMASK
+#undef __set_PRIMASK
+#undef __ISB
+#undef __DSB
+#undef __DMB
+
+void sim_EnableIrq(void);
+void sim_DisableIrq(void);
+uint32_t sim_GetPrimask(void);
+void sim_SetPrimask(uint32_t primask);
+
+#define __enable_irq() 			sim_EnableIrq()
+#define __disable_irq() 		sim_DisableIrq()
+#define __get_PRIMASK() 		sim_GetPrimask()
+#define __set_PRIMASK(primask) 	sim_SetPrimask(primask)
+#define __ISB() 				__sync_synchronize()
+#define __DSB() 				__sync_synchronize()
+#define __DMB() 				__sync_synchronize()
+
+#endif
@@ -27,6 +27,7 @@ extern "C" {
 
 /* Includes ------------------------------------------------------------------*/
 #include  "usbd_ioreq.h"
+#include  "sine_cs.h"
 
 /** @addtogroup STM32_USB_DEVICE_LIBRARY
   * @{
@@ -42,9 +43,18 @@ extern "C" {
   * @{
   */
 
-#define USB_CONTROL_CONFIG_DESC_SIZ       	18U
+#define USB_CONTROL_CONFIG_DESC_SIZ       	46U
 #define USB_CONTROL_DESC_SIZ              	9U
 
+#define CS_CONTROL_EPOUT_ADDR				0x01U
+#define CS_CONTROL_EPIN_ADDR				0x81U
+#define CS_CONTROL_EP_SIZE					0x40U
+#define CS_CONTROL_EVENT_EP_ADDR			0x82U
+#define CS_CONTROL_EVENT_EP_SIZE			0x08U // one sineCS_event record per transfer
+#define CS_CONTROL_CAPTURE_EP_ADDR			0x83U
+#define CS_CONTROL_CAPTURE_EP_SIZE			0x40U
+#define CS_CONTROL_CAPTURE_CHUNK			(CS_CONTROL_CAPTURE_EP_SIZE/4U) // capture samples per packet
+
 #ifndef CONTROL_FS_BINTERVAL
 #define CONTROL_FS_BINTERVAL            	0x05U
 #endif /* CONTROL_FS_BINTERVAL */
@@ -55,6 +65,45 @@ extern "C" {
 #define CS_CONTROL_SET_RAW_OFFSET			0x34
 #define CS_CONTROL_SET_RAW_AMPL				0x35
 #define CS_CONTROL_SET_AMPL					0x36
+#define CS_CONTROL_SET_FREQ					0x37 // wValue - low word, wIndex - high word of frequency in mHz
+#define CS_CONTROL_SET_RAMP_RATE			0x38 // wValue - ramp rate in 0,1 A/s, 0 - no ramp
+#define CS_CONTROL_SET_DEAD_TIME			0x39 // wValue - commutator dead-time in DAC samples, calibration mode
+#define CS_CONTROL_DEAD_TIME_SWEEP			0x3A // wValue - 1 start, 0 stop and restore the previous step
+#define CS_CONTROL_SAVE_SETTINGS			0x3B // save settings snapshot to EEPROM journal
+#define CS_CONTROL_SET_CAL_POINT			0x3C // wValue - 1...7 A, current raw amplitude is stored as calibration point
+#define CS_CONTROL_FULL_PERIOD_CTRL			0x3D // wValue - 1 full period buffer with polarity corrections, 0 half period
+#define CS_CONTROL_CALIB_POLARITY			0x3E // wValue - 1 raw amplitude and offset set negative half corrections
+#define CS_CONTROL_LINEARIZATION_CTRL		0x3F // wValue - 1 enable, 0 disable linearization curve, calibration mode
+#define CS_CONTROL_GET_STATUS				0x40 // IN request, returns sineCS_status block
+#define CS_CONTROL_GET_PERF					0x41 // IN request, returns sineCS_perf block, wValue - 1 to reset statistics
+#define CS_CONTROL_SET_LINEARIZATION		0x42 // OUT request, SINE_LIN_KNOTS signed corrections, calibration mode
+#define CS_CONTROL_GET_LINEARIZATION		0x43 // IN request, returns SINE_LIN_KNOTS signed corrections
+#define CS_CONTROL_LOOP_CTRL				0x44 // wValue - 1 closed loop RMS regulation, 0 open loop. Stays open until shunt channel is confirmed, see current_sense.h
+#define CS_CONTROL_CAPTURE_CTRL				0x45 // wValue - SINE_CAPTURE_x trigger, 0 releases frozen record
+/* Frozen capture record is sent over capture bulk endpoint as SINE_CAPTURE_SAMPLES 32-bit words in time order.
+   Record length is a multiple of packet size and no zero length packet is sent, host reads the whole record */
+#define CS_CONTROL_CAPTURE_READ				0x46
+#define CS_CONTROL_WAVE_WRITE				0x47 // OUT request, wIndex - first sample, little-endian samples to waveform slot
+#define CS_CONTROL_WAVE_ACTIVATE			0x48 // wValue - low word, wIndex - high word of slot CRC-32/MPEG-2 (poly 0x04C11DB7, init 0xFFFFFFFF, no reflection, no final XOR, LE words)
+#define CS_CONTROL_WAVE_CTRL				0x49 // wValue - 1 verified waveform slot, 0 sine
+#define CS_CONTROL_SET_HARMONIC				0x4A // wValue - amplitude | order << 12, wIndex - phase
+#define CS_CONTROL_HARMONICS_CTRL			0x4B // wValue - 1 synthesize and activate, 0 clear harmonics list
+#define CS_CONTROL_SET_SEGMENT				0x4C // OUT request, wIndex - segment index, sineCS_segment, sequencer stopped
+#define CS_CONTROL_SEQUENCE_CTRL			0x4D // wValue - segments number, 0 stop, wIndex - loops, 0 endless
+#define CS_CONTROL_BURST_CTRL				0x4E // wValue - periods in burst, 0 stop, wIndex - interval ms, 0 single burst
+
+/* Bulk command packet: sequence number, commands count, then commands count records of
+   command code (one of vendor request codes above) and 32-bit little-endian value (wValue | wIndex << 16).
+   Reply packet: the same sequence number and commands count, then command code and status for each command */
+#define CS_CONTROL_BULK_HDR_SIZE			2U
+#define CS_CONTROL_BULK_CMD_SIZE			5U
+#define CS_CONTROL_BULK_STATUS_SIZE			2U
+#define CS_CONTROL_BULK_MAX_CMDS			((CS_CONTROL_EP_SIZE - CS_CONTROL_BULK_HDR_SIZE)/CS_CONTROL_BULK_CMD_SIZE)
+
+#define CS_CONTROL_STATUS_OK				0x00 // command is queued
+#define CS_CONTROL_STATUS_BUSY				0x01 // command queue is full, command is dropped
+#define CS_CONTROL_STATUS_UNKNOWN			0x02 // unknown command code
+#define CS_CONTROL_STATUS_NOT_EXECUTED		0x03 // command is out of packet length
 /**
   * @}
   */
@@ -66,6 +115,17 @@ extern "C" {
 typedef struct
 {
   uint32_t             AltSetting;
+  uint8_t              RxBuffer[CS_CONTROL_EP_SIZE];
+  uint8_t              TxBuffer[CS_CONTROL_EP_SIZE];
+  uint8_t              CtlBuffer[CS_CONTROL_EP_SIZE]; // control transfers data stage
+  uint8_t              CtlRequest;                    // request, which data stage is received
+  uint16_t             CtlIndex;                      // wIndex of the request
+  sineCS_status        Status;
+  sineCS_perf          Perf;
+  sineCS_event         Event;
+  volatile uint8_t     EventBusy;
+  uint32_t             CaptureBuffer[CS_CONTROL_CAPTURE_CHUNK];
+  uint16_t             CaptureIndex;                  // record index of the next packet
 }
 USBD_CONTROL_HandleTypeDef;
 /**
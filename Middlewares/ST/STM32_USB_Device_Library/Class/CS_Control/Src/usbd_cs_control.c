@@ -85,9 +85,27 @@ EndBSPDependencies */
   * @{
   */
 
+static uint8_t  USBD_CONTROL_Init(USBD_HandleTypeDef *pdev, uint8_t cfgidx);
+
+static uint8_t  USBD_CONTROL_DeInit(USBD_HandleTypeDef *pdev, uint8_t cfgidx);
+
 static uint8_t  USBD_CONTROL_Setup(USBD_HandleTypeDef *pdev,
                                       USBD_SetupReqTypedef *req);
 
+static uint8_t  USBD_CONTROL_EP0_RxReady(USBD_HandleTypeDef *pdev);
+
+static uint8_t  USBD_CONTROL_DataIn(USBD_HandleTypeDef *pdev, uint8_t epnum);
+
+static uint8_t  USBD_CONTROL_DataOut(USBD_HandleTypeDef *pdev, uint8_t epnum);
+
+static uint8_t  USBD_CONTROL_SOF(USBD_HandleTypeDef *pdev);
+
+static void     USBD_CONTROL_SendEvent(USBD_HandleTypeDef *pdev);
+
+static uint8_t  USBD_CONTROL_SendCapture(USBD_HandleTypeDef *pdev);
+
+static uint8_t  USBD_CONTROL_GetDriverCmd(uint8_t request);
+
 static uint8_t  *USBD_CONTROL_GetFSCfgDesc(uint16_t *length);
 
 static uint8_t  *USBD_CONTROL_GetDeviceQualifierDesc(uint16_t *length);
@@ -101,14 +119,14 @@ static uint8_t  *USBD_CONTROL_GetDeviceQualifierDesc(uint16_t *length);
 
 USBD_ClassTypeDef  USBD_CONTROL =
 {
-  NULL,
-  NULL,
+  USBD_CONTROL_Init,
+  USBD_CONTROL_DeInit,
   USBD_CONTROL_Setup,
   NULL, /*EP0_TxSent*/
-  NULL, /*EP0_RxReady*/ /* STATUS STAGE IN */
-  NULL, /*DataIn*/
-  NULL,
-  NULL, /*SOF */
+  USBD_CONTROL_EP0_RxReady, /*EP0_RxReady*/ /* STATUS STAGE IN */
+  USBD_CONTROL_DataIn, /*DataIn*/
+  USBD_CONTROL_DataOut,
+  USBD_CONTROL_SOF, /*SOF */
   NULL,
   NULL,
   NULL,
@@ -136,13 +154,48 @@ __ALIGN_BEGIN static uint8_t USBD_CONTROL_CfgFSDesc[USB_CONTROL_CONFIG_DESC_SIZ]
 	USB_DESC_TYPE_INTERFACE,   /* bDescriptorType */
 	0x00,   /* bInterfaceNumber: Number of Interface */
 	0x00,      /* bAlternateSetting: Alternate setting */
-	0x00,   /* bNumEndpoints*/
+	0x04,   /* bNumEndpoints*/
 	0xFF,   /* bInterfaceClass: Vendor Specific Class Code */
 	0x00,   /* bInterfaceSubClass*/
 	0x00,   /* nInterfaceProtocol*/
-	USBD_IDX_INTERFACE_STR + 1U /* iInterface: Index of string descriptor */
+	USBD_IDX_INTERFACE_STR + 1U, /* iInterface: Index of string descriptor */
+
+	0x07,   /* bLength: Endpoint Descriptor size */
+	USB_DESC_TYPE_ENDPOINT, /* bDescriptorType: Endpoint */
+	CS_CONTROL_EPOUT_ADDR,  /* bEndpointAddress: batched commands */
+	USBD_EP_TYPE_BULK,      /* bmAttributes: Bulk */
+	LOBYTE(CS_CONTROL_EP_SIZE), /* wMaxPacketSize */
+	HIBYTE(CS_CONTROL_EP_SIZE),
+	0x00,   /* bInterval: ignored for Bulk transfer */
+
+	0x07,   /* bLength: Endpoint Descriptor size */
+	USB_DESC_TYPE_ENDPOINT, /* bDescriptorType: Endpoint */
+	CS_CONTROL_EPIN_ADDR,   /* bEndpointAddress: command replies */
+	USBD_EP_TYPE_BULK,      /* bmAttributes: Bulk */
+	LOBYTE(CS_CONTROL_EP_SIZE), /* wMaxPacketSize */
+	HIBYTE(CS_CONTROL_EP_SIZE),
+	0x00,   /* bInterval: ignored for Bulk transfer */
+
+	0x07,   /* bLength: Endpoint Descriptor size */
+	USB_DESC_TYPE_ENDPOINT, /* bDescriptorType: Endpoint */
+	CS_CONTROL_EVENT_EP_ADDR, /* bEndpointAddress: asynchronous events */
+	USBD_EP_TYPE_INTR,      /* bmAttributes: Interrupt */
+	LOBYTE(CS_CONTROL_EVENT_EP_SIZE), /* wMaxPacketSize */
+	HIBYTE(CS_CONTROL_EVENT_EP_SIZE),
+	CONTROL_FS_BINTERVAL,   /* bInterval: polling interval, ms */
+
+	0x07,   /* bLength: Endpoint Descriptor size */
+	USB_DESC_TYPE_ENDPOINT, /* bDescriptorType: Endpoint */
+	CS_CONTROL_CAPTURE_EP_ADDR, /* bEndpointAddress: capture record */
+	USBD_EP_TYPE_BULK,      /* bmAttributes: Bulk */
+	LOBYTE(CS_CONTROL_CAPTURE_EP_SIZE), /* wMaxPacketSize */
+	HIBYTE(CS_CONTROL_CAPTURE_EP_SIZE),
+	0x00    /* bInterval: ignored for Bulk transfer */
 };
 
+/* class data is allocated statically, heap is not used */
+static USBD_CONTROL_HandleTypeDef USBD_CONTROL_Handle;
+
 /* USB Standard Device Descriptor */
 __ALIGN_BEGIN static uint8_t USBD_CONTROL_DeviceQualifierDesc[USB_LEN_DEV_QUALIFIER_DESC] __ALIGN_END =
 {
@@ -166,6 +219,65 @@ __ALIGN_BEGIN static uint8_t USBD_CONTROL_DeviceQualifierDesc[USB_LEN_DEV_QUALIF
   * @{
   */
 
+/**
+  * @brief  USBD_CONTROL_Init
+  *         Initialize the CONTROL interface: open bulk endpoints
+  * @param  pdev: device instance
+  * @param  cfgidx: Configuration index
+  * @retval status
+  */
+static uint8_t  USBD_CONTROL_Init(USBD_HandleTypeDef *pdev, uint8_t cfgidx)
+{
+  USBD_CONTROL_HandleTypeDef *hcs = &USBD_CONTROL_Handle;
+
+  USBD_LL_OpenEP(pdev, CS_CONTROL_EPOUT_ADDR, USBD_EP_TYPE_BULK, CS_CONTROL_EP_SIZE);
+  pdev->ep_out[CS_CONTROL_EPOUT_ADDR & 0xFU].is_used = 1U;
+
+  USBD_LL_OpenEP(pdev, CS_CONTROL_EPIN_ADDR, USBD_EP_TYPE_BULK, CS_CONTROL_EP_SIZE);
+  pdev->ep_in[CS_CONTROL_EPIN_ADDR & 0xFU].is_used = 1U;
+
+  USBD_LL_OpenEP(pdev, CS_CONTROL_EVENT_EP_ADDR, USBD_EP_TYPE_INTR, CS_CONTROL_EVENT_EP_SIZE);
+  pdev->ep_in[CS_CONTROL_EVENT_EP_ADDR & 0xFU].is_used = 1U;
+
+  USBD_LL_OpenEP(pdev, CS_CONTROL_CAPTURE_EP_ADDR, USBD_EP_TYPE_BULK, CS_CONTROL_CAPTURE_EP_SIZE);
+  pdev->ep_in[CS_CONTROL_CAPTURE_EP_ADDR & 0xFU].is_used = 1U;
+
+  hcs->AltSetting = 0U;
+  hcs->EventBusy = 0U;
+  pdev->pClassData = hcs;
+
+  /* Prepare Out endpoint to receive the first command packet */
+  USBD_LL_PrepareReceive(pdev, CS_CONTROL_EPOUT_ADDR, hcs->RxBuffer, CS_CONTROL_EP_SIZE);
+
+  return USBD_OK;
+}
+
+/**
+  * @brief  USBD_CONTROL_DeInit
+  *         DeInitialize the CONTROL layer
+  * @param  pdev: device instance
+  * @param  cfgidx: Configuration index
+  * @retval status
+  */
+static uint8_t  USBD_CONTROL_DeInit(USBD_HandleTypeDef *pdev, uint8_t cfgidx)
+{
+  USBD_LL_CloseEP(pdev, CS_CONTROL_EPOUT_ADDR);
+  pdev->ep_out[CS_CONTROL_EPOUT_ADDR & 0xFU].is_used = 0U;
+
+  USBD_LL_CloseEP(pdev, CS_CONTROL_EPIN_ADDR);
+  pdev->ep_in[CS_CONTROL_EPIN_ADDR & 0xFU].is_used = 0U;
+
+  USBD_LL_CloseEP(pdev, CS_CONTROL_EVENT_EP_ADDR);
+  pdev->ep_in[CS_CONTROL_EVENT_EP_ADDR & 0xFU].is_used = 0U;
+
+  USBD_LL_CloseEP(pdev, CS_CONTROL_CAPTURE_EP_ADDR);
+  pdev->ep_in[CS_CONTROL_CAPTURE_EP_ADDR & 0xFU].is_used = 0U;
+
+  pdev->pClassData = NULL;
+
+  return USBD_OK;
+}
+
 /**
   * @brief  USBD_CONTROL_Setup
   *         Handle the CONTROL specific requests
@@ -178,50 +290,144 @@ static uint8_t  USBD_CONTROL_Setup(USBD_HandleTypeDef *pdev,
 {
   USBD_CONTROL_HandleTypeDef *hcs = (USBD_CONTROL_HandleTypeDef *)pdev->pClassData;
   uint16_t status_info = 0U;
+  uint16_t *wave = NULL;
   uint8_t ret = USBD_OK;
+  uint8_t cmd = 0U;
 
   switch (req->bmRequest & USB_REQ_TYPE_MASK)
   {
     case USB_REQ_TYPE_VENDOR :
     	// handle vendor requests with sine CS control commands
-      switch (req->bRequest)
+      if (req->bRequest == CS_CONTROL_GET_STATUS)
       {
-        case CS_CONTROL_POWER_CTRL:
-		  sineCS_drv->PowerCtrl((uint8_t)(req->wValue & 0x01));
-		  USBD_CtlSendStatus(pdev);
-          break;
-
-        case CS_CONTROL_CALIB_MODE_CTRL:
-          sineCS_drv->CalibrationModeCtrl((uint8_t)(req->wValue & 0x01));
+        // status block is read in a single transfer
+        if (hcs != NULL)
+        {
+          sineCS_drv->GetStatus(&hcs->Status);
+          USBD_CtlSendData(pdev, (uint8_t *)&hcs->Status, MIN(sizeof(hcs->Status), req->wLength));
+        }
+        else
+        {
+          USBD_CtlError(pdev, req);
+          ret = USBD_FAIL;
+        }
+        break;
+      }
+      if (req->bRequest == CS_CONTROL_GET_PERF)
+      {
+        if (hcs != NULL)
+        {
+          sineCS_drv->GetPerf(&hcs->Perf, (uint8_t)(req->wValue & 0x01U));
+          USBD_CtlSendData(pdev, (uint8_t *)&hcs->Perf, MIN(sizeof(hcs->Perf), req->wLength));
+        }
+        else
+        {
+          USBD_CtlError(pdev, req);
+          ret = USBD_FAIL;
+        }
+        break;
+      }
+      if (req->bRequest == CS_CONTROL_GET_LINEARIZATION)
+      {
+        if (hcs != NULL)
+        {
+          sineCS_drv->GetLinearization((int8_t *)hcs->CtlBuffer);
+          USBD_CtlSendData(pdev, hcs->CtlBuffer, MIN(SINE_LIN_KNOTS, req->wLength));
+        }
+        else
+        {
+          USBD_CtlError(pdev, req);
+          ret = USBD_FAIL;
+        }
+        break;
+      }
+      if (req->bRequest == CS_CONTROL_SET_LINEARIZATION)
+      {
+        // the whole curve is received in data stage and taken in EP0_RxReady
+        if ((hcs != NULL) && (req->wLength == SINE_LIN_KNOTS))
+        {
+          hcs->CtlRequest = req->bRequest;
+          USBD_CtlPrepareRx(pdev, hcs->CtlBuffer, req->wLength);
+        }
+        else
+        {
+          USBD_CtlError(pdev, req);
+          ret = USBD_FAIL;
+        }
+        break;
+      }
+      if (req->bRequest == CS_CONTROL_SET_SEGMENT)
+      {
+        if ((hcs != NULL) && (req->wLength == sizeof(sineCS_segment)) && (req->wIndex < SINE_SEQUENCE_SEGMENTS))
+        {
+          hcs->CtlRequest = req->bRequest;
+          hcs->CtlIndex = req->wIndex;
+          USBD_CtlPrepareRx(pdev, hcs->CtlBuffer, req->wLength);
+        }
+        else
+        {
+          USBD_CtlError(pdev, req);
+          ret = USBD_FAIL;
+        }
+        break;
+      }
+      if (req->bRequest == CS_CONTROL_WAVE_WRITE)
+      {
+        // samples are received straight into the slot, which is refused while it is active
+        if ((hcs != NULL) && ((req->wLength & 0x01U) == 0U))
+        {
+          wave = sineCS_drv->GetWaveSlot(req->wIndex, req->wLength/2U);
+        }
+        if (wave != NULL)
+        {
+          USBD_CtlPrepareRx(pdev, (uint8_t *)wave, req->wLength);
+        }
+        else
+        {
+          USBD_CtlError(pdev, req);
+          ret = USBD_FAIL;
+        }
+        break;
+      }
+      if (req->bRequest == CS_CONTROL_CAPTURE_READ)
+      {
+        // record is streamed over capture endpoint from its start
+        if (hcs != NULL)
+        {
+          hcs->CaptureIndex = 0U;
+        }
+        if ((hcs != NULL) && USBD_CONTROL_SendCapture(pdev))
+        {
           USBD_CtlSendStatus(pdev);
-          break;
-
-        case CS_CONTROL_SAVE_CALIB_DATA:
-        	sineCS_drv->SaveCalibrationData();
-        	USBD_CtlSendStatus(pdev);
-          break;
-
-        case CS_CONTROL_SET_RAW_OFFSET:
-        	sineCS_drv->SetRawOffset(req->wValue);
-        	USBD_CtlSendStatus(pdev);
-          break;
-
-        case CS_CONTROL_SET_RAW_AMPL:
-        	sineCS_drv->SetRawAmplitude(req->wValue);
-        	USBD_CtlSendStatus(pdev);
-          break;
-
-        case CS_CONTROL_SET_AMPL:
-        	sineCS_drv->SetAmplitude((uint8_t)(req->wValue & 0xFF));
-        	USBD_CtlSendStatus(pdev);
-          break;
-
-        default:
-          // skip 0x55 request
-          if (req->bmRequest == 0xC0 && req->bRequest == 0x55) return ret;
+        }
+        else
+        {
           USBD_CtlError(pdev, req);
           ret = USBD_FAIL;
-          break;
+        }
+        break;
+      }
+      cmd = USBD_CONTROL_GetDriverCmd(req->bRequest);
+      if (cmd == 0U)
+      {
+        // skip 0x55 request
+        if (req->bmRequest == 0xC0 && req->bRequest == 0x55) return ret;
+        USBD_CtlError(pdev, req);
+        ret = USBD_FAIL;
+      }
+      // commands are only posted here and executed from main loop
+      else
+      {
+        if (sineCS_drv->PostCommand(cmd, req->wValue | ((uint32_t)req->wIndex << 16)))
+        {
+          USBD_CtlSendStatus(pdev);
+        }
+        else
+        {
+          // queue is full: request is stalled, the host retries it
+          USBD_CtlError(pdev, req);
+          ret = USBD_FAIL;
+        }
       }
       break;
 
@@ -283,6 +489,279 @@ static uint8_t  USBD_CONTROL_Setup(USBD_HandleTypeDef *pdev,
   return ret;
 }
 
+/**
+  * @brief  USBD_CONTROL_GetDriverCmd
+  *         Convert vendor request code into sine CS driver command
+  * @param  request: CS_CONTROL_x request code
+  * @retval SINE_CS_CMD_x command code, 0 - unknown request
+  */
+static uint8_t  USBD_CONTROL_GetDriverCmd(uint8_t request)
+{
+  uint8_t cmd = 0U;
+
+  switch (request)
+  {
+    case CS_CONTROL_POWER_CTRL:
+      cmd = SINE_CS_CMD_POWER_CTRL;
+      break;
+
+    case CS_CONTROL_CALIB_MODE_CTRL:
+      cmd = SINE_CS_CMD_CALIB_MODE_CTRL;
+      break;
+
+    case CS_CONTROL_SAVE_CALIB_DATA:
+      cmd = SINE_CS_CMD_SAVE_CALIB_DATA;
+      break;
+
+    case CS_CONTROL_SET_RAW_OFFSET:
+      cmd = SINE_CS_CMD_SET_RAW_OFFSET;
+      break;
+
+    case CS_CONTROL_SET_RAW_AMPL:
+      cmd = SINE_CS_CMD_SET_RAW_AMPL;
+      break;
+
+    case CS_CONTROL_SET_AMPL:
+      cmd = SINE_CS_CMD_SET_AMPL;
+      break;
+
+    case CS_CONTROL_SET_FREQ:
+      cmd = SINE_CS_CMD_SET_FREQ;
+      break;
+
+    case CS_CONTROL_SET_RAMP_RATE:
+      cmd = SINE_CS_CMD_SET_RAMP_RATE;
+      break;
+
+    case CS_CONTROL_SET_DEAD_TIME:
+      cmd = SINE_CS_CMD_SET_DEAD_TIME;
+      break;
+
+    case CS_CONTROL_DEAD_TIME_SWEEP:
+      cmd = SINE_CS_CMD_DEAD_TIME_SWEEP;
+      break;
+
+    case CS_CONTROL_SAVE_SETTINGS:
+      cmd = SINE_CS_CMD_SAVE_SETTINGS;
+      break;
+
+    case CS_CONTROL_SET_CAL_POINT:
+      cmd = SINE_CS_CMD_SET_CAL_POINT;
+      break;
+
+    case CS_CONTROL_FULL_PERIOD_CTRL:
+      cmd = SINE_CS_CMD_FULL_PERIOD_CTRL;
+      break;
+
+    case CS_CONTROL_CALIB_POLARITY:
+      cmd = SINE_CS_CMD_CALIB_POLARITY;
+      break;
+
+    case CS_CONTROL_LINEARIZATION_CTRL:
+      cmd = SINE_CS_CMD_LINEARIZATION_CTRL;
+      break;
+
+    case CS_CONTROL_LOOP_CTRL:
+      cmd = SINE_CS_CMD_LOOP_CTRL;
+      break;
+
+    case CS_CONTROL_CAPTURE_CTRL:
+      cmd = SINE_CS_CMD_CAPTURE_CTRL;
+      break;
+
+    case CS_CONTROL_WAVE_ACTIVATE:
+      cmd = SINE_CS_CMD_WAVE_ACTIVATE;
+      break;
+
+    case CS_CONTROL_WAVE_CTRL:
+      cmd = SINE_CS_CMD_WAVE_CTRL;
+      break;
+
+    case CS_CONTROL_SET_HARMONIC:
+      cmd = SINE_CS_CMD_SET_HARMONIC;
+      break;
+
+    case CS_CONTROL_HARMONICS_CTRL:
+      cmd = SINE_CS_CMD_HARMONICS_CTRL;
+      break;
+
+    case CS_CONTROL_SEQUENCE_CTRL:
+      cmd = SINE_CS_CMD_SEQUENCE_CTRL;
+      break;
+
+    case CS_CONTROL_BURST_CTRL:
+      cmd = SINE_CS_CMD_BURST_CTRL;
+      break;
+
+    default:
+      break;
+  }
+  return cmd;
+}
+
+/**
+  * @brief  USBD_CONTROL_DataOut
+  *         Handle batched command packet: post all commands and send status for each of them.
+  *         Next packet is received after the reply is sent
+  * @param  pdev: device instance
+  * @param  epnum: endpoint index
+  * @retval status
+  */
+static uint8_t  USBD_CONTROL_DataOut(USBD_HandleTypeDef *pdev, uint8_t epnum)
+{
+  USBD_CONTROL_HandleTypeDef *hcs = (USBD_CONTROL_HandleTypeDef *)pdev->pClassData;
+  uint32_t rx_len = USBD_LL_GetRxDataSize(pdev, epnum);
+  uint8_t cmds_num = 0U;
+  uint8_t *rec;
+  uint8_t cmd;
+  uint8_t status;
+
+  if (rx_len >= CS_CONTROL_BULK_HDR_SIZE)
+  {
+    cmds_num = hcs->RxBuffer[1];
+  }
+  if (cmds_num > CS_CONTROL_BULK_MAX_CMDS)
+  {
+    cmds_num = CS_CONTROL_BULK_MAX_CMDS;
+  }
+
+  hcs->TxBuffer[0] = hcs->RxBuffer[0];
+  hcs->TxBuffer[1] = cmds_num;
+  for (uint8_t i = 0U; i < cmds_num; i++)
+  {
+    rec = &hcs->RxBuffer[CS_CONTROL_BULK_HDR_SIZE + i*CS_CONTROL_BULK_CMD_SIZE];
+    cmd = USBD_CONTROL_GetDriverCmd(rec[0]);
+
+    if ((CS_CONTROL_BULK_HDR_SIZE + (i + 1U)*CS_CONTROL_BULK_CMD_SIZE) > rx_len)
+    {
+      status = CS_CONTROL_STATUS_NOT_EXECUTED;
+    }
+    else if (cmd == 0U)
+    {
+      status = CS_CONTROL_STATUS_UNKNOWN;
+    }
+    else if (sineCS_drv->PostCommand(cmd, rec[1] | (rec[2] << 8) | (rec[3] << 16) | ((uint32_t)rec[4] << 24)))
+    {
+      status = CS_CONTROL_STATUS_OK;
+    }
+    else
+    {
+      status = CS_CONTROL_STATUS_BUSY;
+    }
+    hcs->TxBuffer[CS_CONTROL_BULK_HDR_SIZE + i*CS_CONTROL_BULK_STATUS_SIZE] = rec[0];
+    hcs->TxBuffer[CS_CONTROL_BULK_HDR_SIZE + i*CS_CONTROL_BULK_STATUS_SIZE + 1U] = status;
+  }
+
+  USBD_LL_Transmit(pdev, CS_CONTROL_EPIN_ADDR, hcs->TxBuffer,
+                   CS_CONTROL_BULK_HDR_SIZE + cmds_num*CS_CONTROL_BULK_STATUS_SIZE);
+
+  return USBD_OK;
+}
+
+/**
+  * @brief  USBD_CONTROL_EP0_RxReady
+  *         Control OUT data stage is received
+  * @param  pdev: device instance
+  * @retval status
+  */
+static uint8_t  USBD_CONTROL_EP0_RxReady(USBD_HandleTypeDef *pdev)
+{
+  USBD_CONTROL_HandleTypeDef *hcs = (USBD_CONTROL_HandleTypeDef *)pdev->pClassData;
+
+  if (hcs == NULL) return USBD_FAIL;
+
+  if (hcs->CtlRequest == CS_CONTROL_SET_LINEARIZATION)
+  {
+    sineCS_drv->LoadLinearization((const int8_t *)hcs->CtlBuffer);
+  }
+  else if (hcs->CtlRequest == CS_CONTROL_SET_SEGMENT)
+  {
+    sineCS_drv->LoadSegment((uint8_t)hcs->CtlIndex, (const sineCS_segment *)hcs->CtlBuffer);
+  }
+  hcs->CtlRequest = 0U;
+
+  return USBD_OK;
+}
+
+/**
+  * @brief  USBD_CONTROL_SendEvent
+  *         Send the oldest pending event if event endpoint is free
+  * @param  pdev: device instance
+  * @retval None
+  */
+static void  USBD_CONTROL_SendEvent(USBD_HandleTypeDef *pdev)
+{
+  USBD_CONTROL_HandleTypeDef *hcs = (USBD_CONTROL_HandleTypeDef *)pdev->pClassData;
+
+  if ((hcs == NULL) || hcs->EventBusy) return;
+
+  if (sineCS_drv->GetEvent(&hcs->Event))
+  {
+    hcs->EventBusy = 1U;
+    USBD_LL_Transmit(pdev, CS_CONTROL_EVENT_EP_ADDR, (uint8_t *)&hcs->Event, sizeof(hcs->Event));
+  }
+}
+
+/**
+  * @brief  USBD_CONTROL_SendCapture
+  *         Send the next capture record packet
+  * @param  pdev: device instance
+  * @retval 1 - packet is sent, 0 - record end is reached or capture is not done
+  */
+static uint8_t  USBD_CONTROL_SendCapture(USBD_HandleTypeDef *pdev)
+{
+  USBD_CONTROL_HandleTypeDef *hcs = (USBD_CONTROL_HandleTypeDef *)pdev->pClassData;
+  uint16_t num = sineCS_drv->ReadCapture(hcs->CaptureBuffer, hcs->CaptureIndex, CS_CONTROL_CAPTURE_CHUNK);
+
+  if (num == 0U) return 0U;
+
+  hcs->CaptureIndex += num;
+  USBD_LL_Transmit(pdev, CS_CONTROL_CAPTURE_EP_ADDR, (uint8_t *)hcs->CaptureBuffer, num*4U);
+
+  return 1U;
+}
+
+/**
+  * @brief  USBD_CONTROL_SOF
+  *         Events are posted from any context, so the pending ones are checked each frame
+  * @param  pdev: device instance
+  * @retval status
+  */
+static uint8_t  USBD_CONTROL_SOF(USBD_HandleTypeDef *pdev)
+{
+  USBD_CONTROL_SendEvent(pdev);
+
+  return USBD_OK;
+}
+
+/**
+  * @brief  USBD_CONTROL_DataIn
+  *         Reply is sent, receive next command packet
+  * @param  pdev: device instance
+  * @param  epnum: endpoint index
+  * @retval status
+  */
+static uint8_t  USBD_CONTROL_DataIn(USBD_HandleTypeDef *pdev, uint8_t epnum)
+{
+  USBD_CONTROL_HandleTypeDef *hcs = (USBD_CONTROL_HandleTypeDef *)pdev->pClassData;
+
+  if ((epnum | 0x80U) == CS_CONTROL_EPIN_ADDR)
+  {
+    USBD_LL_PrepareReceive(pdev, CS_CONTROL_EPOUT_ADDR, hcs->RxBuffer, CS_CONTROL_EP_SIZE);
+  }
+  else if ((epnum | 0x80U) == CS_CONTROL_EVENT_EP_ADDR)
+  {
+    hcs->EventBusy = 0U;
+    USBD_CONTROL_SendEvent(pdev);
+  }
+  else if ((epnum | 0x80U) == CS_CONTROL_CAPTURE_EP_ADDR)
+  {
+    (void)USBD_CONTROL_SendCapture(pdev);
+  }
+
+  return USBD_OK;
+}
+
 /**
   * @brief  USBD_CONTROL_GetFSCfgDesc
   *         return FS configuration descriptor
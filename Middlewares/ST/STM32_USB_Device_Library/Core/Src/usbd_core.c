@@ -224,7 +224,18 @@ USBD_StatusTypeDef  USBD_RunTestMode(USBD_HandleTypeDef  *pdev)
 
 USBD_StatusTypeDef USBD_SetClassConfig(USBD_HandleTypeDef  *pdev, uint8_t cfgidx)
 {
-  return USBD_OK;
+  USBD_StatusTypeDef ret = USBD_FAIL;
+
+  if (pdev->pClass != NULL)
+  {
+    /* Set configuration  and Start the Class*/
+    if (pdev->pClass->Init(pdev, cfgidx) == 0U)
+    {
+      ret = USBD_OK;
+    }
+  }
+
+  return ret;
 }
 
 /**
@@ -237,6 +248,11 @@ USBD_StatusTypeDef USBD_SetClassConfig(USBD_HandleTypeDef  *pdev, uint8_t cfgidx
 USBD_StatusTypeDef USBD_ClrClassConfig(USBD_HandleTypeDef  *pdev, uint8_t cfgidx)
 {
   /* Clear configuration  and De-initialize the Class process*/
+  if (pdev->pClass != NULL)
+  {
+    pdev->pClass->DeInit(pdev, cfgidx);
+  }
+
   return USBD_OK;
 }
 